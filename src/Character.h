@@ -25,6 +25,7 @@
 
 // terminal
 #include "CharacterColor.h"
+#include "CharacterStyleTable.h"
 #include "CharacterWidth.h"
 
 // Qt
@@ -33,8 +34,6 @@
 namespace terminal {
 typedef unsigned char LineProperty;
 
-typedef quint16 RenditionFlags;
-
 const int LINE_DEFAULT      = 0;
 const int LINE_WRAPPED      = (1 << 0);
 const int LINE_DOUBLEWIDTH  = (1 << 1);
@@ -53,14 +52,38 @@ const RenditionFlags RE_STRIKEOUT      = (1 << 8);
 const RenditionFlags RE_CONCEAL        = (1 << 9);
 const RenditionFlags RE_OVERLINE       = (1 << 10);
 
+// rendition flags which belong to a single character rather than its style
+const RenditionFlags RE_CELL_FLAGS     = RE_CURSOR | RE_EXTENDED_CHAR;
+
 /**
  * A single character in the terminal which consists of a unicode character
  * value, foreground and background colors and a set of rendition attributes
  * which specify how it should be drawn.
+ *
+ * The colors and rendition attributes are stored as an index into the
+ * CharacterStyleTable, so that a character takes 8 bytes.
  */
 class Character
 {
 public:
+    /** Constructs a space drawn with the default colors and rendition. */
+    inline Character()
+        : character(' ')
+        , style(CharacterStyleTable::DefaultStyle)
+        , cellRendition(DEFAULT_RENDITION)
+        , isRealCharacter(true) { }
+
+    /**
+     * Constructs a new character with the default colors and rendition.
+     *
+     * @param _c The unicode character value of this character.
+     */
+    explicit inline Character(uint _c)
+        : character(_c)
+        , style(CharacterStyleTable::DefaultStyle)
+        , cellRendition(DEFAULT_RENDITION)
+        , isRealCharacter(true) { }
+
     /**
      * Constructs a new character.
      *
@@ -72,15 +95,14 @@ public:
      * @param _real Indicate whether this character really exists, or exists
      *              simply as place holder.
      */
-    explicit inline Character(uint _c = ' ',
-                              CharacterColor  _f = CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR),
-                              CharacterColor  _b = CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR),
-                              RenditionFlags  _r = DEFAULT_RENDITION,
-                              bool _real = true)
+    inline Character(uint _c,
+                     const CharacterColor &_f,
+                     const CharacterColor &_b,
+                     RenditionFlags  _r = DEFAULT_RENDITION,
+                     bool _real = true)
         : character(_c)
-        , rendition(_r)
-        , foregroundColor(_f)
-        , backgroundColor(_b)
+        , style(CharacterStyleTable::intern(_f, _b, _r & ~RE_CELL_FLAGS))
+        , cellRendition(_r & RE_CELL_FLAGS)
         , isRealCharacter(_real) { }
 
     /** The unicode character value for this character.
@@ -91,14 +113,14 @@ public:
      */
     uint character;
 
-    /** A combination of RENDITION flags which specify options for drawing the character. */
-    RenditionFlags rendition;
-
-    /** The foreground color used to draw this character. */
-    CharacterColor foregroundColor;
+    /**
+     * The index of the colors and rendition flags of this character in the
+     * CharacterStyleTable.  Characters with the same format have the same style.
+     */
+    quint32 style : 24;
 
-    /** The color used to draw this character's background. */
-    CharacterColor backgroundColor;
+    /** The rendition flags of this character which are not part of its style, see RE_CELL_FLAGS. */
+    quint32 cellRendition : 7;
 
     /** Indicate whether this character really exists, or exists simply as place holder.
      *
@@ -109,7 +131,51 @@ public:
      *    PlaceHolderCharacter: a character which exists as place holder
      *    TabStopCharacter: a special place holder for HT("\t")
      */
-    bool isRealCharacter;
+    quint32 isRealCharacter : 1;
+
+    /** A combination of RENDITION flags which specify options for drawing the character. */
+    inline RenditionFlags rendition() const
+    {
+        return CharacterStyleTable::style(style).rendition | cellRendition;
+    }
+
+    /** The foreground color used to draw this character. */
+    inline const CharacterColor &foregroundColor() const
+    {
+        return CharacterStyleTable::style(style).foregroundColor;
+    }
+
+    /** The color used to draw this character's background. */
+    inline const CharacterColor &backgroundColor() const
+    {
+        return CharacterStyleTable::style(style).backgroundColor;
+    }
+
+    /** Sets the colors and rendition flags of this character. */
+    inline void setFormat(const CharacterColor &f, const CharacterColor &b, RenditionFlags r)
+    {
+        style = CharacterStyleTable::intern(f, b, r & ~RE_CELL_FLAGS);
+        cellRendition = r & RE_CELL_FLAGS;
+    }
+
+    inline void setRendition(RenditionFlags r)
+    {
+        if ((r & ~RE_CELL_FLAGS) == (rendition() & ~RE_CELL_FLAGS)) {
+            cellRendition = r & RE_CELL_FLAGS;
+        } else {
+            setFormat(foregroundColor(), backgroundColor(), r);
+        }
+    }
+
+    inline void setForegroundColor(const CharacterColor &f)
+    {
+        setFormat(f, backgroundColor(), rendition());
+    }
+
+    inline void setBackgroundColor(const CharacterColor &b)
+    {
+        setFormat(foregroundColor(), b, rendition());
+    }
 
     /**
      * returns true if the format (color, rendition flag) of the compared characters is equal
@@ -130,7 +196,7 @@ public:
 
     inline bool isSpace() const
     {
-        if (rendition & RE_EXTENDED_CHAR) {
+        if (cellRendition & RE_EXTENDED_CHAR) {
             return false;
         } else {
             return QChar(character).isSpace();
@@ -171,10 +237,10 @@ inline bool operator !=(const Character &a, const Character &b)
 
 inline bool Character::equalsFormat(const Character &other) const
 {
-    return backgroundColor == other.backgroundColor
-           && foregroundColor == other.foregroundColor
-           && rendition == other.rendition;
+    return style == other.style && cellRendition == other.cellRendition;
 }
+
+static_assert(sizeof(Character) == 8, "Character is expected to be packed into 8 bytes");
 }
 Q_DECLARE_TYPEINFO(terminal::Character, Q_MOVABLE_TYPE);
 
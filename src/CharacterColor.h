@@ -111,10 +111,11 @@ enum ColorTableIndex {
 class CharacterColor
 {
     friend class Character;
+    friend class CharacterStyleTable;
 
 public:
     /** Constructs a new CharacterColor whose color and color space are undefined. */
-    CharacterColor() :
+    constexpr CharacterColor() :
         _colorSpace(COLOR_SPACE_UNDEFINED),
         _u(0),
         _v(0),
@@ -132,7 +133,7 @@ public:
      *
      * TODO : Add documentation about available color spaces.
      */
-    CharacterColor(quint8 colorSpace, int co) :
+    constexpr CharacterColor(quint8 colorSpace, int co) :
         _colorSpace(colorSpace),
         _u(0),
         _v(0),
@@ -0,0 +1,234 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "CharacterStyleTable.h"
+
+// Qt
+#include <QCoreApplication>
+
+// terminal
+#include "Character.h"
+#include "TerminalDebug.h"
+
+using namespace terminal;
+
+// All of these are constant-initialized, the first page already holds the
+// default style.
+CharacterStyle CharacterStyleTable::_firstPage[PageSize] = {
+    CharacterStyle(CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR),
+                   CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR),
+                   0)
+};
+CharacterStyle *CharacterStyleTable::_pages[PageCount] = { _firstPage };
+QBasicMutex CharacterStyleTable::_mutex;
+QHash<CharacterStyleTable::Key, quint32> *CharacterStyleTable::_index = nullptr;
+quint32 CharacterStyleTable::_count = 1;
+QVector<quint32> *CharacterStyleTable::_free = nullptr;
+QList<CharacterStyleUser *> *CharacterStyleTable::_users = nullptr;
+quint32 CharacterStyleTable::_added = 0;
+bool CharacterStyleTable::_collectionScheduled = false;
+bool CharacterStyleTable::_warnedFull = false;
+QBitArray *CharacterStyleTable::_interned = nullptr;
+
+void CharacterStyleMarks::mark(const Character *characters, int count)
+{
+    // characters come in runs of the same style
+    quint32 last = CharacterStyleTable::DefaultStyle;
+    for (int i = 0; i < count; i++) {
+        if (characters[i].style != last) {
+            last = characters[i].style;
+            mark(last);
+        }
+    }
+}
+
+CharacterStyleUser::CharacterStyleUser()
+{
+    QMutexLocker locker(&CharacterStyleTable::_mutex);
+
+    if (CharacterStyleTable::_users == nullptr) {
+        CharacterStyleTable::_users = new QList<CharacterStyleUser *>();
+    }
+    CharacterStyleTable::_users->append(this);
+}
+
+CharacterStyleUser::~CharacterStyleUser()
+{
+    QMutexLocker locker(&CharacterStyleTable::_mutex);
+
+    CharacterStyleTable::_users->removeOne(this);
+}
+
+int CharacterStyleTable::count()
+{
+    QMutexLocker locker(&_mutex);
+
+    return int(_count) - (_free != nullptr ? _free->size() : 0);
+}
+
+quint32 CharacterStyleTable::insert(const CharacterStyle &style)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (_index == nullptr) {
+        _index = new QHash<Key, quint32>();
+        _index->insert(key(_firstPage[DefaultStyle]), DefaultStyle);
+        _free = new QVector<quint32>();
+    }
+
+    const Key styleKey = key(style);
+    auto it = _index->constFind(styleKey);
+    if (it == _index->constEnd()) {
+        quint32 index;
+        if (!_free->isEmpty()) {
+            index = _free->takeLast();
+        } else if (_count < PageCount * PageSize) {
+            index = _count++;
+            CharacterStyle *&page = _pages[index >> PageBits];
+            if (page == nullptr) {
+                page = new CharacterStyle[PageSize];
+            }
+        } else {
+            scheduleCollection();
+            return substitute(style);
+        }
+        _pages[index >> PageBits][index & (PageSize - 1)] = style;
+        it = _index->insert(styleKey, index);
+
+        if (++_added >= CollectionInterval) {
+            scheduleCollection();
+        }
+    }
+
+    if (_interned != nullptr && it.value() < quint32(_interned->size())) {
+        _interned->setBit(int(it.value()));
+    }
+    return it.value();
+}
+
+quint32 CharacterStyleTable::substitute(const CharacterStyle &style)
+{
+    if (!_warnedFull) {
+        qCWarning(TerminalDebug) << "All" << _count << "character styles are in use,"
+                                 << "new styles are drawn without their rendition flags until some are freed";
+        _warnedFull = true;
+    }
+
+    const CharacterStyle plain(style.foregroundColor, style.backgroundColor, 0);
+    const quint32 index = _index->value(key(plain), DefaultStyle);
+    if (_interned != nullptr && index < quint32(_interned->size())) {
+        _interned->setBit(int(index));
+    }
+    return index;
+}
+
+void CharacterStyleTable::scheduleCollection()
+{
+    QCoreApplication *application = QCoreApplication::instance();
+    if (_collectionScheduled || application == nullptr) {
+        return;
+    }
+
+    _collectionScheduled = true;
+    QMetaObject::invokeMethod(application, &CharacterStyleTable::collect, Qt::QueuedConnection);
+}
+
+void CharacterStyleTable::collect()
+{
+    QList<CharacterStyleUser *> users;
+    int size;
+    {
+        QMutexLocker locker(&_mutex);
+
+        _collectionScheduled = false;
+        if (_index == nullptr || _interned != nullptr) {
+            return;
+        }
+        _added = 0;
+        size = int(_count);
+        _interned = new QBitArray(size);
+        if (_users != nullptr) {
+            users = *_users;
+        }
+    }
+
+    // users are only destroyed on this thread, so none goes away meanwhile
+    CharacterStyleMarks marks(size);
+    marks.mark(DefaultStyle);
+    for (CharacterStyleUser *user : qAsConst(users)) {
+        user->markStyles(marks);
+    }
+
+    QMutexLocker locker(&_mutex);
+
+    const int before = _free->size();
+    for (int index = 1; index < size; index++) {
+        if (marks._marks.testBit(index) || _interned->testBit(index)) {
+            continue;
+        }
+        // the key of a free entry belongs to another entry or to none
+        const Key styleKey = key(style(quint32(index)));
+        const auto it = _index->constFind(styleKey);
+        if (it != _index->constEnd() && it.value() == quint32(index)) {
+            _index->erase(it);
+            _free->append(quint32(index));
+        }
+    }
+    delete _interned;
+    _interned = nullptr;
+    _warnedFull = false;
+
+    qCDebug(TerminalDebug) << "Freed" << _free->size() - before << "of" << size << "character styles";
+}
+
+void CharacterStyleTable::save(quint32 index, quint32 data[SavedSize])
+{
+    const CharacterStyle &saved = style(index);
+    data[0] = colorKey(saved.foregroundColor);
+    data[1] = colorKey(saved.backgroundColor);
+    data[2] = saved.rendition;
+}
+
+quint32 CharacterStyleTable::restore(const quint32 data[SavedSize])
+{
+    return intern(color(data[0]), color(data[1]), RenditionFlags(data[2]));
+}
+
+CharacterStyleTable::Key CharacterStyleTable::key(const CharacterStyle &style)
+{
+    return Key(quint64(colorKey(style.foregroundColor)) << 32 | colorKey(style.backgroundColor),
+               style.rendition);
+}
+
+quint32 CharacterStyleTable::colorKey(const CharacterColor &color)
+{
+    return quint32(color._colorSpace) << 24 | quint32(color._u) << 16
+           | quint32(color._v) << 8 | quint32(color._w);
+}
+
+CharacterColor CharacterStyleTable::color(quint32 colorKey)
+{
+    CharacterColor color;
+    color._colorSpace = quint8(colorKey >> 24);
+    color._u = quint8(colorKey >> 16);
+    color._v = quint8(colorKey >> 8);
+    color._w = quint8(colorKey);
+    return color;
+}
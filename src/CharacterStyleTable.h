@@ -0,0 +1,223 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef CHARACTERSTYLETABLE_H
+#define CHARACTERSTYLETABLE_H
+
+// Qt
+#include <QBitArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QVector>
+
+// terminal
+#include "CharacterColor.h"
+
+namespace terminal {
+typedef quint16 RenditionFlags;
+
+class Character;
+
+/**
+ * The colors and rendition flags which a run of characters is drawn with.
+ */
+struct CharacterStyle
+{
+    constexpr CharacterStyle() :
+        foregroundColor(),
+        backgroundColor(),
+        rendition(0)
+    {
+    }
+
+    constexpr CharacterStyle(const CharacterColor &f, const CharacterColor &b, RenditionFlags r) :
+        foregroundColor(f),
+        backgroundColor(b),
+        rendition(r)
+    {
+    }
+
+    CharacterColor foregroundColor;
+    CharacterColor backgroundColor;
+    RenditionFlags rendition;
+};
+
+/**
+ * The styles which are still in use, collected by CharacterStyleTable::collect().
+ */
+class CharacterStyleMarks
+{
+public:
+    void mark(quint32 style)
+    {
+        if (style < quint32(_marks.size())) {
+            _marks.setBit(int(style));
+        }
+    }
+
+    void mark(const Character *characters, int count);
+
+private:
+    friend class CharacterStyleTable;
+
+    explicit CharacterStyleMarks(int size) :
+        _marks(size)
+    {
+    }
+
+    QBitArray _marks;
+};
+
+/**
+ * Something which keeps characters, such as the screens of an emulation or
+ * the image of a view.  A user is known to the CharacterStyleTable from its
+ * construction to its destruction, which have to happen on the GUI thread.
+ */
+class CharacterStyleUser
+{
+public:
+    CharacterStyleUser();
+    virtual ~CharacterStyleUser();
+
+    /**
+     * Marks the styles of all characters the user keeps.  Called on the
+     * GUI thread, a user which is changed by other threads has to lock
+     * itself.
+     */
+    virtual void markStyles(CharacterStyleMarks &marks) = 0;
+
+private:
+    Q_DISABLE_COPY(CharacterStyleUser)
+};
+
+/**
+ * The styles of all characters in the terminal, shared by all screens,
+ * histories and views of the process.
+ *
+ * A Character refers to its style by an index into this table, which keeps
+ * it at 8 bytes and makes comparing the format of two characters a single
+ * integer comparison.  Styles are added by intern() and never moved.
+ *
+ * Styles which are no longer used are removed by collect(), which asks all
+ * CharacterStyleUser instances for the styles they keep and makes the
+ * entries of the others available to intern() again.  A collection is
+ * scheduled on the GUI thread after many styles have been added.
+ *
+ * intern() may be called from any thread.  style() does not lock, an index
+ * can only be obtained after its entry has been written.
+ *
+ * The table consists of static data only, so that characters can be
+ * created during static initialization.
+ */
+class CharacterStyleTable
+{
+public:
+    /** The index of the default colors without rendition flags. */
+    static constexpr quint32 DefaultStyle = 0;
+
+    /**
+     * Returns the index of the style with the colors @p foreground and
+     * @p background and the rendition flags @p rendition, adding the style
+     * to the table if it is new.
+     *
+     * If the table is full, a warning is printed and the style with the
+     * same colors and no rendition flags is returned if there is one,
+     * DefaultStyle otherwise, until a collection has made room.
+     */
+    static quint32 intern(const CharacterColor &foreground, const CharacterColor &background,
+                          RenditionFlags rendition)
+    {
+        if (rendition == 0
+            && foreground == CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR)
+            && background == CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR)) {
+            return DefaultStyle;
+        }
+        return insert(CharacterStyle(foreground, background, rendition));
+    }
+
+    /** Returns the style with the given @p index. */
+    static const CharacterStyle &style(quint32 index)
+    {
+        return _pages[index >> PageBits][index & (PageSize - 1)];
+    }
+
+    /** Returns the number of styles in the table. */
+    static int count();
+
+    /**
+     * Removes the styles which no CharacterStyleUser keeps.  Has to be
+     * called on the GUI thread.
+     */
+    static void collect();
+
+    /** The number of values save() writes. */
+    static constexpr int SavedSize = 3;
+
+    /**
+     * Writes the style with the given @p index to @p data in a form which,
+     * unlike the index, keeps its meaning in another process.
+     */
+    static void save(quint32 index, quint32 data[SavedSize]);
+
+    /**
+     * Returns the index of the style which save() has written to @p data,
+     * adding the style to the table if it is new.
+     */
+    static quint32 restore(const quint32 data[SavedSize]);
+
+private:
+    friend class CharacterStyleUser;
+
+    // an index has the 24 bits of Character::style
+    static constexpr int PageBits = 12;
+    static constexpr quint32 PageSize = 1 << PageBits;
+    static constexpr int PageCount = 1 << (24 - PageBits);
+
+    // the number of styles added after which a collection is scheduled
+    static constexpr quint32 CollectionInterval = 64 * 1024;
+
+    typedef QPair<quint64, RenditionFlags> Key;
+
+    static quint32 insert(const CharacterStyle &style);
+    // returns the style which is used instead of style when the table is full
+    static quint32 substitute(const CharacterStyle &style);
+    static void scheduleCollection();
+    static Key key(const CharacterStyle &style);
+    static quint32 colorKey(const CharacterColor &color);
+    static CharacterColor color(quint32 colorKey);
+
+    static CharacterStyle _firstPage[PageSize];
+    static CharacterStyle *_pages[PageCount];
+    static QBasicMutex _mutex;
+    static QHash<Key, quint32> *_index;
+    static quint32 _count;              // the number of entries, including free ones
+    static QVector<quint32> *_free;     // the entries which collect() has removed
+    static QList<CharacterStyleUser *> *_users;
+    static quint32 _added;              // styles added since the last collection
+    static bool _collectionScheduled;
+    static bool _warnedFull;
+    // the styles returned by intern() while the users are being asked for
+    // theirs, which may already be in a user which has been asked
+    static QBitArray *_interned;
+};
+}
+
+#endif // CHARACTERSTYLETABLE_H
@@ -22,8 +22,14 @@
 // Own
 #include "Emulation.h"
 
+// Standard
+#include <cstring>
+
 // Qt
+#include <QGuiApplication>
 #include <QKeyEvent>
+#include <QScreen>
+#include <QThread>
 
 // terminal
 #include "KeyboardTranslator.h"
@@ -38,20 +44,29 @@ Emulation::Emulation() :
     _currentScreen(nullptr),
     _codec(nullptr),
     _decoder(nullptr),
+    _utf8Decoder(),
     _keyTranslator(nullptr),
     _usesMouseTracking(false),
     _bracketedPasteMode(false),
-    _bulkTimer1(new QTimer(this)),
-    _bulkTimer2(new QTimer(this)),
-    _imageSizeInitialized(false)
+    _bulkTimer(),
+    _historyTimer(),
+    _lastUpdate(),
+    _imageSizeInitialized(false),
+    _mutex(),
+    _updatePending(0)
 {
     // create screens with a default size
     _screen[0] = new Screen(40, 80);
     _screen[1] = new Screen(40, 80);
     _currentScreen = _screen[0];
 
-    QObject::connect(&_bulkTimer1, &QTimer::timeout, this, &terminal::Emulation::showBulk);
-    QObject::connect(&_bulkTimer2, &QTimer::timeout, this, &terminal::Emulation::showBulk);
+    _bulkTimer.setSingleShot(true);
+    _bulkTimer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&_bulkTimer, &QTimer::timeout, this, &terminal::Emulation::showBulk);
+    _lastUpdate.start();
+
+    _historyTimer.setSingleShot(true);
+    QObject::connect(&_historyTimer, &QTimer::timeout, this, &terminal::Emulation::migrateHistory);
 
     // listen for mouse status changes
     connect(this, &terminal::Emulation::programRequestsMouseTracking, this,
@@ -82,7 +97,10 @@ void Emulation::bracketedPasteModeChanged(bool bracketedPasteMode)
 
 ScreenWindow *Emulation::createWindow()
 {
+    QMutexLocker locker(&_mutex);
+
     auto window = new ScreenWindow(_currentScreen);
+    window->setMutex(&_mutex);
     _windows << window;
 
     connect(window, &terminal::ScreenWindow::selectionChanged, this,
@@ -103,6 +121,8 @@ void Emulation::checkScreenInUse()
 
 void Emulation::checkSelectedText()
 {
+    QMutexLocker locker(&_mutex);
+
     QString text = _currentScreen->selectedText(Screen::PreserveLineBreaks);
     emit selectionChanged(text);
 }
@@ -135,28 +155,77 @@ void Emulation::setScreen(int index)
 
 void Emulation::clearHistory()
 {
+    QMutexLocker locker(&_mutex);
+
     _screen[0]->setScroll(_screen[0]->getScroll(), false);
 }
 
 void Emulation::setHistory(const HistoryType &history)
 {
+    QMutexLocker locker(&_mutex);
+
     _screen[0]->setScroll(history);
+    _historyTimer.start(0);
 
     showBulk();
 }
 
+void Emulation::migrateHistory()
+{
+    // the lines copied in one step, few enough to keep the event loop responsive
+    static const int HISTORY_MIGRATION_LINES = 2000;
+
+    QMutexLocker locker(&_mutex);
+
+    if (!_screen[0]->migrateHistory(HISTORY_MIGRATION_LINES)) {
+        _historyTimer.start(0);
+    }
+
+    if (_screen[0]->droppedLines() > 0) {
+        bufferedUpdate();
+    }
+}
+
 const HistoryType &Emulation::history() const
 {
     return _screen[0]->getScroll();
 }
 
+qint64 Emulation::historyMemoryUsage() const
+{
+    QMutexLocker locker(&_mutex);
+
+    return _screen[0]->historyMemoryUsage();
+}
+
+qreal Emulation::historyDeduplicationRatio() const
+{
+    QMutexLocker locker(&_mutex);
+
+    return _screen[0]->historyDeduplicationRatio();
+}
+
+void Emulation::markStyles(CharacterStyleMarks &marks)
+{
+    QMutexLocker locker(&_mutex);
+
+    _screen[0]->markStyles(marks);
+    _screen[1]->markStyles(marks);
+    for (ScreenWindow *window : qAsConst(_windows)) {
+        window->markStyles(marks);
+    }
+}
+
 void Emulation::setCodec(const QTextCodec *codec)
 {
+    QMutexLocker locker(&_mutex);
+
     if (codec != nullptr) {
         _codec = codec;
 
         delete _decoder;
         _decoder = _codec->makeDecoder();
+        _utf8Decoder.reset();
 
         emit useUtf8Request(utf8());
     } else {
@@ -213,6 +282,13 @@ void Emulation::receiveChar(uint c)
     }
 }
 
+void Emulation::receivePrintableChars(const uint *chars, int count)
+{
+    for (int i = 0; i < count; i++) {
+        receiveChar(chars[i]);
+    }
+}
+
 void Emulation::sendKeyEvent(QKeyEvent *ev)
 {
     emit stateSet(NOTIFYNORMAL);
@@ -232,70 +308,188 @@ void Emulation::sendMouseEvent(int /*buttons*/, int /*column*/, int /*row*/, int
 
 /*
    We are doing code conversion from locale to unicode first.
+
+   UTF-8 is decoded directly from the pty buffer (see receiveUtf8Data()),
+   other codecs go through QTextDecoder.
 */
 
 void Emulation::receiveData(const char *text, int length)
 {
+    QMutexLocker locker(&_mutex);
+
     emit stateSet(NOTIFYACTIVITY);
 
     bufferedUpdate();
 
-    QVector<uint> unicodeText = _decoder->toUnicode(text, length).toUcs4();
+    if (utf8()) {
+        receiveUtf8Data(text, length);
+    } else {
+        QVector<uint> unicodeText = _decoder->toUnicode(text, length).toUcs4();
 
-    //send characters to terminal emulator
-    for (auto &&i : unicodeText) {
-        receiveChar(i);
+        //send characters to terminal emulator
+        for (auto &&i : unicodeText) {
+            receiveChar(i);
+        }
     }
 
     //look for z-modem indicator
     //-- someone who understands more about z-modems that I do may be able to move
     //this check into the above for loop?
-    for (int i = 0; i < length; i++) {
-        if (text[i] == '\030') {
-            if (length - i - 1 > 3) {
-                if (qstrncmp(text + i + 1, "B00", 3) == 0) {
-                    emit zmodemDownloadDetected();
-                } else if (qstrncmp(text + i + 1, "B01", 3) == 0) {
-                    emit zmodemUploadDetected();
+    const char *end = text + length;
+    for (auto p = static_cast<const char *>(memchr(text, '\030', length));
+         p != nullptr;
+         p = static_cast<const char *>(memchr(p + 1, '\030', end - p - 1))) {
+        if (end - p - 1 > 3) {
+            if (qstrncmp(p + 1, "B00", 3) == 0) {
+                emit zmodemDownloadDetected();
+            } else if (qstrncmp(p + 1, "B01", 3) == 0) {
+                emit zmodemUploadDetected();
+            }
+        }
+    }
+}
+
+void Emulation::receiveUtf8Data(const char *text, int length)
+{
+    // printable ASCII runs are widened into this buffer in chunks,
+    // so no allocation is needed regardless of the input size
+    static const int RUN_CHUNK = 256;
+    uint run[RUN_CHUNK];
+
+    const char *p = text;
+    const char *end = text + length;
+    while (p < end) {
+        if (_utf8Decoder.isIdle()) {
+            int runLength = Utf8Decoder::printableAsciiLength(p, end - p);
+            while (runLength > 0) {
+                const int count = qMin(runLength, RUN_CHUNK);
+                for (int i = 0; i < count; i++) {
+                    run[i] = static_cast<uchar>(p[i]);
                 }
+                receivePrintableChars(run, count);
+                p += count;
+                runLength -= count;
+            }
+            if (p == end) {
+                break;
             }
         }
+
+        uint decoded[2];
+        const int count = _utf8Decoder.feed(static_cast<uchar>(*p++), decoded);
+        for (int i = 0; i < count; i++) {
+            receiveChar(decoded[i]);
+        }
     }
 }
 
 void Emulation::writeToStream(TerminalCharacterDecoder *decoder, int startLine, int endLine)
 {
+    QMutexLocker locker(&_mutex);
+
     _currentScreen->writeLinesToStream(decoder, startLine, endLine);
 }
 
+int Emulation::primaryLineCount() const
+{
+    QMutexLocker locker(&_mutex);
+
+    return _screen[0]->getLines() + _screen[0]->getHistLines();
+}
+
+qint64 Emulation::droppedPrimaryLines() const
+{
+    QMutexLocker locker(&_mutex);
+
+    return _screen[0]->totalDroppedLines();
+}
+
+void Emulation::writePrimaryToStream(TerminalCharacterDecoder *decoder, qint64 startLine, qint64 endLine)
+{
+    QMutexLocker locker(&_mutex);
+
+    const qint64 dropped = _screen[0]->totalDroppedLines();
+    const int start = int(qMax<qint64>(startLine - dropped, 0));
+    const int end = int(qMin<qint64>(endLine - dropped, primaryLineCount() - 1));
+    if (start <= end) {
+        _screen[0]->writeLinesToStream(decoder, start, end);
+    }
+}
+
 int Emulation::lineCount() const
 {
+    QMutexLocker locker(&_mutex);
+
     // sum number of lines currently on _screen plus number of lines in history
     return _currentScreen->getLines() + _currentScreen->getHistLines();
 }
 
 void Emulation::showBulk()
 {
-    _bulkTimer1.stop();
-    _bulkTimer2.stop();
+    QMutexLocker locker(&_mutex);
+
+    _bulkTimer.stop();
+    _lastUpdate.restart();
+
+    // the lines scrolled off since the last update go to the history in
+    // one batch
+    _currentScreen->flushHistory();
 
     emit outputChanged();
 
+    // If a whole screen has scrolled by since the last update, the output
+    // arrives faster than it can be displayed.  Keep the lines which scroll
+    // off for the next batch until it slows down again.
+    _currentScreen->setFastForward(_currentScreen->scrolledLines() <= -_currentScreen->getLines());
+
     _currentScreen->resetScrolledLines();
     _currentScreen->resetDroppedLines();
 }
 
 void Emulation::bufferedUpdate()
 {
-    static const int BULK_TIMEOUT1 = 10;
-    static const int BULK_TIMEOUT2 = 40;
+    // Upper limit for the time between two updates while output is being
+    // processed, in case the event loop does not get to the timer.
+    static const int MAX_UPDATE_DELAY = 100;
+
+    // The output is being processed on a worker thread, but the timer can
+    // only be started from the thread this object lives in.  Hand the
+    // request over, at most one of them is queued at any time.
+    if (QThread::currentThread() != thread()) {
+        if (_updatePending.testAndSetOrdered(0, 1)) {
+            QMetaObject::invokeMethod(this, [this]() {
+                _updatePending.storeRelease(0);
+                bufferedUpdate();
+            }, Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    const qint64 sinceLastUpdate = _lastUpdate.elapsed();
 
-    _bulkTimer1.setSingleShot(true);
-    _bulkTimer1.start(BULK_TIMEOUT1);
-    if (!_bulkTimer2.isActive()) {
-        _bulkTimer2.setSingleShot(true);
-        _bulkTimer2.start(BULK_TIMEOUT2);
+    // an update is already scheduled
+    if (_bulkTimer.isActive()) {
+        if (sinceLastUpdate >= MAX_UPDATE_DELAY) {
+            showBulk();
+        }
+        return;
     }
+
+    // After a quiet period update as soon as the pending output has been
+    // processed, otherwise wait for the next refresh of the screen.
+    const int interval = frameInterval();
+    _bulkTimer.start(sinceLastUpdate >= interval ? 0 : int(interval - sinceLastUpdate));
+}
+
+int Emulation::frameInterval()
+{
+    // there is no screen if this is not a GUI application
+    const QScreen *screen = QGuiApplication::primaryScreen();
+    const qreal refreshRate = screen != nullptr ? screen->refreshRate() : 0;
+    if (refreshRate < 1) {
+        return 16;
+    }
+    return qBound(4, qRound(1000 / refreshRate), 40);
 }
 
 char Emulation::eraseChar() const
@@ -309,6 +503,8 @@ void Emulation::setImageSize(int lines, int columns)
         return;
     }
 
+    QMutexLocker locker(&_mutex);
+
     QSize screenSize[2] = {
         QSize(_screen[0]->getColumns(),
               _screen[0]->getLines()),
@@ -342,5 +538,7 @@ void Emulation::setImageSize(int lines, int columns)
 
 QSize Emulation::imageSize() const
 {
+    QMutexLocker locker(&_mutex);
+
     return {_currentScreen->getColumns(), _currentScreen->getLines()};
 }
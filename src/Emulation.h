@@ -24,12 +24,17 @@
 #define EMULATION_H
 
 // Qt
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QSize>
 #include <QTextCodec>
 #include <QTimer>
 
 // terminal
+#include "CharacterStyleTable.h"
 #include "Enumeration.h"
+#include "Utf8Decoder.h"
 
 
 class QKeyEvent;
@@ -114,7 +119,7 @@ enum {
  * how long the emulation has been active/idle for and also respond to
  * a 'bell' event in different ways.
  */
-class  Emulation : public QObject
+class  Emulation : public QObject, public CharacterStyleUser
 {
     Q_OBJECT
 
@@ -151,6 +156,19 @@ public:
     const HistoryType &history() const;
     /** Clears the history scroll. */
     void clearHistory();
+    /**
+     * Returns the approximate number of bytes of memory used by the history
+     * store, not counting what it keeps in files.
+     */
+    qint64 historyMemoryUsage() const;
+    /**
+     * Returns the number of lines in the history per line it stores, which
+     * is more than 1 if identical lines are stored only once.
+     */
+    qreal historyDeduplicationRatio() const;
+
+    /** Marks the styles of the screens, their histories and the windows. */
+    void markStyles(CharacterStyleMarks &marks) Q_DECL_OVERRIDE;
 
     /**
      * Copies the output history from @p startLine to @p endLine
@@ -165,6 +183,40 @@ public:
      */
     virtual void writeToStream(TerminalCharacterDecoder *decoder, int startLine, int endLine);
 
+    /**
+     * Returns the number of lines of the primary screen, including those
+     * in its history, whichever screen is in use.
+     */
+    int primaryLineCount() const;
+    /**
+     * Returns the number of lines which the history of the primary screen
+     * has dropped.  Adding it to the number of a line of the primary
+     * screen gives a number which the line keeps while older lines are
+     * dropped, see writePrimaryToStream().
+     */
+    qint64 droppedPrimaryLines() const;
+    /**
+     * Like writeToStream(), but copies lines of the primary screen whose
+     * numbers include the lines dropped before them, see
+     * droppedPrimaryLines().  Lines which have been dropped meanwhile are
+     * skipped.
+     */
+    void writePrimaryToStream(TerminalCharacterDecoder *decoder, qint64 startLine, qint64 endLine);
+
+    /**
+     * Returns the lock which guards the screens of this emulation.
+     *
+     * The output of the terminal process may be processed on a worker
+     * thread ( see EmulationWorker ), in which case the lock is held while
+     * a block of output is processed.  Code on the GUI thread which reads
+     * the screens directly instead of through the methods of this class or
+     * ScreenWindow must hold it as well.
+     */
+    QRecursiveMutex *mutex() const
+    {
+        return &_mutex;
+    }
+
     /** Returns the codec used to decode incoming characters.  See setCodec() */
     const QTextCodec *codec() const
     {
@@ -256,6 +308,10 @@ public Q_SLOTS:
      * character buffer using the current codec(), and then calls receiveChar() for
      * each unicode character in the resulting buffer.
      *
+     * When the codec is UTF-8 the buffer is decoded in place without going through
+     * QTextDecoder, and runs of printable ASCII characters are handed to
+     * receivePrintableChars() in bulk.
+     *
      * receiveData() also starts a timer which causes the outputChanged() signal
      * to be emitted when it expires.  The timer allows multiple updates in quick
      * succession to be buffered into a single outputChanged() signal emission.
@@ -456,6 +512,16 @@ protected:
      */
     virtual void receiveChar(uint c);
 
+    /**
+     * Processes a run of printable characters which contains no control
+     * characters.  The default implementation calls receiveChar() for each
+     * character in @p chars.  See receiveData()
+     *
+     * @p chars The unicode character codes.
+     * @p count The number of characters in @p chars
+     */
+    virtual void receivePrintableChars(const uint *chars, int count);
+
     /**
      * Sets the active screen.  The terminal has two screens, primary and alternate.
      * The primary screen is used by default.  When certain interactive programs such
@@ -486,6 +552,8 @@ protected:
     //the current text codec.  (this allows for rendering of non-ASCII characters in text files etc.)
     const QTextCodec *_codec;
     QTextDecoder *_decoder;
+    // used instead of _decoder when the codec is UTF-8
+    Utf8Decoder _utf8Decoder;
     const KeyboardTranslator *_keyTranslator; // the keyboard layout
 
 protected Q_SLOTS:
@@ -493,6 +561,10 @@ protected Q_SLOTS:
      * Schedules an update of attached views.
      * Repeated calls to bufferedUpdate() in close succession will result in only a single update,
      * much like the Qt buffered update of widgets.
+     *
+     * The first change after a quiet period, such as the echo of a keystroke, is shown as soon
+     * as control returns to the event loop.  While output keeps arriving the views are updated
+     * at most once per refresh of the screen.
      */
     void bufferedUpdate();
 
@@ -511,14 +583,29 @@ private Q_SLOTS:
 
     void bracketedPasteModeChanged(bool bracketedPasteMode);
 
+    // copies the next lines of the previous history after setHistory()
+    void migrateHistory();
+
 private:
     Q_DISABLE_COPY(Emulation)
 
+    void receiveUtf8Data(const char *text, int length);
+    // the time between two refreshes of the primary screen, in milliseconds
+    static int frameInterval();
+
     bool _usesMouseTracking;
     bool _bracketedPasteMode;
-    QTimer _bulkTimer1;
-    QTimer _bulkTimer2;
+    QTimer _bulkTimer;
+    // converts the history in steps whenever the event loop is idle
+    QTimer _historyTimer;
+    // time since the views were last updated
+    QElapsedTimer _lastUpdate;
     bool _imageSizeInitialized;
+
+    mutable QRecursiveMutex _mutex;
+    // set while an update requested from a worker thread is queued
+    // for the thread this object lives in, see bufferedUpdate()
+    QAtomicInt _updatePending;
 };
 }
 
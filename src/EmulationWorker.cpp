@@ -0,0 +1,85 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "EmulationWorker.h"
+
+// Qt
+#include <QSocketNotifier>
+
+// terminal
+#include "Emulation.h"
+#include "Pty.h"
+
+using namespace terminal;
+
+// The output is read straight into a buffer of this size, which is
+// reused for every read.
+static const int READ_BUFFER_SIZE = 64 * 1024;
+// The amount of output read before checking for other events, such as
+// the request to stop.
+static const int READ_BUDGET = 256 * 1024;
+
+EmulationWorker::EmulationWorker(int masterFd, Emulation *emulation) :
+    QObject(nullptr),
+    _masterFd(masterFd),
+    _emulation(emulation),
+    _readNotifier(nullptr),
+    _buffer(READ_BUFFER_SIZE, Qt::Uninitialized),
+    _thread()
+{
+    _thread.setObjectName(QStringLiteral("EmulationWorker"));
+    moveToThread(&_thread);
+
+    // socket notifiers have to be created in the thread which uses them
+    connect(&_thread, &QThread::started, this, &terminal::EmulationWorker::startReading);
+    _thread.start();
+}
+
+EmulationWorker::~EmulationWorker()
+{
+    QMetaObject::invokeMethod(this, "stopReading", Qt::BlockingQueuedConnection);
+    _thread.quit();
+    _thread.wait();
+}
+
+void EmulationWorker::startReading()
+{
+    _readNotifier = new QSocketNotifier(_masterFd, QSocketNotifier::Read, this);
+    connect(_readNotifier, &QSocketNotifier::activated, this, &terminal::EmulationWorker::readData);
+}
+
+void EmulationWorker::stopReading()
+{
+    delete _readNotifier;
+    _readNotifier = nullptr;
+}
+
+void EmulationWorker::readData()
+{
+    const bool open = Pty::readAvailable(_masterFd, _buffer, READ_BUDGET,
+                                         [this](const char *data, int length) {
+        _emulation->receiveData(data, length);
+    });
+
+    // the session learns about the end of the process from the process itself
+    if (!open) {
+        _readNotifier->setEnabled(false);
+    }
+}
@@ -0,0 +1,72 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef EMULATIONWORKER_H
+#define EMULATIONWORKER_H
+
+// Qt
+#include <QByteArray>
+#include <QObject>
+#include <QThread>
+
+class QSocketNotifier;
+
+namespace terminal {
+class Emulation;
+
+/**
+ * Reads the output of a terminal process and feeds it to an emulation
+ * on a thread of its own, so that heavy output does not block the GUI.
+ *
+ * The worker reads the pty master directly; the KPtyDevice of the
+ * session must be suspended while a worker is active.  The emulation
+ * serializes access to its screens with Emulation::mutex() and forwards
+ * screen updates to the GUI thread, so views keep working unchanged.
+ *
+ * The thread is started by the constructor and stopped by the destructor.
+ */
+class EmulationWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Starts reading from @p masterFd and passing the data to the
+     * receiveData() method of @p emulation.
+     */
+    EmulationWorker(int masterFd, Emulation *emulation);
+    ~EmulationWorker() Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    void startReading();
+    void stopReading();
+    void readData();
+
+private:
+    Q_DISABLE_COPY(EmulationWorker)
+
+    int _masterFd;
+    Emulation *_emulation;
+    QSocketNotifier *_readNotifier;
+    QByteArray _buffer;
+    QThread _thread;
+};
+}
+
+#endif // EMULATIONWORKER_H
@@ -47,7 +47,13 @@ public:
          * Typically this means that lines are recorded to
          * a file as they are scrolled off-screen.
          */
-        UnlimitedHistory = 2
+        UnlimitedHistory = 2,
+        /** All output is remembered for the duration of the session.
+         * The lines are compressed in blocks before they are recorded
+         * to a file, which takes a fraction of the space of
+         * UnlimitedHistory.
+         */
+        CompressedHistory = 3
     };
 
     /**
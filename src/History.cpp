@@ -22,10 +22,13 @@
 #include "History.h"
 
 #include "TerminalDebug.h"
+#include "ExtendedCharTable.h"
 #include "KonsoleSettings.h"
 
 // System
+#include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <cstdio>
 #include <sys/types.h>
@@ -38,13 +41,53 @@
 #include <config/kconfiggroup.h>
 #include <config/ksharedconfig.h>
 
-// Reasonable line size
-static const int LINE_SIZE = 1024;
-
 using namespace terminal;
 
 Q_GLOBAL_STATIC(QString, historyFileLocation)
 
+namespace {
+// creates the directory of the named history files, which only the user
+// may enter since the scrollback may hold passwords and the like
+void makeHistoryDirectory(const QString &fileName)
+{
+    const QString directory = QFileInfo(fileName).absolutePath();
+    QDir().mkpath(directory);
+    QFile::setPermissions(directory, QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner);
+}
+
+// returns the lock of the files of a named history, or 0 if another
+// process holds it or the history is not named
+QLockFile *lockHistoryFiles(const QString &fileName)
+{
+    if (fileName.isEmpty()) {
+        return nullptr;
+    }
+    makeHistoryDirectory(fileName);
+
+    auto lock = new QLockFile(fileName + QLatin1String(".lock"));
+    if (!lock->tryLock(0)) {
+        qCWarning(TerminalDebug) << "Scrollback files are used by another process, using a temporary file"
+                                 << fileName;
+        delete lock;
+        return nullptr;
+    }
+    return lock;
+}
+
+// adds the styles of characters to styles, for histories which cannot
+// look at all of their cells when the styles are collected
+void addStyles(QSet<quint32> &styles, const Character characters[], int count)
+{
+    quint32 last = CharacterStyleTable::DefaultStyle;
+    for (int i = 0; i < count; i++) {
+        if (characters[i].style != last) {
+            last = characters[i].style;
+            styles.insert(last);
+        }
+    }
+}
+}
+
 /*
    An arbitrary long scroll.
 
@@ -61,11 +104,34 @@ Q_GLOBAL_STATIC(QString, historyFileLocation)
 */
 
 // History File ///////////////////////////////////////////
-HistoryFile::HistoryFile() :
+HistoryFile::HistoryFile(const QString &fileName) :
     _length(0),
-    _fileMap(nullptr),
-    _readWriteBalance(0)
+    _fileLength(0),
+    _tmpFile(),
+    _namedFile(fileName),
+    _file(&_tmpFile),
+    _tail(),
+    _lastWrite(),
+    _windows()
 {
+    _lastWrite.start();
+
+    if (!fileName.isEmpty()) {
+        _file = &_namedFile;
+        makeHistoryDirectory(fileName);
+        if (!_namedFile.open(QIODevice::ReadWrite)) {
+            qCWarning(TerminalDebug) << "Unable to open scrollback file" << fileName;
+            return;
+        }
+        // before anything is written to it
+        if (!_namedFile.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner)) {
+            qCWarning(TerminalDebug) << "Unable to restrict the permissions of scrollback file" << fileName;
+        }
+        _length = _fileLength = _namedFile.size();
+        loadTail();
+        return;
+    }
+
     // Determine the temp directory once
     // This class is called 3 times for each "unlimited" scrollback.
     // This has the down-side that users must restart to
@@ -129,99 +195,167 @@ HistoryFile::HistoryFile() :
 
 HistoryFile::~HistoryFile()
 {
-    if (_fileMap != nullptr) {
-        unmap();
-    }
+    unmapWindows();
+    flush();
 }
 
-//TODO:  Mapping the entire file in will cause problems if the history file becomes exceedingly large,
-//(ie. larger than available memory).  HistoryFile::map() should only map in sections of the file at a time,
-//to avoid this.
-void HistoryFile::map()
+const uchar *HistoryFile::window(qint64 index)
 {
-    Q_ASSERT(_fileMap == nullptr);
-
-    if (_tmpFile.flush()) {
-        Q_ASSERT(_tmpFile.size() >= _length);
-        _fileMap = _tmpFile.map(0, _length);
+    for (int i = 0; i < _windows.count(); i++) {
+        if (_windows[i].index == index) {
+            _windows.move(i, 0);
+            return _windows.first().data;
+        }
     }
 
-    //if mmap'ing fails, fall back to the read-lseek combination
-    if (_fileMap == nullptr) {
-        _readWriteBalance = 0;
+    uchar *data = _file->map(index * WINDOW_SIZE, WINDOW_SIZE);
+    if (data == nullptr) {
         qCDebug(TerminalDebug) << "mmap'ing history failed.  errno = " << errno;
+        return nullptr;
+    }
+
+    if (_windows.count() == MAX_WINDOWS) {
+        _file->unmap(_windows.last().data);
+        _windows.removeLast();
     }
+    _windows.prepend({index, data});
+
+    return data;
 }
 
-void HistoryFile::unmap()
+void HistoryFile::writeTail()
 {
-    Q_ASSERT(_fileMap != nullptr);
+    if (_fileLength == _length) {
+        return;
+    }
+
+    const qint64 tailStart = _length - _tail.size();
+    const qint64 count = _length - _fileLength;
 
-    if (_tmpFile.unmap(_fileMap)) {
-        _fileMap = nullptr;
+    if (!_file->seek(_fileLength)) {
+        perror("HistoryFile::add.seek");
+        return;
     }
+    if (_file->write(_tail.constData() + (_fileLength - tailStart), count) != count || !_file->flush()) {
+        perror("HistoryFile::add.write");
+        return;
+    }
+    _fileLength = _length;
+    _lastWrite.restart();
+}
 
-    Q_ASSERT(_fileMap == nullptr);
+void HistoryFile::loadTail()
+{
+    const qint64 tailStart = _length - _length % WINDOW_SIZE;
 
+    _tail.clear();
+    if (tailStart < _length && _file->seek(tailStart)) {
+        _tail = _file->read(_length - tailStart);
+    }
+    // whatever could not be read is lost
+    _length = _fileLength = tailStart + _tail.size();
 }
 
-void HistoryFile::add(const char *buffer, qint64 count)
+void HistoryFile::unmapWindows()
 {
-    if (_fileMap != nullptr) {
-        unmap();
+    for (const Window &mapped : qAsConst(_windows)) {
+        _file->unmap(mapped.data);
     }
+    _windows.clear();
+}
 
-    if (_readWriteBalance < INT_MAX) {
-        _readWriteBalance++;
+void HistoryFile::truncate(qint64 length)
+{
+    if (length >= _length) {
+        return;
     }
 
-    qint64 rc = 0;
+    unmapWindows();
+    writeTail();
+    if (!_file->resize(length)) {
+        perror("HistoryFile::truncate");
+    }
+    _length = _fileLength = length;
+    loadTail();
+}
 
-    if (!_tmpFile.seek(_length)) {
-        perror("HistoryFile::add.seek");
-        return;
+void HistoryFile::add(const char *buffer, qint64 count)
+{
+    while (count > 0) {
+        const qint64 room = WINDOW_SIZE - _tail.size();
+        const qint64 n = qMin(count, room);
+
+        _tail.append(buffer, int(n));
+        _length += n;
+        buffer += n;
+        count -= n;
+
+        if (_tail.size() == WINDOW_SIZE) {
+            writeTail();
+            if (_fileLength != _length) {
+                // the window could not be written, drop it
+                _length -= _tail.size();
+                _fileLength = qMin(_fileLength, _length);
+                _tail.clear();
+                return;
+            }
+            _tail.clear();
+        }
     }
-    rc = _tmpFile.write(buffer, count);
-    if (rc < 0) {
-        perror("HistoryFile::add.write");
-        return;
+
+    // a crash loses the last batch, see HistoryScrollFile::repair()
+    if (_file == &_namedFile
+            && (_length - _fileLength >= WRITE_SIZE || _lastWrite.hasExpired(WRITE_INTERVAL))) {
+        writeTail();
     }
-    _length += rc;
 }
 
-void HistoryFile::get(char *buffer, qint64 size, qint64 loc)
+void HistoryFile::flush()
 {
+    if (_file == &_namedFile) {
+        writeTail();
+    }
+}
 
+void HistoryFile::get(char *buffer, qint64 size, qint64 loc)
+{
     if (loc < 0 || size < 0 || loc + size > _length) {
         fprintf(stderr, "getHist(...,%lld,%lld): invalid args.\n", size, loc);
         return;
     }
 
-    //count number of get() calls vs. number of add() calls.
-    //If there are many more get() calls compared with add()
-    //calls (decided by using MAP_THRESHOLD) then mmap the log
-    //file to improve performance.
-    if (_readWriteBalance > INT_MIN) {
-        _readWriteBalance--;
-    }
-    if ((_fileMap == nullptr) && _readWriteBalance < MAP_THRESHOLD) {
-        map();
+    // the part which is still in the tail
+    const qint64 tailStart = _length - _tail.size();
+    if (loc + size > tailStart) {
+        const qint64 start = qMax(loc, tailStart);
+        memcpy(buffer + (start - loc), _tail.constData() + (start - tailStart), loc + size - start);
+        size = start - loc;
     }
 
-    if (_fileMap != nullptr) {
-        memcpy(buffer, _fileMap + loc, size);
-    } else {
-        qint64 rc = 0;
+    // the part which has been written to the file, window by window
+    while (size > 0) {
+        const qint64 index = loc / WINDOW_SIZE;
+        const qint64 offset = loc % WINDOW_SIZE;
+        const qint64 n = qMin(size, WINDOW_SIZE - offset);
 
-        if (!_tmpFile.seek(loc)) {
-            perror("HistoryFile::get.seek");
-            return;
-        }
-        rc = _tmpFile.read(buffer, size);
-        if (rc < 0) {
-            perror("HistoryFile::get.read");
-            return;
+        const uchar *data = window(index);
+        if (data != nullptr) {
+            memcpy(buffer, data + offset, n);
+        } else {
+            //if mmap'ing fails, fall back to the read-lseek combination
+            if (!_file->seek(loc)) {
+                perror("HistoryFile::get.seek");
+                return;
+            }
+            if (_file->read(buffer, n) < 0) {
+                perror("HistoryFile::get.read");
+                return;
+            }
         }
+
+        buffer += n;
+        loc += n;
+        size -= n;
     }
 }
 
@@ -230,6 +364,114 @@ qint64 HistoryFile::len() const
     return _length;
 }
 
+// History Line Index ///////////////////////////////////////////
+
+HistoryLineIndex::HistoryLineIndex() :
+    _chunks(),
+    _count(0),
+    _file(),
+    _savedCount(nullptr),
+    _mappedChunks(0)
+{
+}
+
+HistoryLineIndex::~HistoryLineIndex()
+{
+    // the mapped chunks go away with the file
+    qDeleteAll(_chunks.begin() + _mappedChunks, _chunks.end());
+}
+
+bool HistoryLineIndex::open(const QString &fileName)
+{
+    Q_ASSERT(_count == 0 && _chunks.isEmpty());
+
+    _file.setFileName(fileName);
+    if (!_file.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+    _file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+
+    if (_file.size() < HEADER_SIZE && !_file.resize(HEADER_SIZE)) {
+        _file.close();
+        return false;
+    }
+    _savedCount = reinterpret_cast<qint64 *>(_file.map(0, HEADER_SIZE));
+    if (_savedCount == nullptr) {
+        _file.close();
+        return false;
+    }
+
+    // only lines in chunks which are complete in the file count
+    const qint64 fileChunks = (_file.size() - HEADER_SIZE) / qint64(sizeof(Chunk));
+    const int count = int(qBound<qint64>(0, *_savedCount, qMin<qint64>(fileChunks * CHUNK_SIZE, INT_MAX)));
+    for (int index = 0; index < (count + CHUNK_SIZE - 1) >> CHUNK_BITS; index++) {
+        Chunk *chunk = mapChunk(index);
+        if (chunk == nullptr) {
+            _chunks.clear();
+            _savedCount = nullptr;
+            _file.close();
+            return false;
+        }
+        _chunks.append(chunk);
+    }
+
+    _mappedChunks = _chunks.size();
+    _count = count;
+    *_savedCount = count;
+    return true;
+}
+
+HistoryLineIndex::Chunk *HistoryLineIndex::mapChunk(int index)
+{
+    const qint64 start = HEADER_SIZE + qint64(index) * sizeof(Chunk);
+    if (_file.size() < start + qint64(sizeof(Chunk)) && !_file.resize(start + sizeof(Chunk))) {
+        return nullptr;
+    }
+    return reinterpret_cast<Chunk *>(_file.map(start, sizeof(Chunk)));
+}
+
+void HistoryLineIndex::append(qint64 end, bool wrapped)
+{
+    Q_ASSERT(end >= 0 && end < (qint64(HIGH_MASK) + 1) << 32);
+
+    if ((_count & (CHUNK_SIZE - 1)) == 0 && (_count >> CHUNK_BITS) == _chunks.size()) {
+        Chunk *chunk = nullptr;
+        if (_savedCount != nullptr && _mappedChunks == _chunks.size()) {
+            chunk = mapChunk(_chunks.size());
+            if (chunk != nullptr) {
+                _mappedChunks++;
+            } else {
+                qCWarning(TerminalDebug) << "Unable to extend scrollback file" << _file.fileName()
+                                         << ", the following lines are not saved";
+            }
+        }
+        _chunks.append(chunk != nullptr ? chunk : new Chunk);
+    }
+
+    Chunk *chunk = _chunks[_count >> CHUNK_BITS];
+    const int i = _count & (CHUNK_SIZE - 1);
+    chunk->low[i] = quint32(end);
+    chunk->high[i] = quint8((end >> 32) & HIGH_MASK) | (wrapped ? WRAPPED : 0);
+    _count++;
+
+    // the line is saved once the count includes it
+    if (_savedCount != nullptr && (_count - 1) >> CHUNK_BITS < _mappedChunks) {
+        *_savedCount = _count;
+    }
+}
+
+void HistoryLineIndex::truncate(int count)
+{
+    if (count >= _count) {
+        return;
+    }
+
+    _count = count;
+    if (_savedCount != nullptr) {
+        *_savedCount = qMin(qint64(count), qint64(_mappedChunks) * CHUNK_SIZE);
+    }
+}
+
 // History Scroll abstract base class //////////////////////////////////////
 
 HistoryScroll::HistoryScroll(HistoryType *t) :
@@ -260,16 +502,108 @@ bool HistoryScroll::hasScroll()
    at 0 in cells.
 */
 
-HistoryScrollFile::HistoryScrollFile() :
-    HistoryScroll(new HistoryTypeFile())
+HistoryScrollFile::HistoryScrollFile(const QString &fileName) :
+    HistoryScrollFile(fileName, lockHistoryFiles(fileName))
 {
 }
 
+HistoryScrollFile::HistoryScrollFile(const QString &fileName, QLockFile *lock) :
+    HistoryScroll(new HistoryTypeFile(lock != nullptr ? fileName : QString())),
+    _lock(lock),
+    _lines(),
+    _cells(lock != nullptr ? fileName + QLatin1String(".cells") : QString()),
+    _named(lock != nullptr),
+    _styles(),
+    _fileStyles(),
+    _processStyles(),
+    _usedStyles(),
+    _buffer()
+{
+    if (_named) {
+        if (!_lines.open(fileName + QLatin1String(".lines"))) {
+            qCWarning(TerminalDebug) << "Unable to open scrollback file" << fileName + QLatin1String(".lines");
+        }
+        _styles.reset(new HistoryFile(fileName + QLatin1String(".styles")));
+        repair();
+        loadStyles();
+    }
+}
+
 HistoryScrollFile::~HistoryScrollFile() = default;
 
+void HistoryScrollFile::removeFiles(const QString &fileName)
+{
+    // the files may be open in another process, a stale lock of a
+    // process which is gone is taken over
+    QLockFile lock(fileName + QLatin1String(".lock"));
+    if (!lock.tryLock(0)) {
+        return;
+    }
+    QFile::remove(fileName + QLatin1String(".lines"));
+    QFile::remove(fileName + QLatin1String(".cells"));
+    QFile::remove(fileName + QLatin1String(".styles"));
+}
+
+void HistoryScrollFile::removeUnusedFiles(const QString &directory, const QStringList &fileNames)
+{
+    QSet<QString> histories;
+    const QFileInfoList files = QDir(directory).entryInfoList(QDir::Files);
+    for (const QFileInfo &file : files) {
+        histories.insert(file.absolutePath() + QLatin1Char('/') + file.completeBaseName());
+    }
+
+    for (const QString &history : qAsConst(histories)) {
+        if (fileNames.contains(history)) {
+            continue;
+        }
+        removeFiles(history);
+    }
+}
+
+void HistoryScrollFile::repair()
+{
+    // the index is mapped and complete, the cells are written in batches,
+    // so a crash may have lost the cells of the last lines
+    const qint64 cells = _cells.len() / qint64(sizeof(Character));
+    int lines = _lines.count();
+    if (lines > 0 && _lines.end(lines - 1) > cells) {
+        // the first line which ends past the cells
+        int low = 0;
+        int high = lines - 1;
+        while (low < high) {
+            const int middle = low + (high - low) / 2;
+            if (_lines.end(middle) > cells) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        qCWarning(TerminalDebug) << "Discarding" << lines - low << "lines of damaged scrollback";
+        lines = low;
+        _lines.truncate(lines);
+    }
+    _cells.truncate(lines > 0 ? _lines.end(lines - 1) * qint64(sizeof(Character)) : 0);
+
+    const int styleSize = CharacterStyleTable::SavedSize * sizeof(quint32);
+    _styles->truncate(_styles->len() - _styles->len() % styleSize);
+}
+
+void HistoryScrollFile::loadStyles()
+{
+    const int count = int(_styles->len() / (CharacterStyleTable::SavedSize * sizeof(quint32)));
+    QVector<quint32> data(count * CharacterStyleTable::SavedSize);
+    _styles->get(reinterpret_cast<char *>(data.data()), data.size() * sizeof(quint32), 0);
+
+    _processStyles.resize(count);
+    for (int i = 0; i < count; i++) {
+        _processStyles[i] = CharacterStyleTable::restore(data.constData() + i * CharacterStyleTable::SavedSize);
+        _fileStyles.insert(_processStyles[i], i);
+    }
+}
+
 int HistoryScrollFile::getLines()
 {
-    return _index.len() / sizeof(qint64);
+    return _lines.count();
 }
 
 int HistoryScrollFile::getLineLen(int lineno)
@@ -279,11 +613,8 @@ int HistoryScrollFile::getLineLen(int lineno)
 
 bool HistoryScrollFile::isWrappedLine(int lineno)
 {
-    if (lineno >= 0 && lineno <= getLines()) {
-        unsigned char flag = 0;
-        _lineflags.get(reinterpret_cast<char *>(&flag), sizeof(unsigned char),
-                       (lineno)*sizeof(unsigned char));
-        return flag != 0u;
+    if (lineno >= 0 && lineno < getLines()) {
+        return _lines.isWrapped(lineno);
     }
     return false;
 }
@@ -294,9 +625,7 @@ qint64 HistoryScrollFile::startOfLine(int lineno)
         return 0;
     }
     if (lineno <= getLines()) {
-        qint64 res = 0;
-        _index.get(reinterpret_cast<char*>(&res), sizeof(qint64), (lineno - 1)*sizeof(qint64));
-        return res;
+        return _lines.end(lineno - 1) * sizeof(Character);
     }
     return _cells.len();
 }
@@ -304,19 +633,510 @@ qint64 HistoryScrollFile::startOfLine(int lineno)
 void HistoryScrollFile::getCells(int lineno, int colno, int count, Character res[])
 {
     _cells.get(reinterpret_cast<char*>(res), count * sizeof(Character), startOfLine(lineno) + colno * sizeof(Character));
+
+    if (_named) {
+        for (int i = 0; i < count; i++) {
+            const quint32 fileStyle = res[i].style;
+            res[i].style = fileStyle < quint32(_processStyles.size())
+                           ? _processStyles[fileStyle] : CharacterStyleTable::DefaultStyle;
+        }
+    }
 }
 
 void HistoryScrollFile::addCells(const Character text[], int count)
 {
-    _cells.add(reinterpret_cast<const char*>(text), count * sizeof(Character));
+    if (!_named) {
+        _cells.add(reinterpret_cast<const char*>(text), count * sizeof(Character));
+        addStyles(_usedStyles, text, count);
+        return;
+    }
+
+    _buffer.resize(count);
+    for (int i = 0; i < count; i++) {
+        Character c = text[i];
+
+        // the table of extended characters belongs to the process as well,
+        // such characters are written as their first code point
+        if ((c.cellRendition & RE_EXTENDED_CHAR) != 0) {
+            ushort extendedCharLength = 0;
+            const uint *chars = ExtendedCharTable::instance.lookupExtendedChar(c.character, extendedCharLength);
+            c.character = (chars != nullptr && extendedCharLength > 0) ? chars[0] : uint(' ');
+            c.cellRendition &= ~RE_EXTENDED_CHAR;
+        }
+
+        auto it = _fileStyles.constFind(c.style);
+        if (it == _fileStyles.constEnd()) {
+            quint32 data[CharacterStyleTable::SavedSize];
+            CharacterStyleTable::save(c.style, data);
+            _styles->add(reinterpret_cast<const char *>(data), sizeof(data));
+            // before any cells which use it
+            _styles->flush();
+            it = _fileStyles.insert(c.style, quint32(_processStyles.size()));
+            _processStyles.append(c.style);
+        }
+        c.style = it.value();
+
+        _buffer[i] = c;
+    }
+    _cells.add(reinterpret_cast<const char*>(_buffer.constData()), count * sizeof(Character));
 }
 
 void HistoryScrollFile::addLine(bool previousWrapped)
 {
-    qint64 locn = _cells.len();
-    _index.add(reinterpret_cast<char *>(&locn), sizeof(qint64));
-    unsigned char flags = previousWrapped ? 0x01 : 0x00;
-    _lineflags.add(reinterpret_cast<char *>(&flags), sizeof(char));
+    _lines.append(_cells.len() / sizeof(Character), previousWrapped);
+}
+
+qint64 HistoryScrollFile::memoryUsage()
+{
+    qint64 usage = _lines.memoryUsage() + _cells.memoryUsage() + _buffer.capacity() * sizeof(Character);
+    if (_named) {
+        usage += _styles->memoryUsage();
+    }
+    return usage;
+}
+
+void HistoryScrollFile::markStyles(CharacterStyleMarks &marks)
+{
+    for (quint32 style : qAsConst(_usedStyles)) {
+        marks.mark(style);
+    }
+    for (quint32 style : qAsConst(_processStyles)) {
+        marks.mark(style);
+    }
+}
+
+// History Scroll Conversion //////////////////////////////////////
+
+HistoryScrollConversion::HistoryScrollConversion(HistoryScroll *source, HistoryScroll *target) :
+    HistoryScroll(nullptr),
+    _source(source),
+    _target(target),
+    _migrated(0),
+    _sourceLines(source->getLines()),
+    _buffer()
+{
+    // the lines which the new history would drop right away are skipped
+    const int maximumLineCount = _target->getType().maximumLineCount();
+    if (maximumLineCount >= 0) {
+        _migrated = qMax(0, _source->getLines() - maximumLineCount);
+    }
+}
+
+HistoryScrollConversion::~HistoryScrollConversion()
+{
+    delete _source;
+    delete _target;
+}
+
+int HistoryScrollConversion::getLines()
+{
+    return _target->getLines() + _source->getLines() - _migrated;
+}
+
+int HistoryScrollConversion::getLineLen(int lineno)
+{
+    const int targetLines = _target->getLines();
+    if (lineno < targetLines) {
+        return _target->getLineLen(lineno);
+    }
+    return _source->getLineLen(lineno - targetLines + _migrated);
+}
+
+void HistoryScrollConversion::getCells(int lineno, int colno, int count, Character res[])
+{
+    const int targetLines = _target->getLines();
+    if (lineno < targetLines) {
+        _target->getCells(lineno, colno, count, res);
+    } else {
+        _source->getCells(lineno - targetLines + _migrated, colno, count, res);
+    }
+}
+
+bool HistoryScrollConversion::isWrappedLine(int lineno)
+{
+    const int targetLines = _target->getLines();
+    if (lineno < targetLines) {
+        return _target->isWrappedLine(lineno);
+    }
+    return _source->isWrappedLine(lineno - targetLines + _migrated);
+}
+
+void HistoryScrollConversion::addCells(const Character a[], int count)
+{
+    _source->addCells(a, count);
+}
+
+void HistoryScrollConversion::addCellsVector(const QVector<Character> &cells)
+{
+    _source->addCellsVector(cells);
+}
+
+void HistoryScrollConversion::addLine(bool previousWrapped)
+{
+    _source->addLine(previousWrapped);
+
+    // a history which is full drops its oldest line for the new one, which
+    // moves the lines which have not been migrated yet
+    const int lines = _source->getLines();
+    const int dropped = _sourceLines + 1 - lines;
+    if (dropped > 0) {
+        _migrated = qMax(0, _migrated - dropped);
+    }
+    _sourceLines = lines;
+}
+
+qint64 HistoryScrollConversion::memoryUsage()
+{
+    return _source->memoryUsage() + _target->memoryUsage();
+}
+
+int HistoryScrollConversion::distinctLines()
+{
+    // the lines which have been migrated may still be in _source
+    return _target->distinctLines() + qMax(0, _source->distinctLines() - _migrated);
+}
+
+void HistoryScrollConversion::markStyles(CharacterStyleMarks &marks)
+{
+    _source->markStyles(marks);
+    _target->markStyles(marks);
+}
+
+const HistoryType &HistoryScrollConversion::getType() const
+{
+    return _target->getType();
+}
+
+bool HistoryScrollConversion::migrate(int count)
+{
+    const int end = qMin(_source->getLines(), _migrated + count);
+    for (; _migrated < end; _migrated++) {
+        _buffer.resize(_source->getLineLen(_migrated));
+        _source->getCells(_migrated, 0, _buffer.size(), _buffer.data());
+        _target->addCellsVector(_buffer);
+        _target->addLine(_source->isWrappedLine(_migrated));
+    }
+
+    return _migrated == _source->getLines();
+}
+
+HistoryScroll *HistoryScrollConversion::takeTarget()
+{
+    Q_ASSERT(_migrated == _source->getLines());
+
+    HistoryScroll *target = _target;
+    _target = nullptr;
+    return target;
+}
+
+// Compressed History Scroll //////////////////////////////////////
+
+/*
+   The compressed history scroll groups the lines into blocks of
+   BLOCK_LINES lines.  The newest block is kept as it is, every
+   older block is compressed once it is complete and appended to
+   a history file.
+
+   A block is stored as
+
+     quint32 lineCount, cellCount, runCount
+     int     lineEnds[lineCount]
+     char    wrapped[lineCount]
+     uint    characters[cellCount]
+     Run     runs[runCount]
+
+   where the runs encode the formats of consecutive cells like
+   CompactHistoryLine does, which leaves little for zlib to do
+   but compress the text.
+*/
+
+namespace {
+struct FormatRun
+{
+    quint32 length;
+    quint32 format;
+};
+
+quint32 packedFormat(const Character &c)
+{
+    return c.style | quint32(c.cellRendition) << 24 | quint32(c.isRealCharacter) << 31;
+}
+
+void unpackFormat(quint32 format, Character &c)
+{
+    c.style = format & 0xffffff;
+    c.cellRendition = (format >> 24) & 0x7f;
+    c.isRealCharacter = (format >> 31) != 0u;
+}
+
+template<typename T>
+void appendArray(QByteArray &data, const T *array, int count)
+{
+    data.append(reinterpret_cast<const char *>(array), int(count * sizeof(T)));
+}
+
+template<typename T>
+bool readArray(const char *&pos, const char *end, T *array, quint32 count)
+{
+    const qint64 size = qint64(count) * sizeof(T);
+    if (end - pos < size) {
+        return false;
+    }
+    memcpy(array, pos, size);
+    pos += size;
+    return true;
+}
+}
+
+CompressedHistoryScroll::CompressedHistoryScroll(int maxLineCount) :
+    HistoryScroll(new CompressedHistoryType(maxLineCount)),
+    _blockOffsets(),
+    _newest(),
+    _cache(CACHED_BLOCKS),
+    _compressedCells(0),
+    _compressedBlocks(0),
+    _firstBlock(0),
+    _droppedLines(0),
+    _maxLineCount(maxLineCount),
+    _usedStyles()
+{
+}
+
+CompressedHistoryScroll::~CompressedHistoryScroll() = default;
+
+int CompressedHistoryScroll::getLines()
+{
+    return _blockOffsets.size() * BLOCK_LINES + _newest.lineEnds.size() - _droppedLines;
+}
+
+int CompressedHistoryScroll::getLineLen(int lineno)
+{
+    if (lineno < 0 || lineno >= getLines()) {
+        return 0;
+    }
+    lineno += _droppedLines;
+    const Block &lineBlock = block(lineno / BLOCK_LINES);
+    const int line = lineno % BLOCK_LINES;
+    return lineBlock.lineEnds[line] - lineBlock.lineStart(line);
+}
+
+bool CompressedHistoryScroll::isWrappedLine(int lineno)
+{
+    if (lineno < 0 || lineno >= getLines()) {
+        return false;
+    }
+    lineno += _droppedLines;
+    return block(lineno / BLOCK_LINES).wrapped[lineno % BLOCK_LINES] != 0;
+}
+
+void CompressedHistoryScroll::getCells(int lineno, int colno, int count, Character res[])
+{
+    if (count == 0) {
+        return;
+    }
+    Q_ASSERT(lineno >= 0 && lineno < getLines());
+    lineno += _droppedLines;
+    const Block &lineBlock = block(lineno / BLOCK_LINES);
+    const int start = lineBlock.lineStart(lineno % BLOCK_LINES) + colno;
+    Q_ASSERT(start + count <= lineBlock.lineEnds[lineno % BLOCK_LINES]);
+    std::copy(lineBlock.cells.constBegin() + start, lineBlock.cells.constBegin() + start + count, res);
+}
+
+void CompressedHistoryScroll::addCells(const Character text[], int count)
+{
+    const int start = _newest.cells.size();
+    _newest.cells.resize(start + count);
+    std::copy(text, text + count, _newest.cells.begin() + start);
+    addStyles(_usedStyles, text, count);
+}
+
+void CompressedHistoryScroll::addLine(bool previousWrapped)
+{
+    _newest.lineEnds.append(_newest.cells.size());
+    _newest.wrapped.append(char(previousWrapped ? 1 : 0));
+
+    if (_newest.lineEnds.size() == BLOCK_LINES) {
+        compressBlock();
+    }
+    dropLines();
+}
+
+void CompressedHistoryScroll::setMaxNbLines(int lineCount)
+{
+    _maxLineCount = lineCount;
+    delete _historyType;
+    _historyType = new CompressedHistoryType(lineCount);
+    dropLines();
+}
+
+void CompressedHistoryScroll::dropLines()
+{
+    if (_maxLineCount < 0) {
+        return;
+    }
+
+    const int excess = getLines() - _maxLineCount;
+    if (excess <= 0) {
+        return;
+    }
+    _droppedLines += excess;
+
+    // the lines of the newest block are only dropped along with it
+    const int droppedBlocks = qMin(_droppedLines / BLOCK_LINES, _blockOffsets.size());
+    _blockOffsets.remove(0, droppedBlocks);
+    _firstBlock += droppedBlocks;
+    _droppedLines -= droppedBlocks * BLOCK_LINES;
+    if (droppedBlocks > 0) {
+        compactBlocks();
+    }
+}
+
+void CompressedHistoryScroll::compactBlocks()
+{
+    // every compaction copies fewer bytes than have been dropped since the
+    // last one, so the blocks are copied about once on average
+    const qint64 dropped = _blockOffsets.isEmpty() ? _blocks.len() : _blockOffsets.first();
+    const qint64 live = _blocks.len() - dropped;
+    if (dropped == 0 || dropped < live) {
+        return;
+    }
+
+    QByteArray data(int(live), Qt::Uninitialized);
+    _blocks.get(data.data(), live, dropped);
+    _blocks.truncate(0);
+    _blocks.add(data.constData(), live);
+    for (qint64 &offset : _blockOffsets) {
+        offset -= dropped;
+    }
+}
+
+const CompressedHistoryScroll::Block &CompressedHistoryScroll::block(int index)
+{
+    if (index == _blockOffsets.size()) {
+        return _newest;
+    }
+
+    Block *cached = _cache.object(_firstBlock + index);
+    if (cached != nullptr) {
+        return *cached;
+    }
+
+    const qint64 start = _blockOffsets[index];
+    const qint64 end = index + 1 < _blockOffsets.size() ? _blockOffsets[index + 1] : _blocks.len();
+    QByteArray compressed(int(end - start), Qt::Uninitialized);
+    _blocks.get(compressed.data(), compressed.size(), start);
+
+    cached = new Block();
+    if (!deserialize(qUncompress(compressed), *cached)) {
+        // show the lines as empty rather than garbage
+        qCDebug(TerminalDebug) << "Reading compressed history block" << _firstBlock + index << "failed";
+        *cached = Block();
+        cached->lineEnds.fill(0, BLOCK_LINES);
+        cached->wrapped.fill(0, BLOCK_LINES);
+    }
+    _cache.insert(_firstBlock + index, cached);
+
+    return *cached;
+}
+
+qint64 CompressedHistoryScroll::memoryUsage()
+{
+    qint64 usage = _blocks.memoryUsage() + _blockOffsets.capacity() * sizeof(qint64) + _newest.memoryUsage();
+    if (_compressedBlocks > 0) {
+        // looking at the cached blocks would make them the most recently used,
+        // assume they are of the average size instead
+        const qint64 averageCells = _compressedCells / _compressedBlocks;
+        usage += _cache.size() * (averageCells * sizeof(Character) + BLOCK_LINES * (sizeof(int) + 1));
+    }
+    return usage;
+}
+
+void CompressedHistoryScroll::markStyles(CharacterStyleMarks &marks)
+{
+    for (quint32 style : qAsConst(_usedStyles)) {
+        marks.mark(style);
+    }
+}
+
+void CompressedHistoryScroll::compressBlock()
+{
+    const QByteArray compressed = qCompress(serialize(_newest), 1);
+
+    _blockOffsets.append(_blocks.len());
+    _blocks.add(compressed.constData(), compressed.size());
+    _compressedCells += _newest.cells.size();
+    _compressedBlocks++;
+
+    _newest.cells.clear();
+    _newest.lineEnds.clear();
+    _newest.wrapped.clear();
+}
+
+QByteArray CompressedHistoryScroll::serialize(const Block &block)
+{
+    QVector<uint> characters;
+    QVector<FormatRun> runs;
+    characters.reserve(block.cells.size());
+    for (const Character &c : block.cells) {
+        characters.append(c.character);
+        const quint32 format = packedFormat(c);
+        if (!runs.isEmpty() && runs.last().format == format) {
+            runs.last().length++;
+        } else {
+            runs.append({1, format});
+        }
+    }
+
+    const quint32 header[3] = {
+        quint32(block.lineEnds.size()), quint32(characters.size()), quint32(runs.size())
+    };
+
+    QByteArray data;
+    data.reserve(int(sizeof(header) + block.lineEnds.size() * (sizeof(int) + 1)
+                     + characters.size() * sizeof(uint) + runs.size() * sizeof(FormatRun)));
+    appendArray(data, header, 3);
+    appendArray(data, block.lineEnds.constData(), block.lineEnds.size());
+    data.append(block.wrapped);
+    appendArray(data, characters.constData(), characters.size());
+    appendArray(data, runs.constData(), runs.size());
+    return data;
+}
+
+bool CompressedHistoryScroll::deserialize(const QByteArray &data, Block &block)
+{
+    const char *pos = data.constData();
+    const char *end = pos + data.size();
+
+    quint32 header[3];
+    if (!readArray(pos, end, header, 3) || header[0] != quint32(BLOCK_LINES)) {
+        return false;
+    }
+
+    block.lineEnds.resize(int(header[0]));
+    block.wrapped.resize(int(header[0]));
+    block.cells.resize(int(header[1]));
+    QVector<uint> characters(int(header[1]));
+    QVector<FormatRun> runs(int(header[2]));
+    if (!readArray(pos, end, block.lineEnds.data(), header[0])
+        || !readArray(pos, end, block.wrapped.data(), header[0])
+        || !readArray(pos, end, characters.data(), header[1])
+        || !readArray(pos, end, runs.data(), header[2])) {
+        return false;
+    }
+
+    int cell = 0;
+    for (const FormatRun &run : qAsConst(runs)) {
+        if (run.length > quint32(block.cells.size() - cell)) {
+            return false;
+        }
+        for (quint32 i = 0; i < run.length; i++, cell++) {
+            block.cells[cell].character = characters[cell];
+            unpackFormat(run.format, block.cells[cell]);
+        }
+    }
+
+    return cell == block.cells.size()
+           && (header[0] == 0 || block.lineEnds.last() == block.cells.size());
 }
 
 // History Scroll None //////////////////////////////////////
@@ -385,9 +1205,13 @@ void CompactHistoryBlock::deallocate()
 
 void *CompactHistoryBlockList::allocate(size_t size)
 {
+    // keep the allocations aligned for the lines which follow
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
     CompactHistoryBlock *block;
     if (list.isEmpty() || list.last()->remaining() < size) {
-        block = new CompactHistoryBlock();
+        block = new CompactHistoryBlock(size);
+        block->setIndex(_firstIndex + list.size());
         list.append(block);
         ////qDebug() << "new block created, remaining " << block->remaining() << "number of blocks=" << list.size();
     } else {
@@ -397,77 +1221,96 @@ void *CompactHistoryBlockList::allocate(size_t size)
     return block->allocate(size);
 }
 
-void CompactHistoryBlockList::deallocate(void *ptr)
+void CompactHistoryBlockList::deallocate(CompactHistoryBlock *block)
 {
     Q_ASSERT(!list.isEmpty());
 
-    int i = 0;
-    CompactHistoryBlock *block = list.at(i);
-    while (i < list.size() && !block->contains(ptr)) {
-        i++;
-        block = list.at(i);
-    }
-
-    Q_ASSERT(i < list.size());
-
     block->deallocate();
 
     if (!block->isInUse()) {
-        list.removeAt(i);
+        // lines age out in the order they were added, so this is usually
+        // the first block, identical lines which are shared keep later
+        // blocks alive though
+        list[int(block->index() - _firstIndex)] = nullptr;
         delete block;
+
+        while (!list.isEmpty() && list.first() == nullptr) {
+            list.removeFirst();
+            _firstIndex++;
+        }
+        while (!list.isEmpty() && list.last() == nullptr) {
+            list.removeLast();
+        }
         ////qDebug() << "block deleted, new size = " << list.size();
     }
 }
 
+qint64 CompactHistoryBlockList::memoryUsage() const
+{
+    qint64 usage = 0;
+    for (CompactHistoryBlock *block : list) {
+        if (block != nullptr) {
+            usage += block->length();
+        }
+    }
+    return usage;
+}
+
 CompactHistoryBlockList::~CompactHistoryBlockList()
 {
     qDeleteAll(list.begin(), list.end());
     list.clear();
 }
 
-void *CompactHistoryLine::operator new(size_t size, CompactHistoryBlockList &blockList)
+int CompactHistoryLine::formatCount(const TextLine &line)
+{
+    if (line.isEmpty()) {
+        return 0;
+    }
+
+    // count number of different formats in this text line
+    int count = 1;
+    const Character *c = line.constData();
+    for (int k = 1; k < line.size(); k++) {
+        if (!(line[k].equalsFormat(*c))) {
+            count++; // format change detected
+            c = &line[k];
+        }
+    }
+    return count;
+}
+
+void *CompactHistoryLine::operator new(size_t size, const TextLine &line, CompactHistoryBlockList &blockList)
 {
-    return blockList.allocate(size);
+    return blockList.allocate(size + sizeof(CharacterFormat) * formatCount(line)
+                              + sizeof(uint) * line.size());
 }
 
 CompactHistoryLine::CompactHistoryLine(const TextLine &line, CompactHistoryBlockList &bList) :
     _blockListRef(bList),
+    _block(bList.last()),
     _formatArray(nullptr),
     _text(nullptr),
     _formatLength(0),
-    _wrapped(false)
+    _refCount(1),
+    _hashValue(0)
 {
     _length = line.size();
 
     if (!line.isEmpty()) {
-        _formatLength = 1;
-        int k = 1;
-
-        // count number of different formats in this text line
-        Character c = line[0];
-        while (k < _length) {
-            if (!(line[k].equalsFormat(c))) {
-                _formatLength++; // format change detected
-                c = line[k];
-            }
-            k++;
-        }
+        _formatLength = formatCount(line);
 
         ////qDebug() << "number of different formats in string: " << _formatLength;
-        _formatArray = static_cast<CharacterFormat *>(_blockListRef.allocate(sizeof(CharacterFormat) * _formatLength));
-        Q_ASSERT(_formatArray != nullptr);
-        _text = static_cast<uint *>(_blockListRef.allocate(sizeof(uint) * line.size()));
-        Q_ASSERT(_text != nullptr);
-
-        _length = line.size();
-        _wrapped = false;
+        // the formats and the characters follow the line in its allocation
+        _formatArray = reinterpret_cast<CharacterFormat *>(this + 1);
+        _text = reinterpret_cast<uint *>(_formatArray + _formatLength);
 
         // record formats and their positions in the format array
-        c = line[0];
+        Character c = line[0];
         _formatArray[0].setFormat(c);
         _formatArray[0].startPos = 0;                      // there's always at least 1 format (for the entire line, unless a change happens)
 
-        k = 1;                                            // look for possible format changes
+        int k = 1;                                        // look for possible format changes
         int j = 1;
         while (k < _length && j < _formatLength) {
             if (!(line[k].equalsFormat(c))) {
@@ -491,26 +1334,28 @@ CompactHistoryLine::CompactHistoryLine(const TextLine &line, CompactHistoryBlock
 
 CompactHistoryLine::~CompactHistoryLine()
 {
-    if (_length > 0) {
-        _blockListRef.deallocate(_text);
-        _blockListRef.deallocate(_formatArray);
-    }
-    _blockListRef.deallocate(this);
+    _blockListRef.deallocate(_block);
+}
+
+int CompactHistoryLine::formatIndex(int index) const
+{
+    // the last format which starts at or before index
+    const CharacterFormat *format = std::upper_bound(_formatArray + 1, _formatArray + _formatLength, index,
+                                                     [](int i, const CharacterFormat &f) {
+        return i < f.startPos;
+    });
+    return int(format - _formatArray) - 1;
 }
 
 void CompactHistoryLine::getCharacter(int index, Character &r)
 {
     Q_ASSERT(index < _length);
-    int formatPos = 0;
-    while ((formatPos + 1) < _formatLength && index >= _formatArray[formatPos + 1].startPos) {
-        formatPos++;
-    }
+    const CharacterFormat &format = _formatArray[formatIndex(index)];
 
     r.character = _text[index];
-    r.rendition = _formatArray[formatPos].rendition;
-    r.foregroundColor = _formatArray[formatPos].fgColor;
-    r.backgroundColor = _formatArray[formatPos].bgColor;
-    r.isRealCharacter = _formatArray[formatPos].isRealCharacter;
+    r.style = format.style;
+    r.cellRendition = format.cellRendition;
+    r.isRealCharacter = format.isRealCharacter;
 }
 
 void CompactHistoryLine::getCharacters(Character *array, int size, int startColumn)
@@ -518,15 +1363,73 @@ void CompactHistoryLine::getCharacters(Character *array, int size, int startColu
     Q_ASSERT(startColumn >= 0 && size >= 0);
     Q_ASSERT(startColumn + size <= static_cast<int>(getLength()));
 
-    for (int i = startColumn; i < size + startColumn; i++) {
-        getCharacter(i, array[i - startColumn]);
+    if (size == 0) {
+        return;
+    }
+
+    // fill the characters run by run
+    const int endColumn = startColumn + size;
+    int column = startColumn;
+    for (int formatPos = formatIndex(startColumn); column < endColumn; formatPos++) {
+        const CharacterFormat &format = _formatArray[formatPos];
+        const int runEnd = formatPos + 1 < _formatLength
+                           ? qMin<int>(_formatArray[formatPos + 1].startPos, endColumn)
+                           : endColumn;
+
+        for (; column < runEnd; column++) {
+            Character &c = array[column - startColumn];
+            c.character = _text[column];
+            c.style = format.style;
+            c.cellRendition = format.cellRendition;
+            c.isRealCharacter = format.isRealCharacter;
+        }
+    }
+}
+
+bool CompactHistoryLine::equals(const TextLine &line) const
+{
+    if (line.size() != _length) {
+        return false;
+    }
+
+    for (int formatPos = 0; formatPos < _formatLength; formatPos++) {
+        const CharacterFormat &format = _formatArray[formatPos];
+        const int runEnd = formatPos + 1 < _formatLength ? _formatArray[formatPos + 1].startPos : _length;
+
+        for (int column = format.startPos; column < runEnd; column++) {
+            const Character &c = line[column];
+            if (c.character != _text[column] || c.style != format.style
+                || c.cellRendition != format.cellRendition
+                || c.isRealCharacter != format.isRealCharacter) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void CompactHistoryLine::markStyles(CharacterStyleMarks &marks) const
+{
+    for (int formatPos = 0; formatPos < _formatLength; formatPos++) {
+        marks.mark(_formatArray[formatPos].style);
     }
 }
 
+uint CompactHistoryLine::hash(const TextLine &line)
+{
+    // all bits of a Character are used
+    return qHashBits(line.constData(), line.size() * sizeof(Character));
+}
+
 CompactHistoryScroll::CompactHistoryScroll(unsigned int maxLineCount) :
     HistoryScroll(new CompactHistoryType(maxLineCount)),
     _lines(),
-    _blockList()
+    _wrapped(),
+    _firstLine(0),
+    _blockList(),
+    _deduplicate(KonsoleSettings::deduplicateHistoryLines()),
+    _lineIndex(),
+    _distinctLines(0)
 {
     ////qDebug() << "scroll of length " << maxLineCount << " created";
     setMaxNbLines(maxLineCount);
@@ -534,19 +1437,66 @@ CompactHistoryScroll::CompactHistoryScroll(unsigned int maxLineCount) :
 
 CompactHistoryScroll::~CompactHistoryScroll()
 {
-    qDeleteAll(_lines.begin(), _lines.end());
+    if (_deduplicate && _distinctLines > 0) {
+        qCDebug(TerminalDebug) << "History lines:" << _lines.size() << "distinct:" << _distinctLines
+                               << "ratio:" << qreal(_lines.size()) / _distinctLines;
+    }
+
+    for (CompactHistoryLine *line : qAsConst(_lines)) {
+        release(line);
+    }
     _lines.clear();
 }
 
+CompactHistoryLine *CompactHistoryScroll::sharedLine(const TextLine &cells)
+{
+    uint hash = 0;
+    if (_deduplicate) {
+        hash = CompactHistoryLine::hash(cells);
+        for (auto it = _lineIndex.constFind(hash); it != _lineIndex.constEnd() && it.key() == hash; ++it) {
+            if (it.value()->equals(cells)) {
+                it.value()->ref();
+                return it.value();
+            }
+        }
+    }
+
+    auto line = new(cells, _blockList) CompactHistoryLine(cells, _blockList);
+    if (_deduplicate) {
+        line->setHashValue(hash);
+        _lineIndex.insert(hash, line);
+    }
+    _distinctLines++;
+    return line;
+}
+
+void CompactHistoryScroll::release(CompactHistoryLine *line)
+{
+    if (line->deref()) {
+        return;
+    }
+
+    if (_deduplicate) {
+        _lineIndex.remove(line->hashValue(), line);
+    }
+    _distinctLines--;
+    delete line;
+}
+
 void CompactHistoryScroll::addCellsVector(const TextLine &cells)
 {
-    CompactHistoryLine *line;
-    line = new(_blockList) CompactHistoryLine(cells, _blockList);
+    CompactHistoryLine *line = sharedLine(cells);
 
-    if (_lines.size() > static_cast<int>(_maxLineCount)) {
-        delete _lines.takeAt(0);
+    if (_lines.isEmpty() || _lines.size() < static_cast<int>(_maxLineCount)) {
+        _lines.append(line);
+        _wrapped.append(false);
+    } else {
+        // replace the oldest line
+        release(_lines[_firstLine]);
+        _lines[_firstLine] = line;
+        _wrapped[_firstLine] = false;
+        _firstLine = _firstLine + 1 < _lines.size() ? _firstLine + 1 : 0;
     }
-    _lines.append(line);
 }
 
 void CompactHistoryScroll::addCells(const Character a[], int count)
@@ -558,9 +1508,24 @@ void CompactHistoryScroll::addCells(const Character a[], int count)
 
 void CompactHistoryScroll::addLine(bool previousWrapped)
 {
-    CompactHistoryLine *line = _lines.last();
-    ////qDebug() << "last line at address " << line;
-    line->setWrapped(previousWrapped);
+    _wrapped[slot(_lines.size() - 1)] = previousWrapped;
+}
+
+qint64 CompactHistoryScroll::memoryUsage()
+{
+    // a node of the index holds the next node, the hash, the key and the line
+    const qint64 indexNode = 2 * sizeof(void *) + 2 * sizeof(uint);
+
+    return _blockList.memoryUsage() + _lines.capacity() * sizeof(CompactHistoryLine *)
+           + _wrapped.capacity() * sizeof(bool)
+           + _lineIndex.capacity() * sizeof(void *) + _lineIndex.size() * indexNode;
+}
+
+void CompactHistoryScroll::markStyles(CharacterStyleMarks &marks)
+{
+    for (const CompactHistoryLine *line : qAsConst(_lines)) {
+        line->markStyles(marks);
+    }
 }
 
 int CompactHistoryScroll::getLines()
@@ -575,7 +1540,7 @@ int CompactHistoryScroll::getLineLen(int lineNumber)
         //Q_ASSERT(lineNumber >= 0 && lineNumber < _lines.size());
         return 0;
     }
-    CompactHistoryLine *line = _lines[lineNumber];
+    CompactHistoryLine *line = this->line(lineNumber);
     ////qDebug() << "request for line at address " << line;
     return line->getLength();
 }
@@ -586,7 +1551,7 @@ void CompactHistoryScroll::getCells(int lineNumber, int startColumn, int count,
         return;
     }
     Q_ASSERT(lineNumber < _lines.size());
-    CompactHistoryLine *line = _lines[lineNumber];
+    CompactHistoryLine *line = this->line(lineNumber);
     Q_ASSERT(startColumn >= 0);
     Q_ASSERT(static_cast<unsigned int>(startColumn) <= line->getLength() - count);
     line->getCharacters(buffer, count, startColumn);
@@ -596,8 +1561,18 @@ void CompactHistoryScroll::setMaxNbLines(unsigned int lineCount)
 {
     _maxLineCount = lineCount;
 
-    while (_lines.size() > static_cast<int>(lineCount)) {
-        delete _lines.takeAt(0);
+    // store the lines in order again, so that the ring can grow or shrink
+    std::rotate(_lines.begin(), _lines.begin() + _firstLine, _lines.end());
+    std::rotate(_wrapped.begin(), _wrapped.begin() + _firstLine, _wrapped.end());
+    _firstLine = 0;
+
+    const int excess = _lines.size() - static_cast<int>(lineCount);
+    if (excess > 0) {
+        for (int i = 0; i < excess; i++) {
+            release(_lines[i]);
+        }
+        _lines.remove(0, excess);
+        _wrapped.remove(0, excess);
     }
     ////qDebug() << "set max lines to: " << _maxLineCount;
 }
@@ -605,7 +1580,7 @@ void CompactHistoryScroll::setMaxNbLines(unsigned int lineCount)
 bool CompactHistoryScroll::isWrappedLine(int lineNumber)
 {
     Q_ASSERT(lineNumber < _lines.size());
-    return _lines[lineNumber]->isWrapped();
+    return _wrapped[slot(lineNumber)];
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -615,6 +1590,15 @@ bool CompactHistoryScroll::isWrappedLine(int lineNumber)
 HistoryType::HistoryType() = default;
 HistoryType::~HistoryType() = default;
 
+HistoryScroll *HistoryType::convert(HistoryScroll *old, HistoryScroll *scroll)
+{
+    if (old == nullptr || old->getLines() == 0) {
+        delete old;
+        return scroll;
+    }
+    return new HistoryScrollConversion(old, scroll);
+}
+
 //////////////////////////////
 
 HistoryTypeNone::HistoryTypeNone() = default;
@@ -637,7 +1621,10 @@ int HistoryTypeNone::maximumLineCount() const
 
 //////////////////////////////
 
-HistoryTypeFile::HistoryTypeFile() = default;
+HistoryTypeFile::HistoryTypeFile(const QString &fileName) :
+    _fileName(fileName)
+{
+}
 
 bool HistoryTypeFile::isEnabled() const
 {
@@ -646,30 +1633,12 @@ bool HistoryTypeFile::isEnabled() const
 
 HistoryScroll *HistoryTypeFile::scroll(HistoryScroll *old) const
 {
-    if (dynamic_cast<HistoryFile *>(old) != nullptr) {
+    auto *oldFile = dynamic_cast<HistoryScrollFile *>(old);
+    if (oldFile != nullptr
+        && static_cast<const HistoryTypeFile &>(oldFile->getType()).fileName() == _fileName) {
         return old; // Unchanged.
     }
-    HistoryScroll *newScroll = new HistoryScrollFile();
-
-    Character line[LINE_SIZE];
-    int lines = (old != nullptr) ? old->getLines() : 0;
-    for (int i = 0; i < lines; i++) {
-        int size = old->getLineLen(i);
-        if (size > LINE_SIZE) {
-            auto tmp_line = new Character[size];
-            old->getCells(i, 0, size, tmp_line);
-            newScroll->addCells(tmp_line, size);
-            newScroll->addLine(old->isWrappedLine(i));
-            delete [] tmp_line;
-        } else {
-            old->getCells(i, 0, size, line);
-            newScroll->addCells(line, size);
-            newScroll->addLine(old->isWrappedLine(i));
-        }
-    }
-
-    delete old;
-    return newScroll;
+    return convert(old, new HistoryScrollFile(_fileName));
 }
 
 int HistoryTypeFile::maximumLineCount() const
@@ -679,6 +1648,33 @@ int HistoryTypeFile::maximumLineCount() const
 
 //////////////////////////////
 
+CompressedHistoryType::CompressedHistoryType(int nbLines) :
+    _maxLines(nbLines)
+{
+}
+
+bool CompressedHistoryType::isEnabled() const
+{
+    return true;
+}
+
+HistoryScroll *CompressedHistoryType::scroll(HistoryScroll *old) const
+{
+    auto *oldCompressed = dynamic_cast<CompressedHistoryScroll *>(old);
+    if (oldCompressed != nullptr) {
+        oldCompressed->setMaxNbLines(_maxLines);
+        return old;
+    }
+    return convert(old, new CompressedHistoryScroll(_maxLines));
+}
+
+int CompressedHistoryType::maximumLineCount() const
+{
+    return _maxLines;
+}
+
+//////////////////////////////
+
 CompactHistoryType::CompactHistoryType(unsigned int nbLines) :
     _maxLines(nbLines)
 {
@@ -702,7 +1698,6 @@ HistoryScroll *CompactHistoryType::scroll(HistoryScroll *old) const
             oldBuffer->setMaxNbLines(_maxLines);
             return oldBuffer;
         }
-        delete old;
     }
-    return new CompactHistoryScroll(_maxLines);
+    return convert(old, new CompactHistoryScroll(_maxLines));
 }
@@ -25,7 +25,14 @@
 #include <sys/mman.h>
 
 // Qt
+#include <QByteArray>
+#include <QCache>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QList>
+#include <QLockFile>
+#include <QScopedPointer>
+#include <QSet>
 #include <QVector>
 #include <QTemporaryFile>
 
@@ -36,42 +43,151 @@
 
 namespace terminal {
 /*
-   An extendable tmpfile(1) based buffer.
+   An extendable tmpfile(1) based buffer, or a buffer in a named
+   file which keeps its contents for later processes.
 */
 
 class HistoryFile
 {
 public:
-    HistoryFile();
+    // uses a temporary file if fileName is empty
+    explicit HistoryFile(const QString &fileName = QString());
     virtual ~HistoryFile();
 
     virtual void add(const char *buffer, qint64 count);
     virtual void get(char *buffer, qint64 size, qint64 loc);
     virtual qint64 len() const;
 
-    //mmaps the file in read-only mode
-    void map();
-    //un-mmaps the file
-    void unmap();
+    //the bytes of memory used, the mmap'ed windows are backed by the file
+    qint64 memoryUsage() const
+    {
+        return _tail.capacity();
+    }
+
+    //drops everything after the first length bytes
+    void truncate(qint64 length);
+
+    //writes what has been added to a named file right away
+    void flush();
 
 private:
+    struct Window {
+        qint64 index;
+        uchar *data;
+    };
+
+    //returns the window with the given index, which is mmap'ed in read-only
+    //mode if necessary, or 0 if mmap'ing fails
+    const uchar *window(qint64 index);
+    //writes the part of the tail which is not in the file yet
+    void writeTail();
+    //reads the incomplete window at the end of the file into the tail
+    void loadTail();
+    //un-mmaps all windows
+    void unmapWindows();
+
     qint64 _length;
+    qint64 _fileLength; //the number of bytes written to the file
     QTemporaryFile _tmpFile;
+    QFile _namedFile;
+    QFileDevice *_file; //_tmpFile or _namedFile
+
+    //The file is written and mmap'ed in windows of WINDOW_SIZE bytes.
+    //Added data is kept in _tail until a whole window is complete, so the
+    //part of the file which has been written never changes and mmap'ed
+    //windows stay valid while the history grows.  A named file is also
+    //written in batches of WRITE_SIZE bytes or every WRITE_INTERVAL ms,
+    //reads of the tail are still served from memory.
+    QByteArray _tail;
+    QElapsedTimer _lastWrite;
+
+    //the mmap'ed windows, the most recently used first
+    QVector<Window> _windows;
+
+    static const qint64 WINDOW_SIZE = 4 * 1024 * 1024;
+    static const qint64 WRITE_SIZE = 64 * 1024;
+    static const qint64 WRITE_INTERVAL = 1000;
+    //the least recently used window is un-mmap'ed when this many are mapped
+    static const int MAX_WINDOWS = 16;
+};
 
-    //pointer to start of mmap'ed file data, or 0 if the file is not mmap'ed
-    uchar *_fileMap;
+//////////////////////////////////////////////////////////////////////
 
-    //incremented whenever 'add' is called and decremented whenever
-    //'get' is called.
-    //this is used to detect when a large number of lines are being read and processed from the history
-    //and automatically mmap the file for better performance (saves the overhead of many lseek-read calls).
-    int _readWriteBalance;
+//////////////////////////////////////////////////////////////////////
+// The ends of lines in a row of cells and their wrapped flags, packed
+// into 5 bytes per line and kept in chunks, so that growing never
+// copies the lines which are already there.  The chunks are allocated
+// in memory, or mapped from a file which keeps the index for later
+// processes in the same layout.
+//////////////////////////////////////////////////////////////////////
+class HistoryLineIndex
+{
+public:
+    HistoryLineIndex();
+    ~HistoryLineIndex();
 
-    //when _readWriteBalance goes below this threshold, the file will be mmap'ed automatically
-    static const int MAP_THRESHOLD = -1000;
-};
+    // keeps the index in fileName, the lines which are already in the file
+    // are part of it.  Returns false if the file cannot be used, the index
+    // is kept in memory then.  Only valid while the index is empty.
+    bool open(const QString &fileName);
 
-//////////////////////////////////////////////////////////////////////
+    // end is the number of cells up to and including the line
+    void append(qint64 end, bool wrapped);
+
+    // drops everything after the first count lines
+    void truncate(int count);
+
+    int count() const
+    {
+        return _count;
+    }
+
+    // the mapped chunks are backed by the file
+    qint64 memoryUsage() const
+    {
+        return qint64(_chunks.size() - _mappedChunks) * sizeof(Chunk);
+    }
+
+    qint64 end(int line) const
+    {
+        const Chunk *chunk = _chunks[line >> CHUNK_BITS];
+        const int i = line & (CHUNK_SIZE - 1);
+        return qint64(chunk->high[i] & HIGH_MASK) << 32 | chunk->low[i];
+    }
+
+    bool isWrapped(int line) const
+    {
+        return (_chunks[line >> CHUNK_BITS]->high[line & (CHUNK_SIZE - 1)] & WRAPPED) != 0;
+    }
+
+private:
+    Q_DISABLE_COPY(HistoryLineIndex)
+
+    static const int CHUNK_BITS = 16;
+    static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+    // the high byte holds bits 32 to 38 of the end and the wrapped flag
+    static const quint8 HIGH_MASK = 0x7f;
+    static const quint8 WRAPPED = 0x80;
+
+    struct Chunk {
+        quint32 low[CHUNK_SIZE];
+        quint8 high[CHUNK_SIZE];
+    };
+
+    // the file starts with the number of lines, the chunks follow at
+    // offsets which are multiples of the page size
+    static const qint64 HEADER_SIZE = 4096;
+
+    // maps the chunk with the given index, growing the file if necessary
+    Chunk *mapChunk(int index);
+
+    QVector<Chunk *> _chunks;
+    int _count;
+
+    QFile _file;
+    qint64 *_savedCount; // the number of lines in the file, if it is open
+    int _mappedChunks;   // the first chunks are mapped, the others allocated
+};
 
 //////////////////////////////////////////////////////////////////////
 // Abstract base class for file and buffer versions
@@ -103,12 +219,33 @@ public:
 
     virtual void addLine(bool previousWrapped = false) = 0;
 
+    // the approximate number of bytes of memory the history keeps,
+    // not counting what it has written to files
+    virtual qint64 memoryUsage()
+    {
+        return 0;
+    }
+
+    // the number of lines with different content, less than getLines()
+    // if the history stores identical lines only once
+    virtual int distinctLines()
+    {
+        return getLines();
+    }
+
+    // marks the styles of the characters in the history, see
+    // CharacterStyleTable::collect()
+    virtual void markStyles(CharacterStyleMarks &marks)
+    {
+        Q_UNUSED(marks)
+    }
+
     //
     // FIXME:  Passing around constant references to HistoryType instances
     // is very unsafe, because those references will no longer
     // be valid if the history scroll is deleted.
     //
-    const HistoryType &getType() const
+    virtual const HistoryType &getType() const
     {
         return *_historyType;
     }
@@ -124,7 +261,19 @@ protected:
 class  HistoryScrollFile : public HistoryScroll
 {
 public:
-    explicit HistoryScrollFile();
+    /**
+     * Keeps the history in a temporary file, or in files named after
+     * @p fileName which keep it for later processes.  In that case the
+     * lines already in the files are part of the history.
+     *
+     * Where the lines start and whether they are wrapped is kept in
+     * memory, files which outlive the process keep it in a file which
+     * is mapped, so reopening them reads nothing but the incomplete end
+     * of the cells.  They can only be read by the user and are locked
+     * while they are open.  If another process holds the lock, the
+     * history goes to a temporary file instead.
+     */
+    explicit HistoryScrollFile(const QString &fileName = QString());
     ~HistoryScrollFile() Q_DECL_OVERRIDE;
 
     int  getLines() Q_DECL_OVERRIDE;
@@ -135,12 +284,172 @@ public:
     void addCells(const Character text[], int count) Q_DECL_OVERRIDE;
     void addLine(bool previousWrapped = false) Q_DECL_OVERRIDE;
 
+    qint64 memoryUsage() Q_DECL_OVERRIDE;
+    void markStyles(CharacterStyleMarks &marks) Q_DECL_OVERRIDE;
+
+    // removes the files of a history created with fileName, unless they
+    // are open in any process
+    static void removeFiles(const QString &fileName);
+    // removes the files of the histories in directory which are neither
+    // created with one of the fileNames nor open in any process
+    static void removeUnusedFiles(const QString &directory, const QStringList &fileNames);
+
 private:
+    // lock is the lock of the files of a named history, or 0 for a
+    // temporary file
+    HistoryScrollFile(const QString &fileName, QLockFile *lock);
+
     qint64 startOfLine(int lineno);
+    // drops what a previous process did not finish writing
+    void repair();
+    void loadStyles();
 
-    HistoryFile _index; // lines Row(qint64)
+    QScopedPointer<QLockFile> _lock; // taken before the files are opened
+    HistoryLineIndex _lines; // in the lines file for named histories
     HistoryFile _cells; // text  Row(Character)
-    HistoryFile _lineflags; // flags Row(unsigned char)
+
+    // The styles of the characters are indices into the
+    // CharacterStyleTable of the process.  Files which outlive it
+    // store indices into their own table of styles instead.
+    bool _named;
+    QScopedPointer<HistoryFile> _styles; // styles Row(quint32[CharacterStyleTable::SavedSize])
+    QHash<quint32, quint32> _fileStyles; // file style by process style
+    QVector<quint32> _processStyles;     // process style by file style
+    QSet<quint32> _usedStyles;           // the styles of a temporary file
+    QVector<Character> _buffer;
+};
+
+//////////////////////////////////////////////////////////////////////
+// History which is being converted to another type
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * Fronts the history of the previous type while its lines are copied into
+ * the history of the new type.
+ *
+ * The lines which have been migrated are read from the new history, the
+ * remaining ones from the old history.  Added lines go to the old history
+ * until all of its lines have been migrated, which happens in chunks by
+ * calling migrate(), so no line has to wait for the conversion.  The old
+ * history keeps its limit meanwhile, the lines it drops are lost unless
+ * they have been migrated already.
+ */
+class  HistoryScrollConversion : public HistoryScroll
+{
+public:
+    HistoryScrollConversion(HistoryScroll *source, HistoryScroll *target);
+    ~HistoryScrollConversion() Q_DECL_OVERRIDE;
+
+    int  getLines() Q_DECL_OVERRIDE;
+    int  getLineLen(int lineno) Q_DECL_OVERRIDE;
+    void getCells(int lineno, int colno, int count, Character res[]) Q_DECL_OVERRIDE;
+    bool isWrappedLine(int lineno) Q_DECL_OVERRIDE;
+
+    void addCells(const Character a[], int count) Q_DECL_OVERRIDE;
+    void addCellsVector(const QVector<Character> &cells) Q_DECL_OVERRIDE;
+    void addLine(bool previousWrapped = false) Q_DECL_OVERRIDE;
+
+    qint64 memoryUsage() Q_DECL_OVERRIDE;
+    int distinctLines() Q_DECL_OVERRIDE;
+    void markStyles(CharacterStyleMarks &marks) Q_DECL_OVERRIDE;
+
+    // the type of the new history
+    const HistoryType &getType() const Q_DECL_OVERRIDE;
+
+    /**
+     * Copies up to @p count lines from the old history to the new one.
+     * Returns true once all lines have been copied.
+     */
+    bool migrate(int count);
+
+    /**
+     * Returns the new history, which is no longer deleted by this
+     * conversion.  Only valid once migrate() has returned true.
+     */
+    HistoryScroll *takeTarget();
+
+private:
+    HistoryScroll *_source;
+    HistoryScroll *_target;
+    int _migrated; // the number of lines of _source which are in _target
+    int _sourceLines; // the number of lines of _source after the last addLine()
+    QVector<Character> _buffer;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Compressed file-based history (unlimited, or limited in length)
+//////////////////////////////////////////////////////////////////////
+typedef QVector<Character> TextLine;
+
+class  CompressedHistoryScroll : public HistoryScroll
+{
+public:
+    // keeps all lines if maxLineCount is -1
+    explicit CompressedHistoryScroll(int maxLineCount = -1);
+    ~CompressedHistoryScroll() Q_DECL_OVERRIDE;
+
+    int  getLines() Q_DECL_OVERRIDE;
+    int  getLineLen(int lineno) Q_DECL_OVERRIDE;
+    void getCells(int lineno, int colno, int count, Character res[]) Q_DECL_OVERRIDE;
+    bool isWrappedLine(int lineno) Q_DECL_OVERRIDE;
+
+    void addCells(const Character text[], int count) Q_DECL_OVERRIDE;
+    void addLine(bool previousWrapped = false) Q_DECL_OVERRIDE;
+
+    qint64 memoryUsage() Q_DECL_OVERRIDE;
+    void markStyles(CharacterStyleMarks &marks) Q_DECL_OVERRIDE;
+
+    void setMaxNbLines(int lineCount);
+
+private:
+    // BLOCK_LINES consecutive lines of the history
+    struct Block {
+        TextLine cells;
+        QVector<int> lineEnds; // end of each line in cells
+        QByteArray wrapped;    // wrapped flag of each line
+
+        int lineStart(int line) const
+        {
+            return line > 0 ? lineEnds[line - 1] : 0;
+        }
+
+        qint64 memoryUsage() const
+        {
+            return cells.capacity() * sizeof(Character) + lineEnds.capacity() * sizeof(int)
+                   + wrapped.capacity();
+        }
+    };
+
+    // returns the block with the given index, decompressing it if necessary
+    const Block &block(int index);
+    // compresses the newest block and appends it to the file
+    void compressBlock();
+    // drops the oldest lines which exceed _maxLineCount
+    void dropLines();
+    // moves the blocks which are left to the start of the file once the
+    // dropped blocks take more of it than they do
+    void compactBlocks();
+
+    static QByteArray serialize(const Block &block);
+    static bool deserialize(const QByteArray &data, Block &block);
+
+    static const int BLOCK_LINES = 512;
+    static const int CACHED_BLOCKS = 4;
+
+    // The oldest _droppedLines lines of the first block are no longer part
+    // of the history, the first block is dropped once all of its lines are.
+    // The space of dropped blocks is reclaimed by compactBlocks(), so the
+    // file stays at most about twice the size of the remaining blocks.
+    HistoryFile _blocks;           // the compressed blocks
+    QVector<qint64> _blockOffsets; // start of each compressed block in _blocks
+    Block _newest;                 // the newest block, not compressed yet
+    QCache<qint64, Block> _cache;  // recently decompressed blocks by _firstBlock + index
+    qint64 _compressedCells;       // the number of cells in all blocks ever compressed
+    qint64 _compressedBlocks;      // the number of blocks ever compressed
+    qint64 _firstBlock;            // the number of blocks which have been dropped
+    int _droppedLines;
+    int _maxLineCount;
+    QSet<quint32> _usedStyles;     // the styles of all cells
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -168,46 +477,45 @@ public:
 // This implementation uses a list of fixed-sized blocks
 // where history lines are allocated in (avoids heap fragmentation)
 //////////////////////////////////////////////////////////////////////
-typedef QVector<Character> TextLine;
 
 class CharacterFormat
 {
 public:
     bool equalsFormat(const CharacterFormat &other) const
     {
-        return (other.rendition & ~RE_EXTENDED_CHAR) == (rendition & ~RE_EXTENDED_CHAR)
-               && other.fgColor == fgColor && other.bgColor == bgColor;
+        return other.style == style;
     }
 
     bool equalsFormat(const Character &c) const
     {
-        return (c.rendition & ~RE_EXTENDED_CHAR) == (rendition & ~RE_EXTENDED_CHAR)
-               && c.foregroundColor == fgColor && c.backgroundColor == bgColor;
+        return c.style == style;
     }
 
     void setFormat(const Character &c)
     {
-        rendition = c.rendition;
-        fgColor = c.foregroundColor;
-        bgColor = c.backgroundColor;
+        style = c.style;
+        cellRendition = c.cellRendition;
         isRealCharacter = c.isRealCharacter;
     }
 
-    CharacterColor fgColor, bgColor;
+    quint32 style;
     quint16 startPos;
-    RenditionFlags rendition;
+    quint8 cellRendition;
     bool isRealCharacter;
 };
 
 class CompactHistoryBlock
 {
 public:
-    CompactHistoryBlock() :
-        _blockLength(4096 * 64), // 256kb
+    // the block is larger than 256kb if a single allocation of
+    // minimumLength bytes needs it
+    explicit CompactHistoryBlock(size_t minimumLength = 0) :
+        _blockLength(qMax<size_t>(4096 * 64, (minimumLength + 4095) & ~size_t(4095))), // 256kb
         _head(static_cast<quint8 *>(mmap(nullptr, _blockLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0))),
         _tail(nullptr),
         _blockStart(nullptr),
-        _allocCount(0)
+        _allocCount(0),
+        _index(0)
     {
         Q_ASSERT(_head != MAP_FAILED);
         _tail = _blockStart = _head;
@@ -241,33 +549,61 @@ public:
         return _allocCount != 0;
     }
 
+    // the number of blocks which have been created before this one
+    // by its CompactHistoryBlockList
+    qint64 index() const
+    {
+        return _index;
+    }
+
+    void setIndex(qint64 index)
+    {
+        _index = index;
+    }
+
 private:
     size_t _blockLength;
     quint8 *_head;
     quint8 *_tail;
     quint8 *_blockStart;
     int _allocCount;
+    qint64 _index;
 };
 
 class CompactHistoryBlockList
 {
 public:
     CompactHistoryBlockList() :
-        list(QList<CompactHistoryBlock *>())
+        list(QList<CompactHistoryBlock *>()),
+        _firstIndex(0)
     {
     }
 
     ~CompactHistoryBlockList();
 
     void *allocate(size_t size);
-    void deallocate(void *);
+    void deallocate(CompactHistoryBlock *block);
+    // the block which the last allocation has been made from
+    CompactHistoryBlock *last()
+    {
+        return list.last();
+    }
+
     int length()
     {
         return list.size();
     }
 
+    qint64 memoryUsage() const;
+
 private:
+    // The blocks in the order they were created.  A block which is no
+    // longer in use is deleted right away and leaves a null entry unless
+    // it is the first or the last one, the list never starts or ends with
+    // a null entry.  Blocks are found by their index, list[0] is the block
+    // with the index _firstIndex.
     QList<CompactHistoryBlock *> list;
+    qint64 _firstIndex;
 };
 
 class CompactHistoryLine
@@ -276,8 +612,9 @@ public:
     CompactHistoryLine(const TextLine &, CompactHistoryBlockList &blockList);
     virtual ~CompactHistoryLine();
 
-    // custom new operator to allocate memory from custom pool instead of heap
-    static void *operator new(size_t size, CompactHistoryBlockList &blockList);
+    // custom new operator to allocate memory from custom pool instead of heap,
+    // the formats and characters of the line are allocated along with it
+    static void *operator new(size_t size, const TextLine &line, CompactHistoryBlockList &blockList);
     static void operator delete(void *)
     {
         /* do nothing, deallocation from pool is done in destructor*/
@@ -285,33 +622,58 @@ public:
 
     virtual void getCharacters(Character *array, int size, int startColumn);
     virtual void getCharacter(int index, Character &r);
-    virtual bool isWrapped() const
+    // returns true if the line holds the same characters as line
+    virtual bool equals(const TextLine &line) const;
+    void markStyles(CharacterStyleMarks &marks) const;
+
+    virtual unsigned int getLength() const
     {
-        return _wrapped;
+        return _length;
     }
 
-    virtual void setWrapped(bool value)
+    // lines with the same content are shared in the history,
+    // the line is deleted when the last reference is released
+    void ref()
     {
-        _wrapped = value;
+        _refCount++;
     }
 
-    virtual unsigned int getLength() const
+    bool deref()
     {
-        return _length;
+        return --_refCount != 0;
+    }
+
+    static uint hash(const TextLine &line);
+
+    // the hash of the content, as returned by hash()
+    uint hashValue() const
+    {
+        return _hashValue;
+    }
+
+    void setHashValue(uint value)
+    {
+        _hashValue = value;
     }
 
 protected:
+    static int formatCount(const TextLine &line);
+    // returns the index of the format of the character at index
+    int formatIndex(int index) const;
+
     CompactHistoryBlockList &_blockListRef;
+    CompactHistoryBlock *_block; // the block the line is allocated in
     CharacterFormat *_formatArray;
     quint16 _length;
     uint    *_text;
     quint16 _formatLength;
-    bool _wrapped;
+    quint32 _refCount;
+    uint _hashValue;
 };
 
 class  CompactHistoryScroll : public HistoryScroll
 {
-    typedef QList<CompactHistoryLine *> HistoryArray;
+    typedef QVector<CompactHistoryLine *> HistoryArray;
 
 public:
     explicit CompactHistoryScroll(unsigned int maxLineCount = 1000);
@@ -326,13 +688,47 @@ public:
     void addCellsVector(const TextLine &cells) Q_DECL_OVERRIDE;
     void addLine(bool previousWrapped = false) Q_DECL_OVERRIDE;
 
+    qint64 memoryUsage() Q_DECL_OVERRIDE;
+    void markStyles(CharacterStyleMarks &marks) Q_DECL_OVERRIDE;
+
     void setMaxNbLines(unsigned int lineCount);
 
+    // lines with the same content are stored only once
+    int distinctLines() Q_DECL_OVERRIDE
+    {
+        return _distinctLines;
+    }
+
 private:
     bool hasDifferentColors(const TextLine &line) const;
+    CompactHistoryLine *line(int lineNumber) const
+    {
+        return _lines[slot(lineNumber)];
+    }
+
+    int slot(int lineNumber) const
+    {
+        const int slot = _firstLine + lineNumber;
+        return slot < _lines.size() ? slot : slot - _lines.size();
+    }
+
+    // returns a line with the content of cells, shared with an
+    // identical line of the history if there is one
+    CompactHistoryLine *sharedLine(const TextLine &cells);
+    void release(CompactHistoryLine *line);
+
+    // a ring of the lines once _maxLineCount lines are stored,
+    // _firstLine is the slot of the oldest one
     HistoryArray _lines;
+    QVector<bool> _wrapped; // the wrapped flags of the slots
+    int _firstLine;
     CompactHistoryBlockList _blockList;
 
+    // the lines by the hash of their content, if identical lines are shared
+    bool _deduplicate;
+    QMultiHash<uint, CompactHistoryLine *> _lineIndex;
+    int _distinctLines;
+
     unsigned int _maxLineCount;
 };
 
@@ -368,6 +764,13 @@ public:
     {
         return maximumLineCount() == -1;
     }
+
+protected:
+    /**
+     * Returns a history which holds the lines of @p old in @p scroll,
+     * a HistoryScrollConversion if there are lines to copy.
+     */
+    static HistoryScroll *convert(HistoryScroll *old, HistoryScroll *scroll);
 };
 
 class  HistoryTypeNone : public HistoryType
@@ -384,12 +787,36 @@ public:
 class  HistoryTypeFile : public HistoryType
 {
 public:
-    explicit HistoryTypeFile();
+    // see HistoryScrollFile for the fileName
+    explicit HistoryTypeFile(const QString &fileName = QString());
+
+    bool isEnabled() const Q_DECL_OVERRIDE;
+    int maximumLineCount() const Q_DECL_OVERRIDE;
+
+    HistoryScroll *scroll(HistoryScroll *) const Q_DECL_OVERRIDE;
+
+    QString fileName() const
+    {
+        return _fileName;
+    }
+
+protected:
+    QString _fileName;
+};
+
+class  CompressedHistoryType : public HistoryType
+{
+public:
+    // an unlimited history if nbLines is -1
+    explicit CompressedHistoryType(int nbLines = -1);
 
     bool isEnabled() const Q_DECL_OVERRIDE;
     int maximumLineCount() const Q_DECL_OVERRIDE;
 
     HistoryScroll *scroll(HistoryScroll *) const Q_DECL_OVERRIDE;
+
+protected:
+    int _maxLines;
 };
 
 class  CompactHistoryType : public HistoryType
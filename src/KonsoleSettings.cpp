@@ -181,6 +181,19 @@ KonsoleSettings::KonsoleSettings(  )
   mScaleOutputItem->setLabel( QCoreApplication::translate("KonsoleSettings", "&Scale output") );
   addItem( mScaleOutputItem, QStringLiteral( "ScaleOutput" ) );
 
+  setCurrentGroup( QStringLiteral( "History" ) );
+
+  mDeduplicateHistoryLinesItem = new KCoreConfigSkeleton::ItemBool( currentGroup(), QStringLiteral( "DeduplicateHistoryLines" ), mDeduplicateHistoryLines, true );
+  mDeduplicateHistoryLinesItem->setLabel( QCoreApplication::translate("KonsoleSettings", "Store identical lines of a fixed size scrollback only once") );
+  addItem( mDeduplicateHistoryLinesItem, QStringLiteral( "DeduplicateHistoryLines" ) );
+  mSaveScrollbackItem = new KCoreConfigSkeleton::ItemBool( currentGroup(), QStringLiteral( "SaveScrollback" ), mSaveScrollback, false );
+  mSaveScrollbackItem->setLabel( QCoreApplication::translate("KonsoleSettings", "Keep the unlimited scrollback of saved sessions for the next start") );
+  addItem( mSaveScrollbackItem, QStringLiteral( "SaveScrollback" ) );
+  mHistoryMemoryBudgetItem = new KCoreConfigSkeleton::ItemInt( currentGroup(), QStringLiteral( "HistoryMemoryBudget" ), mHistoryMemoryBudget, 1024 );
+  mHistoryMemoryBudgetItem->setLabel( QCoreApplication::translate("KonsoleSettings", "Memory in MiB the scrollback of all sessions may use before the least recently viewed ones are moved to disk, 0 for no limit") );
+  mHistoryMemoryBudgetItem->setMinValue(0);
+  addItem( mHistoryMemoryBudgetItem, QStringLiteral( "HistoryMemoryBudget" ) );
+
   setCurrentGroup( QStringLiteral( "FileLocation" ) );
 
   mScrollbackUseSystemLocationItem = new KCoreConfigSkeleton::ItemBool( currentGroup(), QStringLiteral( "scrollbackUseSystemLocation" ), mScrollbackUseSystemLocation, true );
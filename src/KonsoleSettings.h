@@ -641,6 +641,93 @@ class Q_DECL_EXPORT KonsoleSettings : public KCoreConfigSkeleton
       return mScaleOutputItem;
     }
 
+    /**
+      Set Store identical lines of a fixed size scrollback only once
+    */
+    static
+    void setDeduplicateHistoryLines( bool v )
+    {
+      if (!self()->isImmutable( QStringLiteral( "DeduplicateHistoryLines" ) ))
+        self()->mDeduplicateHistoryLines = v;
+    }
+
+    /**
+      Get Store identical lines of a fixed size scrollback only once
+    */
+    static
+    bool deduplicateHistoryLines()
+    {
+      return self()->mDeduplicateHistoryLines;
+    }
+
+    /**
+      Get Item object corresponding to DeduplicateHistoryLines()
+    */
+    ItemBool *deduplicateHistoryLinesItem()
+    {
+      return mDeduplicateHistoryLinesItem;
+    }
+
+    /**
+      Set Keep the unlimited scrollback of saved sessions for the next start
+    */
+    static
+    void setSaveScrollback( bool v )
+    {
+      if (!self()->isImmutable( QStringLiteral( "SaveScrollback" ) ))
+        self()->mSaveScrollback = v;
+    }
+
+    /**
+      Get Keep the unlimited scrollback of saved sessions for the next start
+    */
+    static
+    bool saveScrollback()
+    {
+      return self()->mSaveScrollback;
+    }
+
+    /**
+      Get Item object corresponding to SaveScrollback()
+    */
+    ItemBool *saveScrollbackItem()
+    {
+      return mSaveScrollbackItem;
+    }
+
+    /**
+      Set Memory in MiB the scrollback of all sessions may use before the least recently viewed ones are moved to disk, 0 for no limit
+    */
+    static
+    void setHistoryMemoryBudget( int v )
+    {
+      if (v < 0)
+      {
+        qDebug() << "setHistoryMemoryBudget: value " << v << " is less than the minimum value of 0";
+        v = 0;
+      }
+
+      if (!self()->isImmutable( QStringLiteral( "HistoryMemoryBudget" ) ))
+        self()->mHistoryMemoryBudget = v;
+    }
+
+    /**
+      Get Memory in MiB the scrollback of all sessions may use before the least recently viewed ones are moved to disk, 0 for no limit
+    */
+    static
+    int historyMemoryBudget()
+    {
+      return self()->mHistoryMemoryBudget;
+    }
+
+    /**
+      Get Item object corresponding to HistoryMemoryBudget()
+    */
+    ItemInt *historyMemoryBudgetItem()
+    {
+      return mHistoryMemoryBudgetItem;
+    }
+
     /**
       Set For scrollback files, use system-wide folder location
     */
@@ -785,6 +872,11 @@ class Q_DECL_EXPORT KonsoleSettings : public KCoreConfigSkeleton
     bool mPrinterFriendly;
     bool mScaleOutput;
 
+    // History
+    bool mDeduplicateHistoryLines;
+    bool mSaveScrollback;
+    int mHistoryMemoryBudget;
+
     // FileLocation
     bool mScrollbackUseSystemLocation;
     bool mScrollbackUseCacheLocation;
@@ -815,6 +907,9 @@ class Q_DECL_EXPORT KonsoleSettings : public KCoreConfigSkeleton
     ItemBool *mExpandTabWidthItem;
     ItemBool *mPrinterFriendlyItem;
     ItemBool *mScaleOutputItem;
+    ItemBool *mDeduplicateHistoryLinesItem;
+    ItemBool *mSaveScrollbackItem;
+    ItemInt *mHistoryMemoryBudgetItem;
     ItemBool *mScrollbackUseSystemLocationItem;
     ItemBool *mScrollbackUseCacheLocationItem;
     ItemBool *mScrollbackUseSpecifiedLocationItem;
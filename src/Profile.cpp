@@ -99,6 +99,8 @@ const Profile::PropertyInfo Profile::DefaultPropertyNames[] = {
     , { BidiRenderingEnabled , "BidiRenderingEnabled" , TERMINAL_GROUP , QVariant::Bool }
     , { BlinkingCursorEnabled , "BlinkingCursorEnabled" , TERMINAL_GROUP , QVariant::Bool }
     , { BellMode , "BellMode" , TERMINAL_GROUP , QVariant::Int }
+    , { EmulationThreadEnabled , "EmulationThreadEnabled" , TERMINAL_GROUP , QVariant::Bool }
+    , { OpenGLRenderingEnabled , "OpenGLRenderingEnabled" , TERMINAL_GROUP , QVariant::Bool }
 
     // Cursor
     , { UseCustomCursorColor , "UseCustomCursorColor" , CURSOR_GROUP , QVariant::Bool}
@@ -184,6 +186,8 @@ void Profile::useFallback()
     setProperty(ScrollFullPage, false);
 
     setProperty(FlowControlEnabled, true);
+    setProperty(EmulationThreadEnabled, false);
+    setProperty(OpenGLRenderingEnabled, false);
     setProperty(UrlHintsModifiers, 0);
     setProperty(ReverseUrlHints, false);
     setProperty(BlinkingTextEnabled, true);
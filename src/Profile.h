@@ -287,7 +287,15 @@ public:
         /** (int) Keyboard modifiers to show URL hints */
         UrlHintsModifiers,
         /** (bool) Reverse the order of URL hints */
-        ReverseUrlHints
+        ReverseUrlHints,
+        /** (bool) Specifies whether the output of the terminal process is
+         * read and processed on a worker thread instead of the GUI thread.
+         */
+        EmulationThreadEnabled,
+        /** (bool) Specifies whether the terminal display is drawn with
+         * OpenGL instead of QPainter.
+         */
+        OpenGLRenderingEnabled
     };
 
     Q_ENUM(Property)
@@ -498,6 +506,18 @@ public:
         return property<bool>(Profile::FlowControlEnabled);
     }
 
+    /** Convenience method for property<bool>(Profile::EmulationThreadEnabled) */
+    bool emulationThreadEnabled() const
+    {
+        return property<bool>(Profile::EmulationThreadEnabled);
+    }
+
+    /** Convenience method for property<bool>(Profile::OpenGLRenderingEnabled) */
+    bool openGLRenderingEnabled() const
+    {
+        return property<bool>(Profile::OpenGLRenderingEnabled);
+    }
+
     /** Convenience method for property<bool>(Profile::UseCustomCursorColor) */
     bool useCustomCursorColor() const
     {
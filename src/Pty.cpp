@@ -28,6 +28,7 @@
 #include <csignal>
 
 // Qt
+#include <QSocketNotifier>
 #include <QStringList>
 #include <qplatformdefs.h>
 
@@ -36,14 +37,22 @@
 
 using terminal::Pty;
 
+// The output of the process is read straight into a buffer of this size,
+// which is reused for every read.
+static const int READ_BUFFER_SIZE = 64 * 1024;
+// The amount of output read in one go before returning to the event loop
+static const int READ_BUDGET = 256 * 1024;
+
 Pty::Pty(int masterFd, QObject *aParent) :
-    KPtyProcess(masterFd, aParent)
+    KPtyProcess(masterFd, aParent),
+    _readNotifier(nullptr)
 {
     init();
 }
 
 Pty::Pty(QObject *aParent) :
-    KPtyProcess(aParent)
+    KPtyProcess(aParent),
+    _readNotifier(nullptr)
 {
     init();
 }
@@ -84,7 +93,14 @@ void Pty::init()
     setUseUtmp(true);
     setPtyChannels(KPtyProcess::AllChannels);
 
-    connect(pty(), &KPtyDevice::readyRead, this, &terminal::Pty::dataReceived);
+    // Read the output ourselves instead of through KPtyDevice, which
+    // copies it into a ring buffer and then again for readAll().
+    if (pty()->masterFd() >= 0) {
+        pty()->setSuspended(true);
+        _readBuffer.resize(READ_BUFFER_SIZE);
+        _readNotifier = new QSocketNotifier(pty()->masterFd(), QSocketNotifier::Read, this);
+        connect(_readNotifier, &QSocketNotifier::activated, this, &terminal::Pty::dataReceived);
+    }
 }
 
 Pty::~Pty() = default;
@@ -103,12 +119,21 @@ void Pty::sendData(const QByteArray &data)
 
 void Pty::dataReceived()
 {
-    QByteArray data = pty()->readAll();
-    if (data.isEmpty()) {
-        return;
+    const bool open = readAvailable(pty()->masterFd(), _readBuffer, READ_BUDGET,
+                                    [this](const char *data, int length) {
+        emit receivedData(data, length);
+    });
+
+    if (!open) {
+        _readNotifier->setEnabled(false);
     }
+}
 
-    emit receivedData(data.constData(), data.count());
+void Pty::setReadSuspended(bool suspended)
+{
+    if (_readNotifier != nullptr) {
+        _readNotifier->setEnabled(!suspended);
+    }
 }
 
 void Pty::setWindowSize(int columns, int lines)
@@ -24,6 +24,7 @@
 #define PTY_H
 
 // Qt
+#include <QByteArray>
 #include <QSize>
 
 // KDE
@@ -34,6 +35,12 @@
 
 #include <QStringList>
 
+// System
+#include <cerrno>
+#include <unistd.h>
+
+class QSocketNotifier;
+
 namespace terminal {
 /**
  * The Pty class is used to start the terminal process,
@@ -142,6 +149,47 @@ public:
      */
     void sendEof();
 
+    /**
+     * Stops or resumes reading the output of the terminal process.
+     * receivedData() is not emitted while reading is suspended, this
+     * allows another thread to read from the pty instead.
+     * See EmulationWorker
+     */
+    void setReadSuspended(bool suspended);
+
+    /**
+     * Reads the output which is available on the pty master @p fd.
+     *
+     * The data is read straight into @p buffer and passed to @p receive as
+     * a (const char *, int) pair, without copying it.  Reading continues
+     * until the pty has no more data, or until @p budget bytes have been
+     * read so that other sessions get their turn.
+     *
+     * @return false if the pty has been closed, true otherwise
+     */
+    template<typename Receiver>
+    static bool readAvailable(int fd, QByteArray &buffer, int budget, Receiver receive)
+    {
+        while (budget > 0) {
+            ssize_t readBytes;
+            do {
+                readBytes = ::read(fd, buffer.data(), qMin(buffer.size(), budget));
+            } while (readBytes < 0 && errno == EINTR);
+
+            if (readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return true;
+            }
+            // EIO once the process has gone away
+            if (readBytes <= 0) {
+                return false;
+            }
+
+            receive(buffer.constData(), static_cast<int>(readBytes));
+            budget -= static_cast<int>(readBytes);
+        }
+        return true;
+    }
+
 public Q_SLOTS:
     /**
      * Put the pty into UTF-8 mode on systems which support it.
@@ -177,6 +225,9 @@ private:
     // to the environment for the process
     void addEnvironmentVariables(const QStringList &environment);
 
+    QSocketNotifier *_readNotifier;
+    QByteArray _readBuffer;
+
     int _windowColumns;
     int _windowLines;
     char _eraseChar;
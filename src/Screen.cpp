@@ -23,8 +23,12 @@
 // Own
 #include "Screen.h"
 
+// Standard
+#include <algorithm>
+
 // Qt
 #include <QTextStream>
+#include <QVarLengthArray>
 
 // terminal
 #include "TerminalCharacterDecoder.h"
@@ -46,6 +50,10 @@ using namespace terminal;
 #define loc(X,Y) ((Y)*_columns+(X))
 #endif
 
+// the most lines which are kept aside for the history in fast-forward mode
+// before they are added to it, see Screen::flushHistory()
+static const int FAST_FORWARD_LINES = 4096;
+
 const Character Screen::DefaultChar = Character(' ',
                                       CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR),
                                       CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR),
@@ -58,9 +66,19 @@ Screen::Screen(int lines, int columns):
     _columns(columns),
     _screenLines(new ImageLine[_lines + 1]),
     _screenLinesSize(_lines),
+    _firstLineSlot(0),
     _scrolledLines(0),
     _lastScrolledRegion(QRect()),
     _droppedLines(0),
+    _totalDroppedLines(0),
+    _changes(0),
+    _lineChanges(lines),
+    _historyChanges(0),
+    _fastForward(false),
+    _pendingLines(QVector<ImageLine>()),
+    _pendingProperties(QVector<LineProperty>()),
+    _pendingFirst(0),
+    _pendingCount(0),
     _lineProperties(QVarLengthArray<LineProperty, 64>()),
     _history(new HistoryScrollNone()),
     _cuX(0),
@@ -78,6 +96,8 @@ Screen::Screen(int lines, int columns):
     _effectiveForeground(CharacterColor()),
     _effectiveBackground(CharacterColor()),
     _effectiveRendition(DEFAULT_RENDITION),
+    _effectiveStyle(CharacterStyleTable::DefaultStyle),
+    _clearStyle(CharacterStyleTable::DefaultStyle),
     _lastPos(-1),
     _lastDrawnChar(0)
 {
@@ -214,27 +234,29 @@ void Screen::deleteChars(int n)
     }
 
     // if cursor is beyond the end of the line there is nothing to do
-    if (_cuX >= _screenLines[_cuY].count()) {
+    if (_cuX >= screenLine(_cuY).count()) {
         return;
     }
 
-    if (_cuX + n > _screenLines[_cuY].count()) {
-        n = _screenLines[_cuY].count() - _cuX;
+    if (_cuX + n > screenLine(_cuY).count()) {
+        n = screenLine(_cuY).count() - _cuX;
     }
 
     Q_ASSERT(n >= 0);
-    Q_ASSERT(_cuX + n <= _screenLines[_cuY].count());
+    Q_ASSERT(_cuX + n <= screenLine(_cuY).count());
 
-    _screenLines[_cuY].remove(_cuX, n);
+    screenLine(_cuY).remove(_cuX, n);
 
     // Append space(s) with current attributes
-    Character spaceWithCurrentAttrs(' ', _effectiveForeground,
-                                    _effectiveBackground,
-                                    _effectiveRendition, false);
+    Character spaceWithCurrentAttrs(' ');
+    spaceWithCurrentAttrs.style = _effectiveStyle;
+    spaceWithCurrentAttrs.isRealCharacter = false;
 
     for (int i = 0; i < n; i++) {
-        _screenLines[_cuY].append(spaceWithCurrentAttrs);
+        screenLine(_cuY).append(spaceWithCurrentAttrs);
     }
+
+    linesChanged(_cuY, _cuY);
 }
 
 void Screen::insertChars(int n)
@@ -243,15 +265,17 @@ void Screen::insertChars(int n)
         n = 1; // Default
     }
 
-    if (_screenLines[_cuY].size() < _cuX) {
-        _screenLines[_cuY].resize(_cuX);
+    if (screenLine(_cuY).size() < _cuX) {
+        screenLine(_cuY).resize(_cuX);
     }
 
-    _screenLines[_cuY].insert(_cuX, n, Character(' '));
+    screenLine(_cuY).insert(_cuX, n, Character(' '));
 
-    if (_screenLines[_cuY].count() > _columns) {
-        _screenLines[_cuY].resize(_columns);
+    if (screenLine(_cuY).count() > _columns) {
+        screenLine(_cuY).resize(_columns);
     }
+
+    linesChanged(_cuY, _cuY);
 }
 
 void Screen::repeatChars(int n)
@@ -296,6 +320,12 @@ void Screen::setMode(int m)
         _cuX = 0;
         _cuY = _topMargin;
         break; //FIXME: home
+    case MODE_Cursor :
+        linesChanged(_cuY, _cuY);
+        break;
+    case MODE_Screen :
+        linesChanged(0, _lines - 1);
+        break;
     }
 }
 
@@ -307,6 +337,12 @@ void Screen::resetMode(int m)
         _cuX = 0;
         _cuY = 0;
         break; //FIXME: home
+    case MODE_Cursor :
+        linesChanged(_cuY, _cuY);
+        break;
+    case MODE_Screen :
+        linesChanged(0, _lines - 1);
+        break;
     }
 }
 
@@ -317,6 +353,13 @@ void Screen::saveMode(int m)
 
 void Screen::restoreMode(int m)
 {
+    if (_currentModes[m] != _savedModes[m]) {
+        if (m == MODE_Cursor) {
+            linesChanged(_cuY, _cuY);
+        } else if (m == MODE_Screen) {
+            linesChanged(0, _lines - 1);
+        }
+    }
     _currentModes[m] = _savedModes[m];
 }
 
@@ -350,6 +393,8 @@ void Screen::resizeImage(int new_lines, int new_columns)
         return;
     }
 
+    flushHistory();
+
     if (_cuY > new_lines - 1) {
         // attempt to preserve focus and _lines
         _bottomMargin = _lines - 1; //FIXME: margin lost
@@ -363,9 +408,14 @@ void Screen::resizeImage(int new_lines, int new_columns)
 
     auto newScreenLines = new ImageLine[new_lines + 1];
     for (int i = 0; i < qMin(_lines, new_lines + 1) ; i++) {
-        newScreenLines[i] = _screenLines[i];
+        newScreenLines[i] = screenLine(i);
     }
 
+    // the new image starts at the first slot
+    std::rotate(_lineProperties.begin(), _lineProperties.begin() + _firstLineSlot,
+                _lineProperties.begin() + _screenLinesSize + 1);
+    _firstLineSlot = 0;
+
     _lineProperties.resize(new_lines + 1);
     for (int i = _lines; (i > 0) && (i < new_lines + 1); i++) {
         _lineProperties[i] = LINE_DEFAULT;
@@ -379,6 +429,8 @@ void Screen::resizeImage(int new_lines, int new_columns)
 
     _lines = new_lines;
     _columns = new_columns;
+    _lineChanges.resize(_lines);
+    linesChanged(0, _lines - 1);
     _cuX = qMin(_cuX, _columns - 1);
     _cuY = qMin(_cuY, _lines - 1);
 
@@ -418,11 +470,7 @@ void Screen::setDefaultMargins()
 
 void Screen::reverseRendition(Character& p) const
 {
-    CharacterColor f = p.foregroundColor;
-    CharacterColor b = p.backgroundColor;
-
-    p.foregroundColor = b;
-    p.backgroundColor = f; //p->r &= ~RE_TRANSPARENT;
+    p.setFormat(p.backgroundColor(), p.foregroundColor(), p.rendition());
 }
 
 void Screen::updateEffectiveRendition()
@@ -445,6 +493,11 @@ void Screen::updateEffectiveRendition()
             _effectiveForeground.setFaint();
         }
     }
+
+    _effectiveStyle = CharacterStyleTable::intern(_effectiveForeground, _effectiveBackground,
+                                                  _effectiveRendition & ~RE_CELL_FLAGS);
+    _clearStyle = CharacterStyleTable::intern(_currentForeground, _currentBackground,
+                                              DEFAULT_RENDITION);
 }
 
 void Screen::copyFromHistory(Character* dest, int startLine, int count) const
@@ -484,7 +537,7 @@ void Screen::copyFromScreen(Character* dest , int startLine , int count) const
             int srcIndex = srcLineStartIndex + column;
             int destIndex = destLineStartIndex + column;
 
-            dest[destIndex] = _screenLines[srcIndex / _columns].value(srcIndex % _columns, Screen::DefaultChar);
+            dest[destIndex] = screenLine(srcIndex / _columns).value(srcIndex % _columns, Screen::DefaultChar);
 
             // invert selected text
             if (_selBegin != -1 && isSelected(column, line + _history->getLines())) {
@@ -496,6 +549,7 @@ void Screen::copyFromScreen(Character* dest , int startLine , int count) const
 
 void Screen::getImage(Character* dest, int size, int startLine, int endLine) const
 {
+    flushHistory();
     Q_ASSERT(startLine >= 0);
     Q_ASSERT(endLine >= startLine && endLine < _history->getLines() + _lines);
 
@@ -526,16 +580,16 @@ void Screen::getImage(Character* dest, int size, int startLine, int endLine) con
         }
     }
 
-    int visX = qMin(_cuX, _columns - 1);
     // mark the character at the current cursor position
-    int cursorIndex = loc(visX, _cuY + linesInHistoryBuffer);
-    if (getMode(MODE_Cursor) && cursorIndex < _columns * mergedLines) {
-        dest[cursorIndex].rendition |= RE_CURSOR;
+    const int cursorLine = _history->getLines() + _cuY - startLine;
+    if (getMode(MODE_Cursor) && cursorLine >= 0 && cursorLine < mergedLines) {
+        dest[loc(qMin(_cuX, _columns - 1), cursorLine)].cellRendition |= RE_CURSOR;
     }
 }
 
 QVector<LineProperty> Screen::getLineProperties(int startLine , int endLine) const
 {
+    flushHistory();
     Q_ASSERT(startLine >= 0);
     Q_ASSERT(endLine >= startLine && endLine < _history->getLines() + _lines);
 
@@ -558,7 +612,7 @@ QVector<LineProperty> Screen::getLineProperties(int startLine , int endLine) con
     // copy properties for _lines in screen buffer
     const int firstScreenLine = startLine + linesInHistory - _history->getLines();
     for (int line = firstScreenLine; line < firstScreenLine + linesInScreen; line++) {
-        result[index] = _lineProperties[line];
+        result[index] = lineProperty(line);
         index++;
     }
 
@@ -599,8 +653,8 @@ void Screen::backspace()
     _cuX = qMin(_columns - 1, _cuX); // nowrap!
     _cuX = qMax(0, _cuX - 1);
 
-    if (_screenLines[_cuY].size() < _cuX + 1) {
-        _screenLines[_cuY].resize(_cuX + 1);
+    if (screenLine(_cuY).size() < _cuX + 1) {
+        screenLine(_cuY).resize(_cuX + 1);
     }
 }
 
@@ -701,14 +755,14 @@ void Screen::displayCharacter(uint c)
             return;
         }
         // Find previous "real character" to try to combine with
-        int charToCombineWithX = qMin(_cuX, _screenLines[_cuY].length());
+        int charToCombineWithX = qMin(_cuX, screenLine(_cuY).length());
         int charToCombineWithY = _cuY;
         do {
             if (charToCombineWithX > 0) {
                 charToCombineWithX--;
             } else if (charToCombineWithY > 0) { // Try previous line
                 charToCombineWithY--;
-                charToCombineWithX = _screenLines[charToCombineWithY].length() - 1;
+                charToCombineWithX = screenLine(charToCombineWithY).length() - 1;
             } else {
                 // Give up
                 return;
@@ -718,12 +772,12 @@ void Screen::displayCharacter(uint c)
             if (charToCombineWithX < 0) {
                 return;
             }
-        } while(!_screenLines[charToCombineWithY][charToCombineWithX].isRealCharacter);
+        } while(!screenLine(charToCombineWithY)[charToCombineWithX].isRealCharacter);
 
-        Character& currentChar = _screenLines[charToCombineWithY][charToCombineWithX];
-        if ((currentChar.rendition & RE_EXTENDED_CHAR) == 0) {
+        Character& currentChar = screenLine(charToCombineWithY)[charToCombineWithX];
+        if ((currentChar.cellRendition & RE_EXTENDED_CHAR) == 0) {
             const uint chars[2] = { currentChar.character, c };
-            currentChar.rendition |= RE_EXTENDED_CHAR;
+            currentChar.cellRendition |= RE_EXTENDED_CHAR;
             currentChar.character = ExtendedCharTable::instance.createExtendedChar(chars, 2);
         } else {
             ushort extendedCharLength;
@@ -739,12 +793,13 @@ void Screen::displayCharacter(uint c)
                 delete[] chars;
             }
         }
+        linesChanged(charToCombineWithY, charToCombineWithY);
         return;
     }
 
     if (_cuX + w > _columns) {
         if (getMode(MODE_Wrap)) {
-            _lineProperties[_cuY] = static_cast<LineProperty>(_lineProperties[_cuY] | LINE_WRAPPED);
+            lineProperty(_cuY) = static_cast<LineProperty>(lineProperty(_cuY) | LINE_WRAPPED);
             nextLine();
         } else {
             _cuX = qMax(_columns - w, 0);
@@ -752,8 +807,8 @@ void Screen::displayCharacter(uint c)
     }
 
     // ensure current line vector has enough elements
-    if (_screenLines[_cuY].size() < _cuX + w) {
-        _screenLines[_cuY].resize(_cuX + w);
+    if (screenLine(_cuY).size() < _cuX + w) {
+        screenLine(_cuY).resize(_cuX + w);
     }
 
     if (getMode(MODE_Insert)) {
@@ -765,12 +820,11 @@ void Screen::displayCharacter(uint c)
     // check if selection is still valid.
     checkSelection(_lastPos, _lastPos);
 
-    Character& currentChar = _screenLines[_cuY][_cuX];
+    Character& currentChar = screenLine(_cuY)[_cuX];
 
     currentChar.character = c;
-    currentChar.foregroundColor = _effectiveForeground;
-    currentChar.backgroundColor = _effectiveBackground;
-    currentChar.rendition = _effectiveRendition;
+    currentChar.style = _effectiveStyle;
+    currentChar.cellRendition = DEFAULT_RENDITION;
     currentChar.isRealCharacter = true;
 
     _lastDrawnChar = c;
@@ -780,20 +834,75 @@ void Screen::displayCharacter(uint c)
     while (w != 0) {
         i++;
 
-        if (_screenLines[_cuY].size() < _cuX + i + 1) {
-            _screenLines[_cuY].resize(_cuX + i + 1);
+        if (screenLine(_cuY).size() < _cuX + i + 1) {
+            screenLine(_cuY).resize(_cuX + i + 1);
         }
 
-        Character& ch = _screenLines[_cuY][_cuX + i];
+        Character& ch = screenLine(_cuY)[_cuX + i];
         ch.character = 0;
-        ch.foregroundColor = _effectiveForeground;
-        ch.backgroundColor = _effectiveBackground;
-        ch.rendition = _effectiveRendition;
+        ch.style = _effectiveStyle;
+        ch.cellRendition = DEFAULT_RENDITION;
         ch.isRealCharacter = false;
 
         w--;
     }
     _cuX = newCursorX;
+
+    linesChanged(_cuY, _cuY);
+}
+
+void Screen::displayCharacters(const uint *chars, int count)
+{
+    int i = 0;
+    while (i < count) {
+        // combining and wide characters as well as insert mode
+        // take the general path
+        if (getMode(MODE_Insert) || Character::width(chars[i]) != 1) {
+            displayCharacter(chars[i++]);
+            continue;
+        }
+
+        if (_cuX + 1 > _columns) {
+            if (getMode(MODE_Wrap)) {
+                lineProperty(_cuY) = static_cast<LineProperty>(lineProperty(_cuY) | LINE_WRAPPED);
+                nextLine();
+            } else {
+                _cuX = qMax(_columns - 1, 0);
+            }
+        }
+
+        // the segment ends at the right edge or at the first character
+        // which is not single-width
+        const int room = _columns - _cuX;
+        int n = 1;
+        while (n < room && i + n < count && Character::width(chars[i + n]) == 1) {
+            n++;
+        }
+
+        ImageLine &line = screenLine(_cuY);
+        if (line.size() < _cuX + n) {
+            line.resize(_cuX + n);
+        }
+
+        // check if selection is still valid.
+        checkSelection(loc(_cuX, _cuY), loc(_cuX + n - 1, _cuY));
+
+        Character *data = line.data() + _cuX;
+        for (int j = 0; j < n; j++) {
+            Character &currentChar = data[j];
+            currentChar.character = chars[i + j];
+            currentChar.style = _effectiveStyle;
+            currentChar.cellRendition = DEFAULT_RENDITION;
+            currentChar.isRealCharacter = true;
+        }
+        linesChanged(_cuY, _cuY);
+
+        _cuX += n;
+        i += n;
+
+        _lastPos = loc(_cuX - 1, _cuY);
+        _lastDrawnChar = chars[i - 1];
+    }
 }
 
 int Screen::scrolledLines() const
@@ -808,16 +917,41 @@ void Screen::resetDroppedLines()
 {
     _droppedLines = 0;
 }
+qint64 Screen::totalDroppedLines() const
+{
+    return _totalDroppedLines;
+}
 void Screen::resetScrolledLines()
 {
     _scrolledLines = 0;
 }
 
+void Screen::setFastForward(bool fastForward)
+{
+    // the lines a conversion drops cannot be told in advance
+    _fastForward = fastForward && dynamic_cast<HistoryScrollConversion *>(_history) == nullptr;
+
+    if (!_fastForward) {
+        flushHistory();
+        _pendingLines.clear();
+        _pendingProperties.clear();
+    }
+}
+
+bool Screen::fastForward() const
+{
+    return _fastForward;
+}
+
 void Screen::scrollUp(int n)
 {
     if (n == 0) {
         n = 1; // Default
     }
+    if (_fastForward && _topMargin == 0 && _bottomMargin == _lines - 1 && _selBegin == -1) {
+        fastForwardScrollUp(n);
+        return;
+    }
     if (_topMargin == 0) {
         addHistLine(); // history.history
     }
@@ -829,6 +963,20 @@ QRect Screen::lastScrolledRegion() const
     return _lastScrolledRegion;
 }
 
+void Screen::addScrolledLines(int from, int n)
+{
+    const QRect region(0, from, _columns - 1, _bottomMargin - from + 1);
+
+    // scrolls of different regions cannot be replayed as one by the views,
+    // they compare all of their lines instead
+    if (_scrolledLines != 0 && region != _lastScrolledRegion) {
+        _lastScrolledRegion = QRect();
+    } else {
+        _lastScrolledRegion = region;
+    }
+    _scrolledLines += n;
+}
+
 void Screen::scrollUp(int from, int n)
 {
     if (n <= 0) {
@@ -841,14 +989,92 @@ void Screen::scrollUp(int from, int n)
         n = _bottomMargin + 1 - from;
     }
 
-    _scrolledLines -= n;
-    _lastScrolledRegion = QRect(0, _topMargin, _columns - 1, (_bottomMargin - _topMargin));
+    addScrolledLines(from, -n);
 
     //FIXME: make sure `topMargin', `bottomMargin', `from', `n' is in bounds.
-    moveImage(loc(0, from), loc(0, from + n), loc(_columns, _bottomMargin));
+    if (from == 0 && _bottomMargin == _lines - 1) {
+        // the whole screen scrolls, which only moves the start of the ring
+        rotateLines(n);
+        followImageMove(loc(0, from), loc(0, from + n), loc(_columns, _bottomMargin));
+    } else {
+        moveImage(loc(0, from), loc(0, from + n), loc(_columns, _bottomMargin));
+    }
     clearImage(loc(0, _bottomMargin - n + 1), loc(_columns - 1, _bottomMargin), ' ');
 }
 
+void Screen::rotateLines(int n)
+{
+    _firstLineSlot = lineSlot(n);
+
+    // the spare line past the bottom of the screen now holds the line
+    // which was at the top, it is blank everywhere else
+    screenLine(_lines).resize(0);
+    lineProperty(_lines) = LINE_DEFAULT;
+
+    linesChanged(0, _lines - 1);
+}
+
+void Screen::fastForwardScrollUp(int n)
+{
+    // see addHistLine() and scrollUp(int, int), there is no selection to
+    // follow and no scroll region
+    if (hasScroll()) {
+        const int maxLines = _history->getType().maximumLineCount();
+        const int capacity = maxLines < 0 ? FAST_FORWARD_LINES : qBound(1, maxLines, FAST_FORWARD_LINES);
+
+        // the ring is full, its oldest line is added to the history unless
+        // the history would drop it along with the lines before it
+        if (_pendingCount == capacity && capacity != maxLines) {
+            flushHistory();
+        }
+        if (_pendingLines.size() != capacity) {
+            _pendingLines.resize(capacity);
+            _pendingProperties.resize(capacity);
+        }
+
+        if (maxLines >= 0 && _history->getLines() + _pendingCount >= maxLines) {
+            _droppedLines++;
+            _totalDroppedLines++;
+            historyChanged();
+        }
+        if (_pendingCount == capacity) {
+            _pendingFirst = (_pendingFirst + 1) % capacity;
+            _pendingCount--;
+        }
+
+        // the storage of the line dropped from the ring is reused for the
+        // line which becomes the spare one
+        const int slot = (_pendingFirst + _pendingCount) % capacity;
+        qSwap(_pendingLines[slot], screenLine(0));
+        _pendingProperties[slot] = lineProperty(0);
+        _pendingCount++;
+    }
+
+    n = qMin(n, _lines);
+    addScrolledLines(0, -n);
+    rotateLines(n);
+    if (_lastPos != -1) {
+        // combining characters written after the scroll still find their
+        // base character
+        _lastPos -= n * _columns;
+        if (_lastPos < 0) {
+            _lastPos = -1;
+        }
+    }
+    clearImage(loc(0, _lines - n), loc(_columns - 1, _lines - 1), ' ');
+}
+
+void Screen::flushHistory() const
+{
+    for (int i = 0; i < _pendingCount; i++) {
+        const int slot = (_pendingFirst + i) % _pendingLines.size();
+        _history->addCellsVector(_pendingLines[slot]);
+        _history->addLine((_pendingProperties[slot] & LINE_WRAPPED) != 0);
+    }
+    _pendingFirst = 0;
+    _pendingCount = 0;
+}
+
 void Screen::scrollDown(int n)
 {
     if (n == 0) {
@@ -859,8 +1085,6 @@ void Screen::scrollDown(int n)
 
 void Screen::scrollDown(int from, int n)
 {
-    _scrolledLines += n;
-
     //FIXME: make sure `topMargin', `bottomMargin', `from', `n' is in bounds.
     if (n <= 0) {
         return;
@@ -871,6 +1095,8 @@ void Screen::scrollDown(int from, int n)
     if (from + n > _bottomMargin) {
         n = _bottomMargin - from;
     }
+
+    addScrolledLines(from, n);
     moveImage(loc(0, from + n), loc(0, from), loc(_columns - 1, _bottomMargin - n));
     clearImage(loc(0, from), loc(_columns - 1, from + n - 1), ' ');
 }
@@ -926,20 +1152,23 @@ void Screen::clearImage(int loca, int loce, char c)
 
     const int topLine = loca / _columns;
     const int bottomLine = loce / _columns;
+    linesChanged(topLine, bottomLine);
 
-    Character clearCh(uint(c), _currentForeground, _currentBackground, DEFAULT_RENDITION, false);
+    Character clearCh(uint(c));
+    clearCh.style = _clearStyle;
+    clearCh.isRealCharacter = false;
 
     //if the character being used to clear the area is the same as the
     //default character, the affected _lines can simply be shrunk.
     const bool isDefaultCh = (clearCh == Screen::DefaultChar);
 
     for (int y = topLine; y <= bottomLine; y++) {
-        _lineProperties[y] = 0;
+        lineProperty(y) = 0;
 
         const int endCol = (y == bottomLine) ? loce % _columns : _columns - 1;
         const int startCol = (y == topLine) ? loca % _columns : 0;
 
-        QVector<Character>& line = _screenLines[y];
+        QVector<Character>& line = screenLine(y);
 
         if (isDefaultCh && endCol == _columns - 1) {
             line.resize(startCol);
@@ -969,15 +1198,23 @@ void Screen::moveImage(int dest, int sourceBegin, int sourceEnd)
     //(search the web for 'memmove implementation' for details)
     if (dest < sourceBegin) {
         for (int i = 0; i <= lines; i++) {
-            _screenLines[(dest / _columns) + i ] = _screenLines[(sourceBegin / _columns) + i ];
-            _lineProperties[(dest / _columns) + i] = _lineProperties[(sourceBegin / _columns) + i];
+            screenLine((dest / _columns) + i ) = screenLine((sourceBegin / _columns) + i );
+            lineProperty((dest / _columns) + i) = lineProperty((sourceBegin / _columns) + i);
         }
     } else {
         for (int i = lines; i >= 0; i--) {
-            _screenLines[(dest / _columns) + i ] = _screenLines[(sourceBegin / _columns) + i ];
-            _lineProperties[(dest / _columns) + i] = _lineProperties[(sourceBegin / _columns) + i];
+            screenLine((dest / _columns) + i ) = screenLine((sourceBegin / _columns) + i );
+            lineProperty((dest / _columns) + i) = lineProperty((sourceBegin / _columns) + i);
         }
     }
+    linesChanged(dest / _columns, dest / _columns + lines);
+
+    followImageMove(dest, sourceBegin, sourceEnd);
+}
+
+void Screen::followImageMove(int dest, int sourceBegin, int sourceEnd)
+{
+    const int lines = (sourceEnd - sourceBegin) / _columns;
 
     if (_lastPos != -1) {
         const int diff = dest - sourceBegin; // Scroll by this amount
@@ -1135,6 +1372,7 @@ void Screen::getSelectionEnd(int& column , int& line) const
 }
 void Screen::setSelectionStart(const int x, const int y, const bool blockSelectionMode)
 {
+    flushHistory();
     _selBegin = loc(x, y);
     /* FIXME, HACK to correct for x too far to the right... */
     if (x == _columns) {
@@ -1289,14 +1527,10 @@ int Screen::copyLineToStream(int line ,
                              bool appendNewLine,
                              const DecodingOptions options) const
 {
-    //buffer to hold characters for decoding
-    //the buffer is static to avoid initializing every
-    //element on each call to copyLineToStream
-    //(which is unnecessary since all elements will be overwritten anyway)
-    static const int MAX_CHARS = 1024;
-    static Character characterBuffer[MAX_CHARS];
-
-    Q_ASSERT(count < MAX_CHARS);
+    //buffer to hold characters for decoding, lines of usual length fit
+    //onto the stack; it is not static because lines are copied by
+    //views and by exports on other threads
+    QVarLengthArray<Character, 1024> characterBuffer;
 
     LineProperty currentLineProperties = 0;
 
@@ -1321,7 +1555,9 @@ int Screen::copyLineToStream(int line ,
         Q_ASSERT(count >= 0);
         Q_ASSERT((start + count) <= _history->getLineLen(line));
 
-        _history->getCells(line, start, count, characterBuffer);
+        // room for a new line character
+        characterBuffer.resize(count + 1);
+        _history->getCells(line, start, count, characterBuffer.data());
 
         if (_history->isWrappedLine(line)) {
             currentLineProperties |= LINE_WRAPPED;
@@ -1333,17 +1569,17 @@ int Screen::copyLineToStream(int line ,
 
         Q_ASSERT(count >= 0);
 
-        int screenLine = line - _history->getLines();
+        int lineInScreen = line - _history->getLines();
 
-        Q_ASSERT(screenLine <= _screenLinesSize);
+        Q_ASSERT(lineInScreen <= _screenLinesSize);
 
-        screenLine = qMin(screenLine, _screenLinesSize);
+        lineInScreen = qMin(lineInScreen, _screenLinesSize);
 
-        Character* data = _screenLines[screenLine].data();
-        int length = _screenLines[screenLine].count();
+        const Character* data = screenLine(lineInScreen).constData();
+        int length = screenLine(lineInScreen).count();
 
         // Don't remove end spaces in lines that wrap
-        if (options.testFlag(TrimTrailingWhitespace) && ((_lineProperties[screenLine] & LINE_WRAPPED) == 0))
+        if (options.testFlag(TrimTrailingWhitespace) && ((lineProperty(lineInScreen) & LINE_WRAPPED) == 0))
         {
             // ignore trailing white space at the end of the line
             for (int i = length-1; i >= 0; i--)
@@ -1356,19 +1592,18 @@ int Screen::copyLineToStream(int line ,
             }
         }
 
-        //retrieve line from screen image
-        for (int i = start; i < qMin(start + count, length); i++) {
-            characterBuffer[i - start] = data[i];
-        }
-
         // count cannot be any greater than length
         count = qBound(0, count, length - start);
 
-        Q_ASSERT(screenLine < _lineProperties.count());
-        currentLineProperties |= _lineProperties[screenLine];
+        //retrieve line from screen image
+        characterBuffer.resize(count + 1);
+        std::copy(data + start, data + start + count, characterBuffer.data());
+
+        Q_ASSERT(lineInScreen <= _lines);
+        currentLineProperties |= lineProperty(lineInScreen);
     }
 
-    if (appendNewLine && (count + 1 < MAX_CHARS)) {
+    if (appendNewLine) {
         if ((currentLineProperties & LINE_WRAPPED) != 0) {
             // do nothing extra when this line is wrapped.
         } else {
@@ -1400,7 +1635,7 @@ int Screen::copyLineToStream(int line ,
     }
 
     //decode line and write to text stream
-    decoder->decodeLine(characterBuffer,
+    decoder->decodeLine(characterBuffer.constData(),
                         count, currentLineProperties);
 
     return count;
@@ -1408,19 +1643,22 @@ int Screen::copyLineToStream(int line ,
 
 void Screen::writeLinesToStream(TerminalCharacterDecoder* decoder, int fromLine, int toLine) const
 {
+    flushHistory();
     writeToStream(decoder, loc(0, fromLine), loc(_columns - 1, toLine), PreserveLineBreaks);
 }
 
 void Screen::addHistLine()
 {
+    flushHistory();
+
     // add line to history buffer
     // we have to take care about scrolling, too...
 
     if (hasScroll()) {
         const int oldHistLines = _history->getLines();
 
-        _history->addCellsVector(_screenLines[0]);
-        _history->addLine((_lineProperties[0] & LINE_WRAPPED) != 0);
+        _history->addCellsVector(screenLine(0));
+        _history->addLine((lineProperty(0) & LINE_WRAPPED) != 0);
 
         const int newHistLines = _history->getLines();
 
@@ -1430,6 +1668,8 @@ void Screen::addHistLine()
         // of dropped _lines
         if (newHistLines == oldHistLines) {
             _droppedLines++;
+            _totalDroppedLines++;
+            historyChanged();
         }
 
         // Adjust selection for the new point of reference
@@ -1471,13 +1711,45 @@ void Screen::addHistLine()
 
 int Screen::getHistLines() const
 {
+    flushHistory();
     return _history->getLines();
 }
 
+qint64 Screen::historyMemoryUsage() const
+{
+    flushHistory();
+    return _history->memoryUsage();
+}
+
+qreal Screen::historyDeduplicationRatio() const
+{
+    flushHistory();
+    const int distinctLines = _history->distinctLines();
+    return distinctLines > 0 ? qreal(_history->getLines()) / distinctLines : 1.0;
+}
+
+void Screen::markStyles(CharacterStyleMarks &marks) const
+{
+    for (int slot = 0; slot <= _screenLinesSize; slot++) {
+        marks.mark(_screenLines[slot].constData(), _screenLines[slot].size());
+    }
+    marks.mark(_effectiveStyle);
+    marks.mark(_clearStyle);
+    for (int i = 0; i < _pendingCount; i++) {
+        const ImageLine &line = _pendingLines[(_pendingFirst + i) % _pendingLines.size()];
+        marks.mark(line.constData(), line.size());
+    }
+    _history->markStyles(marks);
+}
+
 void Screen::setScroll(const HistoryType& t , bool copyPreviousScroll)
 {
+    flushHistory();
+    _fastForward = false;
     clearSelection();
+    historyChanged();
 
+    const int oldHistLines = _history->getLines();
     if (copyPreviousScroll) {
         _history = t.scroll(_history);
     } else {
@@ -1485,6 +1757,7 @@ void Screen::setScroll(const HistoryType& t , bool copyPreviousScroll)
         _history = t.scroll(nullptr);
         delete oldScroll;
     }
+    _totalDroppedLines += qMax(0, oldHistLines - _history->getLines());
 }
 
 bool Screen::hasScroll() const
@@ -1497,13 +1770,41 @@ const HistoryType& Screen::getScroll() const
     return _history->getType();
 }
 
+bool Screen::migrateHistory(int lines)
+{
+    flushHistory();
+
+    auto *conversion = dynamic_cast<HistoryScrollConversion *>(_history);
+    if (conversion == nullptr) {
+        return true;
+    }
+
+    // a limited history may drop lines which it receives
+    const int oldHistLines = _history->getLines();
+    const bool done = conversion->migrate(lines);
+    const int droppedLines = oldHistLines - _history->getLines();
+    if (droppedLines > 0) {
+        _droppedLines += droppedLines;
+        _totalDroppedLines += droppedLines;
+        historyChanged();
+        clearSelection();
+    }
+
+    if (done) {
+        _history = conversion->takeTarget();
+        delete conversion;
+    }
+    return done;
+}
+
 void Screen::setLineProperty(LineProperty property , bool enable)
 {
     if (enable) {
-        _lineProperties[_cuY] = static_cast<LineProperty>(_lineProperties[_cuY] | property);
+        lineProperty(_cuY) = static_cast<LineProperty>(lineProperty(_cuY) | property);
     } else {
-        _lineProperties[_cuY] = static_cast<LineProperty>(_lineProperties[_cuY] & ~property);
+        lineProperty(_cuY) = static_cast<LineProperty>(lineProperty(_cuY) & ~property);
     }
+    linesChanged(_cuY, _cuY);
 }
 void Screen::fillWithDefaultChar(Character* dest, int count)
 {
@@ -362,6 +362,15 @@ public:
      */
     void displayCharacter(uint c);
 
+    /**
+     * Displays a run of @p count characters starting at the current cursor
+     * position.  The result is the same as calling displayCharacter() for
+     * each character in @p chars, but runs of single-width characters are
+     * written into the current line in one pass, with the wrap and selection
+     * checks done once per line segment instead of once per character.
+     */
+    void displayCharacters(const uint *chars, int count);
+
     /**
      * Resizes the image to a new fixed size of @p new_lines by @p new_columns.
      * In the case that @p new_columns is smaller than the current number of columns,
@@ -408,6 +417,15 @@ public:
 
     /** Return the number of lines in the history buffer. */
     int getHistLines() const;
+    /** Returns the approximate number of bytes of memory used by the history. */
+    qint64 historyMemoryUsage() const;
+    /**
+     * Returns the number of lines in the history divided by the number of
+     * lines with different content, which the history may store only once.
+     */
+    qreal historyDeduplicationRatio() const;
+    /** Marks the styles of the lines of the screen and the history. */
+    void markStyles(CharacterStyleMarks &marks) const;
     /**
      * Sets the type of storage used to keep lines in the history.
      * If @p copyPreviousScroll is true then the contents of the previous
@@ -416,6 +434,13 @@ public:
     void setScroll(const HistoryType &, bool copyPreviousScroll = true);
     /** Returns the type of storage used to keep lines in the history. */
     const HistoryType &getScroll() const;
+    /**
+     * Copies up to @p lines lines of the previous history into the history
+     * set by setScroll(), which happens in steps so that switching the type
+     * of a long history does not block.  Returns true once the history has
+     * been converted completely.
+     */
+    bool migrateHistory(int lines);
     /**
      * Returns true if this screen keeps lines that are scrolled off the screen
      * in a history buffer.
@@ -537,10 +562,12 @@ public:
     int scrolledLines() const;
 
     /**
-     * Returns the region of the image which was last scrolled.
+     * Returns the region of the image which has been scrolled by
+     * scrolledLines().
      *
-     * This is the area of the image from the top margin to the
-     * bottom margin when the last scroll occurred.
+     * This is the area of the image from the first scrolled line to the
+     * bottom margin, or an invalid rect if different areas have been
+     * scrolled since resetScrolledLines() was called.
      */
     QRect lastScrolledRegion() const;
 
@@ -567,6 +594,66 @@ public:
      */
     void resetDroppedLines();
 
+    /**
+     * Returns the number of lines which have been dropped from the
+     * history, including those of histories which have been replaced.
+     * Unlike droppedLines(), it is never reset, adding it to the number
+     * of a line gives a number which the line keeps while the history
+     * drops older lines.
+     */
+    qint64 totalDroppedLines() const;
+
+    /**
+     * Returns a count which increases whenever the image changes.
+     *
+     * Views remember it when they copy the image and afterwards only copy
+     * the lines whose lineChanges() is larger, which are the lines that
+     * have been written, erased or moved since.
+     */
+    quint64 changes() const
+    {
+        return _changes;
+    }
+
+    /** Returns the value of changes() when @p line of the screen last changed. */
+    quint64 lineChanges(int line) const
+    {
+        return _lineChanges[line];
+    }
+
+    /**
+     * Returns the value of changes() when the history last dropped lines
+     * or was replaced, which moves or changes the lines in it.
+     */
+    quint64 historyChanges() const
+    {
+        return _historyChanges;
+    }
+
+    /**
+     * Enables or disables fast-forward mode, which is used while output
+     * arrives faster than it can be displayed.
+     *
+     * In this mode lines which scroll off the top of the screen are kept
+     * aside and added to the history in one batch by flushHistory(), and
+     * lines which a limited history would drop again before that are never
+     * added.  Scrolling skips the selection handling of the normal path.
+     * It has no effect while there is a selection or a scroll region, and
+     * while the history is being converted.  Disabling the mode flushes
+     * the history.
+     */
+    void setFastForward(bool fastForward);
+
+    /** Returns whether fast-forward mode is enabled, see setFastForward() */
+    bool fastForward() const;
+
+    /**
+     * Adds the lines scrolled off in fast-forward mode to the history.
+     * The functions which read the history call this first, so the lines
+     * kept aside are only a deferred part of the history.
+     */
+    void flushHistory() const;
+
     /**
       * Fills the buffer @p dest with @p count instances of the default (ie. blank)
       * Character style.
@@ -587,9 +674,9 @@ public:
     {
         QSet<uint> result;
         for (int i = 0; i < _lines; ++i) {
-            const ImageLine &il = _screenLines[i];
+            const ImageLine &il = screenLine(i);
             for (int j = 0; j < il.length(); ++j) {
-                if (il[j].rendition & RE_EXTENDED_CHAR) {
+                if (il[j].cellRendition & RE_EXTENDED_CHAR) {
                     result << il[j].character;
                 }
             }
@@ -625,15 +712,40 @@ private:
     //
     //NOTE: moveImage() can only move whole lines
     void moveImage(int dest, int sourceBegin, int sourceEnd);
+    // adjusts the selection after the image has been moved, see moveImage()
+    void followImageMove(int dest, int sourceBegin, int sourceEnd);
     // scroll up 'n' lines in current region, clearing the bottom 'n' lines
     void scrollUp(int from, int n);
     // scroll down 'n' lines in current region, clearing the top 'n' lines
     void scrollDown(int from, int n);
+    // records a scroll of the lines from 'from' to the bottom margin by
+    // 'n' lines, up if 'n' is negative, see scrolledLines()
+    void addScrolledLines(int from, int n);
 
     //when we handle scroll commands, we need to know which screenwindow will scroll
     TerminalDisplay *_currentTerminalDisplay;
 
     void addHistLine();
+    // scrollUp() for fast-forward mode: keeps the top line aside for the
+    // history, counting it as dropped if the history will drop it, and
+    // rotates the screen without following a selection
+    void fastForwardScrollUp(int n);
+    // scrolls the whole screen up by n lines by rotating the ring of lines
+    void rotateLines(int n);
+
+    // records that the lines from first to last of the screen have changed
+    void linesChanged(int first, int last)
+    {
+        _changes++;
+        for (int line = first; line <= last; line++) {
+            _lineChanges[line] = _changes;
+        }
+    }
+    // records that lines of the history have been dropped or replaced
+    void historyChanged()
+    {
+        _historyChanges = ++_changes;
+    }
 
     void initTabStops();
 
@@ -657,13 +769,54 @@ private:
     int _columns;
 
     typedef QVector<Character> ImageLine;      // [0..columns]
+    // _screenLines and _lineProperties are rings of _lines + 1 slots, the
+    // first line of the screen is in slot _firstLineSlot.  Scrolling the
+    // whole screen moves the start of the ring instead of the lines.
     ImageLine *_screenLines;             // [lines]
     int _screenLinesSize;                // _screenLines.size()
+    int _firstLineSlot;
+
+    // returns the slot of @p line of the screen, 0 <= line <= _lines
+    int lineSlot(int line) const
+    {
+        const int slot = _firstLineSlot + line;
+        return slot <= _screenLinesSize ? slot : slot - (_screenLinesSize + 1);
+    }
+    ImageLine &screenLine(int line)
+    {
+        return _screenLines[lineSlot(line)];
+    }
+    const ImageLine &screenLine(int line) const
+    {
+        return _screenLines[lineSlot(line)];
+    }
+    LineProperty &lineProperty(int line)
+    {
+        return _lineProperties[lineSlot(line)];
+    }
+    LineProperty lineProperty(int line) const
+    {
+        return _lineProperties[lineSlot(line)];
+    }
 
     int _scrolledLines;
     QRect _lastScrolledRegion;
 
     int _droppedLines;
+    qint64 _totalDroppedLines;
+
+    // see changes(), lineChanges() and historyChanges()
+    quint64 _changes;
+    QVector<quint64> _lineChanges; // [lines]
+    quint64 _historyChanges;
+
+    bool _fastForward;
+    // the lines scrolled off in fast-forward mode, a ring of up to
+    // FAST_FORWARD_LINES lines starting at _pendingFirst, see flushHistory()
+    mutable QVector<ImageLine> _pendingLines;
+    mutable QVector<LineProperty> _pendingProperties;
+    mutable int _pendingFirst;
+    mutable int _pendingCount;
 
     QVarLengthArray<LineProperty, 64> _lineProperties;
 
@@ -701,6 +854,8 @@ private:
     CharacterColor _effectiveForeground; // These are derived from
     CharacterColor _effectiveBackground; // the cu_* variables above
     RenditionFlags _effectiveRendition;  // to speed up operation
+    quint32 _effectiveStyle;             // style of new characters
+    quint32 _clearStyle;                 // style of erased characters
 
     class SavedState
     {
@@ -28,9 +28,17 @@ using namespace terminal;
 ScreenWindow::ScreenWindow(Screen *screen, QObject *parent) :
     QObject(parent),
     _screen(nullptr),
+    _mutex(nullptr),
     _windowBuffer(nullptr),
     _windowBufferSize(0),
     _bufferNeedsUpdate(true),
+    _copiedChanges(0),
+    _copiedColumns(0),
+    _copiedCurrentLine(0),
+    _copiedHistLines(0),
+    _copiedCursor(QPoint()),
+    _copiedSelection(false),
+    _dirtyLines(QBitArray()),
     _windowLines(1),
     _currentLine(0),
     _currentResultLine(-1),
@@ -50,6 +58,7 @@ void ScreenWindow::setScreen(Screen *screen)
     Q_ASSERT(screen);
 
     _screen = screen;
+    _bufferNeedsUpdate = true;
 }
 
 Screen *ScreenWindow::screen() const
@@ -57,8 +66,20 @@ Screen *ScreenWindow::screen() const
     return _screen;
 }
 
+void ScreenWindow::setMutex(QRecursiveMutex *mutex)
+{
+    _mutex = mutex;
+}
+
+QRecursiveMutex *ScreenWindow::mutex() const
+{
+    return _mutex;
+}
+
 Character *ScreenWindow::getImage()
 {
+    QMutexLocker locker(_mutex);
+
     // reallocate internal buffer if the window size has changed
     int size = windowLines() * windowColumns();
     if (_windowBuffer == nullptr || _windowBufferSize != size) {
@@ -68,22 +89,67 @@ Character *ScreenWindow::getImage()
         _bufferNeedsUpdate = true;
     }
 
-    if (!_bufferNeedsUpdate) {
-        return _windowBuffer;
+    if (_dirtyLines.size() != windowLines()) {
+        _dirtyLines.resize(windowLines());
+    }
+
+    const int columns = windowColumns();
+    const int startLine = currentLine();
+    const int histLines = _screen->getHistLines();
+    const QPoint cursor(_screen->getCursorX(), histLines + _screen->getCursorY());
+    const bool selection = _screen->hasSelection();
+
+    // the lines of the history do not change unless it drops lines, the
+    // selection is drawn into the image by the screen
+    if (columns != _copiedColumns || startLine != _copiedCurrentLine || histLines != _copiedHistLines
+        || selection || _copiedSelection
+        || (startLine < histLines && _screen->historyChanges() > _copiedChanges)) {
+        _bufferNeedsUpdate = true;
     }
 
-    _screen->getImage(_windowBuffer, size,
-                      currentLine(), endWindowLine());
+    if (_bufferNeedsUpdate) {
+        _screen->getImage(_windowBuffer, size,
+                          startLine, endWindowLine());
 
-    // this window may look beyond the end of the screen, in which
-    // case there will be an unused area which needs to be filled
-    // with blank characters
-    fillUnusedArea();
+        // this window may look beyond the end of the screen, in which
+        // case there will be an unused area which needs to be filled
+        // with blank characters
+        fillUnusedArea();
 
+        _dirtyLines.fill(true);
+    } else {
+        const bool cursorMoved = cursor != _copiedCursor;
+        const int endLine = endWindowLine();
+        for (int line = qMax(startLine, histLines); line <= endLine; line++) {
+            if (_screen->lineChanges(line - histLines) > _copiedChanges
+                || (cursorMoved && (line == cursor.y() || line == _copiedCursor.y()))) {
+                const int windowLine = line - startLine;
+                _screen->getImage(_windowBuffer + windowLine * columns, columns, line, line);
+                _dirtyLines.setBit(windowLine);
+            }
+        }
+    }
+
+    _copiedChanges = _screen->changes();
+    _copiedColumns = columns;
+    _copiedCurrentLine = startLine;
+    _copiedHistLines = histLines;
+    _copiedCursor = cursor;
+    _copiedSelection = selection;
     _bufferNeedsUpdate = false;
     return _windowBuffer;
 }
 
+void ScreenWindow::markStyles(CharacterStyleMarks &marks) const
+{
+    marks.mark(_windowBuffer, _windowBuffer != nullptr ? _windowBufferSize : 0);
+}
+
+void ScreenWindow::resetDirtyLines()
+{
+    _dirtyLines.fill(false);
+}
+
 void ScreenWindow::fillUnusedArea()
 {
     int screenEndLine = _screen->getHistLines() + _screen->getLines() - 1;
@@ -117,6 +183,8 @@ int ScreenWindow::endWindowLine() const
 
 QVector<LineProperty> ScreenWindow::getLineProperties()
 {
+    QMutexLocker locker(_mutex);
+
     QVector<LineProperty> result = _screen->getLineProperties(currentLine(), endWindowLine());
 
     if (result.count() != windowLines()) {
@@ -128,23 +196,31 @@ QVector<LineProperty> ScreenWindow::getLineProperties()
 
 QString ScreenWindow::selectedText(const Screen::DecodingOptions options) const
 {
+    QMutexLocker locker(_mutex);
+
     return _screen->selectedText(options);
 }
 
 void ScreenWindow::getSelectionStart(int &column, int &line)
 {
+    QMutexLocker locker(_mutex);
+
     _screen->getSelectionStart(column, line);
     line -= currentLine();
 }
 
 void ScreenWindow::getSelectionEnd(int &column, int &line)
 {
+    QMutexLocker locker(_mutex);
+
     _screen->getSelectionEnd(column, line);
     line -= currentLine();
 }
 
 void ScreenWindow::setSelectionStart(int column, int line, bool columnMode)
 {
+    QMutexLocker locker(_mutex);
+
     _screen->setSelectionStart(column, line + currentLine(), columnMode);
 
     _bufferNeedsUpdate = true;
@@ -153,6 +229,8 @@ void ScreenWindow::setSelectionStart(int column, int line, bool columnMode)
 
 void ScreenWindow::setSelectionEnd(int column, int line)
 {
+    QMutexLocker locker(_mutex);
+
     _screen->setSelectionEnd(column, line + currentLine());
 
     _bufferNeedsUpdate = true;
@@ -161,6 +239,8 @@ void ScreenWindow::setSelectionEnd(int column, int line)
 
 void ScreenWindow::setSelectionByLineRange(int start, int end)
 {
+    QMutexLocker locker(_mutex);
+
     clearSelection();
 
     _screen->setSelectionStart(0, start, false);
@@ -172,16 +252,22 @@ void ScreenWindow::setSelectionByLineRange(int start, int end)
 
 bool ScreenWindow::isSelected(int column, int line)
 {
+    QMutexLocker locker(_mutex);
+
     return _screen->isSelected(column, qMin(line + currentLine(), endWindowLine()));
 }
 
 bool ScreenWindow::hasSelection()
 {
+    QMutexLocker locker(_mutex);
+
     return _screen->hasSelection();
 }
 
 void ScreenWindow::clearSelection()
 {
+    QMutexLocker locker(_mutex);
+
     _screen->clearSelection();
 
     emit selectionChanged();
@@ -190,6 +276,9 @@ void ScreenWindow::clearSelection()
 void ScreenWindow::setWindowLines(int lines)
 {
     Q_ASSERT(lines > 0);
+    if (lines != _windowLines) {
+        _bufferNeedsUpdate = true;
+    }
     _windowLines = lines;
 }
 
@@ -200,21 +289,29 @@ int ScreenWindow::windowLines() const
 
 int ScreenWindow::windowColumns() const
 {
+    QMutexLocker locker(_mutex);
+
     return _screen->getColumns();
 }
 
 int ScreenWindow::lineCount() const
 {
+    QMutexLocker locker(_mutex);
+
     return _screen->getHistLines() + _screen->getLines();
 }
 
 int ScreenWindow::columnCount() const
 {
+    QMutexLocker locker(_mutex);
+
     return _screen->getColumns();
 }
 
 QPoint ScreenWindow::cursorPosition() const
 {
+    QMutexLocker locker(_mutex);
+
     QPoint position;
 
     position.setX(_screen->getCursorX());
@@ -225,6 +322,8 @@ QPoint ScreenWindow::cursorPosition() const
 
 int ScreenWindow::currentLine() const
 {
+    QMutexLocker locker(_mutex);
+
     return qBound(0, _currentLine, lineCount() - windowLines());
 }
 
@@ -245,6 +344,8 @@ void ScreenWindow::setCurrentResultLine(int line)
 
 void ScreenWindow::scrollBy(RelativeScrollMode mode, int amount, bool fullPage)
 {
+    QMutexLocker locker(_mutex);
+
     if (mode == ScrollLines) {
         scrollTo(currentLine() + amount);
     } else if (mode == ScrollPages) {
@@ -258,11 +359,15 @@ void ScreenWindow::scrollBy(RelativeScrollMode mode, int amount, bool fullPage)
 
 bool ScreenWindow::atEndOfOutput() const
 {
+    QMutexLocker locker(_mutex);
+
     return currentLine() == (lineCount() - windowLines());
 }
 
 void ScreenWindow::scrollTo(int line)
 {
+    QMutexLocker locker(_mutex);
+
     int maxCurrentLineNumber = lineCount() - windowLines();
     line = qBound(0, line, maxCurrentLineNumber);
 
@@ -300,6 +405,8 @@ void ScreenWindow::resetScrollCount()
 
 QRect ScreenWindow::scrollRegion() const
 {
+    QMutexLocker locker(_mutex);
+
     bool equalToScreenSize = windowLines() == _screen->getLines();
 
     if (atEndOfOutput() && equalToScreenSize) {
@@ -311,6 +418,8 @@ QRect ScreenWindow::scrollRegion() const
 
 void ScreenWindow::notifyOutputChanged()
 {
+    QMutexLocker locker(_mutex);
+
     // move window to the bottom of the screen and update scroll count
     // if this window is currently tracking the bottom of the screen
     if (_trackOutput) {
@@ -330,7 +439,5 @@ void ScreenWindow::notifyOutputChanged()
         _currentLine = qMin(_currentLine, _screen->getHistLines());
     }
 
-    _bufferNeedsUpdate = true;
-
     emit outputChanged();
 }
@@ -21,6 +21,8 @@
 #define SCREENWINDOW_H
 
 // Qt
+#include <QBitArray>
+#include <QMutex>
 #include <QObject>
 #include <QPoint>
 #include <QRect>
@@ -70,15 +72,43 @@ public:
     /** Returns the screen which this window looks onto */
     Screen *screen() const;
 
+    /**
+     * Sets the lock which guards the screen against changes from other
+     * threads.  It is held by all methods which access the screen.
+     * See Emulation::mutex()
+     */
+    void setMutex(QRecursiveMutex *mutex);
+    /** Returns the lock which guards the screen.  See setMutex() */
+    QRecursiveMutex *mutex() const;
+
     /**
      * Returns the image of characters which are currently visible through this window
      * onto the screen.
      *
      * The returned buffer is managed by the ScreenWindow instance and does not need to be
      * deleted by the caller.
+     *
+     * Only the lines which the screen reports as changed are copied again,
+     * unless the window has moved.  The lines which have been copied are
+     * marked dirty, see isLineDirty().
      */
     Character *getImage();
 
+    /** Marks the styles of the image returned by getImage(). */
+    void markStyles(CharacterStyleMarks &marks) const;
+
+    /**
+     * Returns true if @p line of the image may have changed since the last
+     * call to resetDirtyLines().
+     */
+    bool isLineDirty(int line) const
+    {
+        return _dirtyLines.testBit(line);
+    }
+
+    /** Marks all lines of the image as unchanged.  See isLineDirty() */
+    void resetDirtyLines();
+
     /**
      * Returns the line attributes associated with the lines of characters which
      * are currently visible through this window
@@ -267,9 +297,19 @@ private:
     void fillUnusedArea();
 
     Screen *_screen; // see setScreen() , screen()
+    QRecursiveMutex *_mutex; // see setMutex() , mutex()
     Character *_windowBuffer;
     int _windowBufferSize;
-    bool _bufferNeedsUpdate;
+    bool _bufferNeedsUpdate; // whether all lines have to be copied
+
+    // what the buffer has been copied from, see getImage()
+    quint64 _copiedChanges;
+    int _copiedColumns;
+    int _copiedCurrentLine;
+    int _copiedHistLines;
+    QPoint _copiedCursor; // counting lines from the top of the history
+    bool _copiedSelection;
+    QBitArray _dirtyLines;
 
     int _windowLines;
     int _currentLine;  // see scrollTo() , currentLine()
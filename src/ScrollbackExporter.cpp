@@ -0,0 +1,189 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "ScrollbackExporter.h"
+
+// Qt
+#include <QMutexLocker>
+#include <QTextStream>
+
+// terminal
+#include "Emulation.h"
+#include "TerminalCharacterDecoder.h"
+
+// System
+#include <cerrno>
+#include <unistd.h>
+
+using namespace terminal;
+
+// The number of lines decoded and written at once.
+static const int EXPORT_LINES = 2000;
+
+namespace {
+/**
+ * Passes lines on to another decoder and remembers how the last one ended.
+ *
+ * The last line of a chunk gets no line break, the next chunk starts on a
+ * line of its own though unless the line was wrapped.
+ */
+class ChunkDecoder : public TerminalCharacterDecoder
+{
+public:
+    explicit ChunkDecoder(TerminalCharacterDecoder *decoder) :
+        _decoder(decoder),
+        _lineEnded(true),
+        _wrapped(false)
+    {
+    }
+
+    void begin(QTextStream *output) Q_DECL_OVERRIDE
+    {
+        _decoder->begin(output);
+    }
+
+    void end() Q_DECL_OVERRIDE
+    {
+        _decoder->end();
+    }
+
+    void decodeLine(const Character * const characters, int count,
+                    LineProperty properties) Q_DECL_OVERRIDE
+    {
+        _decoder->decodeLine(characters, count, properties);
+        if (count > 0) {
+            _lineEnded = characters[count - 1].character == '\n';
+            _wrapped = (properties & LINE_WRAPPED) != 0;
+        }
+    }
+
+    void endChunk()
+    {
+        if (!_lineEnded && !_wrapped) {
+            Character newLine('\n');
+            _decoder->decodeLine(&newLine, 1, 0);
+            _lineEnded = true;
+        }
+    }
+
+private:
+    TerminalCharacterDecoder *_decoder;
+    bool _lineEnded;
+    bool _wrapped;
+};
+}
+
+ScrollbackExporter::ScrollbackExporter(Emulation *emulation, TerminalCharacterDecoder *decoder, int fd) :
+    QObject(nullptr),
+    _emulation(emulation),
+    _decoder(decoder),
+    _fd(fd),
+    _canceled(0),
+    _thread()
+{
+    _thread.setObjectName(QStringLiteral("ScrollbackExporter"));
+    moveToThread(&_thread);
+
+    connect(&_thread, &QThread::started, this, &terminal::ScrollbackExporter::exportLines);
+    _thread.start();
+}
+
+ScrollbackExporter::~ScrollbackExporter()
+{
+    cancel();
+    _thread.quit();
+    _thread.wait();
+
+    delete _decoder;
+}
+
+void ScrollbackExporter::cancel()
+{
+    _canceled.storeRelaxed(1);
+}
+
+void ScrollbackExporter::exportLines()
+{
+    QString text;
+    QTextStream stream(&text);
+    ChunkDecoder decoder(_decoder);
+    decoder.begin(&stream);
+
+    // lines which arrive during the export are not included, lines are
+    // counted from the first one the history has ever held, so that they
+    // keep their numbers while the history drops older ones
+    qint64 firstLine;
+    int totalLines;
+    {
+        QMutexLocker locker(_emulation->mutex());
+        firstLine = _emulation->droppedPrimaryLines();
+        totalLines = _emulation->primaryLineCount();
+    }
+    bool success = true;
+
+    for (int line = 0; line < totalLines; line += EXPORT_LINES) {
+        if (_canceled.loadRelaxed() != 0) {
+            success = false;
+            break;
+        }
+
+        const int lastLine = qMin(line + EXPORT_LINES, totalLines) - 1;
+        _emulation->writePrimaryToStream(&decoder, firstLine + line, firstLine + lastLine);
+        decoder.endChunk();
+
+        stream.flush();
+        if (!write(text.toUtf8())) {
+            success = false;
+            break;
+        }
+        text.clear();
+
+        emit progress(lastLine + 1, totalLines);
+    }
+
+    decoder.end();
+    stream.flush();
+    if (success) {
+        success = write(text.toUtf8());
+    }
+
+    emit finished(success);
+    _thread.quit();
+}
+
+bool ScrollbackExporter::write(const QByteArray &data)
+{
+    const char *pos = data.constData();
+    qint64 remaining = data.size();
+
+    while (remaining > 0) {
+        const ssize_t written = ::write(_fd, pos, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ScrollbackExporter::write");
+            return false;
+        }
+        pos += written;
+        remaining -= written;
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef SCROLLBACKEXPORTER_H
+#define SCROLLBACKEXPORTER_H
+
+// Qt
+#include <QAtomicInt>
+#include <QObject>
+#include <QThread>
+
+namespace terminal {
+class Emulation;
+class TerminalCharacterDecoder;
+
+/**
+ * Writes the primary screen of an emulation and its history to a file
+ * descriptor as UTF-8 on a thread of its own.
+ *
+ * The output is decoded and written in chunks of lines, so neither the
+ * text of the whole scrollback nor the time to produce it is ever held
+ * at once: the emulation is locked for one chunk at a time and keeps
+ * receiving output in between.
+ *
+ * The export is started by the constructor.  Deleting the exporter
+ * cancels an export in progress and waits for the thread to stop, which
+ * has to happen before the emulation is deleted.  Session::exportScrollback()
+ * takes care of that.
+ */
+class ScrollbackExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Starts writing the lines of @p emulation to @p fd, using @p decoder
+     * to convert them into text.  The exporter takes ownership of the
+     * decoder.  @p fd is not closed.
+     */
+    ScrollbackExporter(Emulation *emulation, TerminalCharacterDecoder *decoder, int fd);
+    ~ScrollbackExporter() Q_DECL_OVERRIDE;
+
+    /** Stops the export after the chunk which is being written. */
+    void cancel();
+
+Q_SIGNALS:
+    /** Emitted after each chunk, @p lines of @p totalLines have been written. */
+    void progress(int lines, int totalLines);
+
+    /**
+     * Emitted once the export has ended, @p success is false if it was
+     * canceled or writing failed.
+     */
+    void finished(bool success);
+
+private Q_SLOTS:
+    void exportLines();
+
+private:
+    Q_DISABLE_COPY(ScrollbackExporter)
+
+    // writes all of data to _fd
+    bool write(const QByteArray &data);
+
+    Emulation *_emulation;
+    TerminalCharacterDecoder *_decoder;
+    int _fd;
+    QAtomicInt _canceled;
+    QThread _thread;
+};
+}
+
+#endif // SCROLLBACKEXPORTER_H
@@ -34,6 +34,7 @@
 // Qt
 #include <QApplication>
 #include <QColor>
+#include <QDateTime>
 #include <QDir>
 #include <QFile>
 #include <QStringList>
@@ -47,12 +48,14 @@
 //#include <KRun>
 //#include <KShell>
 #include <kprocess.h>
+#include <kptydevice.h>
 #include <config/kconfiggroup.h>
 //#include <KIO/DesktopExecParser>
 
 // terminal
 //#include <sessionadaptor.h>
 
+#include "EmulationWorker.h"
 #include "ProcessInfo.h"
 #include "Pty.h"
 #include "TerminalDisplay.h"
@@ -60,6 +63,8 @@
 #include "Vt102Emulation.h"
 //#include "ZModemDialog.h"
 #include "History.h"
+#include "KonsoleSettings.h"
+#include "ScrollbackExporter.h"
 #include "TerminalDebug.h"
 #include "SessionManager.h"
 #include "ProfileManager.h"
@@ -89,6 +94,7 @@ Session::Session(QObject* parent) :
     , _uniqueIdentifier(QUuid())
     , _shellProcess(nullptr)
     , _emulation(nullptr)
+    , _emulationWorker(nullptr)
     , _views(QList<TerminalDisplay *>())
     , _monitorActivity(false)
     , _monitorSilence(false)
@@ -108,6 +114,7 @@ Session::Session(QObject* parent) :
     , _iconText(QString())
     , _addToUtmp(true)
     , _flowControlEnabled(true)
+    , _emulationThreadEnabled(false)
     , _program(QString())
     , _arguments(QStringList())
     , _environment(QStringList())
@@ -122,6 +129,9 @@ Session::Session(QObject* parent) :
     , _preferredSize(QSize())
     , _readOnly(false)
     , _isPrimaryScreen(true)
+    , _historySaved(false)
+    , _scrollbackExporters()
+    , _lastViewed(QDateTime::currentMSecsSinceEpoch())
 {
     _uniqueIdentifier = QUuid::createUuid();
 
@@ -160,8 +170,18 @@ Session::~Session()
 {
     delete _foregroundProcessInfo;
     delete _sessionProcessInfo;
+
+    // the exporters use the emulation on threads of their own
+    qDeleteAll(_scrollbackExporters);
+    _scrollbackExporters.clear();
+
+    delete _emulationWorker;
     delete _emulation;
     delete _shellProcess;
+
+    if (!_historySaved) {
+        HistoryScrollFile::removeFiles(historyFileName());
+    }
 }
 
 void Session::openTeletype(int fd)
@@ -171,6 +191,8 @@ void Session::openTeletype(int fd)
         return;
     }
 
+    delete _emulationWorker;
+    _emulationWorker = nullptr;
     delete _shellProcess;
 
     if (fd < 0) {
@@ -194,9 +216,44 @@ void Session::openTeletype(int fd)
             this, &terminal::Session::done);
 
     // emulator size
-    // Use a direct connection to ensure that the window size is set before it runs
-    connect(_emulation, &terminal::Emulation::imageSizeChanged, this, &terminal::Session::updateWindowSize, Qt::DirectConnection);
+    // The connection is direct when the size is changed from the GUI thread, which ensures
+    // that the window size is set before it runs.  A resize requested by the running program
+    // may be processed on the worker thread, in which case it is queued.
+    connect(_emulation, &terminal::Emulation::imageSizeChanged, this, &terminal::Session::updateWindowSize);
     connect(_emulation, &terminal::Emulation::imageSizeInitialized, this, &terminal::Session::run);
+
+    updateEmulationWorker();
+}
+
+void Session::setEmulationThreadEnabled(bool enabled)
+{
+    if (_emulationThreadEnabled == enabled) {
+        return;
+    }
+
+    _emulationThreadEnabled = enabled;
+    updateEmulationWorker();
+}
+
+bool Session::emulationThreadEnabled() const
+{
+    return _emulationThreadEnabled;
+}
+
+void Session::updateEmulationWorker()
+{
+    delete _emulationWorker;
+    _emulationWorker = nullptr;
+
+    if (_shellProcess == nullptr) {
+        return;
+    }
+
+    // only one of the worker and the pty device may read from the pty
+    _shellProcess->setReadSuspended(_emulationThreadEnabled);
+    if (_emulationThreadEnabled) {
+        _emulationWorker = new EmulationWorker(_shellProcess->pty()->masterFd(), _emulation);
+    }
 }
 
 WId Session::windowId() const
@@ -362,6 +419,9 @@ void Session::addView(TerminalDisplay* widget)
 
     connect(widget, &terminal::TerminalDisplay::focusLost, _emulation, &terminal::Emulation::focusLost);
     connect(widget, &terminal::TerminalDisplay::focusGained, _emulation, &terminal::Emulation::focusGained);
+    connect(widget, &terminal::TerminalDisplay::focusGained, this, [this]() {
+        _lastViewed = QDateTime::currentMSecsSinceEpoch();
+    });
 
     connect(_emulation, &terminal::Emulation::setCursorStyleRequest, widget, &terminal::TerminalDisplay::setCursorStyle);
     connect(_emulation, &terminal::Emulation::resetCursorStyleRequest, widget, &terminal::TerminalDisplay::resetCursorStyle);
@@ -1364,7 +1424,41 @@ QString Session::iconText() const
 
 void Session::setHistoryType(const HistoryType& hType)
 {
-    _emulation->setHistory(hType);
+    if (KonsoleSettings::saveScrollback() && dynamic_cast<const HistoryTypeFile *>(&hType) != nullptr) {
+        _emulation->setHistory(HistoryTypeFile(historyFileName()));
+    } else {
+        _emulation->setHistory(hType);
+    }
+}
+
+QString Session::historyFileName() const
+{
+    return historyFileName(_uniqueIdentifier);
+}
+
+QString Session::historyFileName(const QUuid &guid)
+{
+    return historyFileDirectory() + QLatin1Char('/') + guid.toString(QUuid::WithoutBraces);
+}
+
+ScrollbackExporter *Session::exportScrollback(TerminalCharacterDecoder *decoder, int fd)
+{
+    auto exporter = new ScrollbackExporter(_emulation, decoder, fd);
+    _scrollbackExporters.append(exporter);
+
+    // queued, the exporter emits finished() on its thread
+    connect(exporter, &terminal::ScrollbackExporter::finished, this, [this, exporter]() {
+        // the session may have deleted it already if it was still queued
+        if (_scrollbackExporters.removeOne(exporter)) {
+            delete exporter;
+        }
+    });
+    return exporter;
+}
+
+QString Session::historyFileDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QLatin1String("/scrollback");
 }
 
 const HistoryType& Session::historyType() const
@@ -1377,6 +1471,34 @@ void Session::clearHistory()
     _emulation->clearHistory();
 }
 
+bool Session::spillHistory()
+{
+    const HistoryType &type = historyType();
+    if (dynamic_cast<const CompactHistoryType *>(&type) == nullptr) {
+        return false;
+    }
+
+    // the same lines are kept, compressed in an unlinked file, which is
+    // neither named after the session nor saved with it
+    _emulation->setHistory(CompressedHistoryType(type.maximumLineCount()));
+    return true;
+}
+
+qint64 Session::lastViewed() const
+{
+    return _lastViewed;
+}
+
+bool Session::hasVisibleView() const
+{
+    for (const TerminalDisplay *view : _views) {
+        if (view->isVisible()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 QStringList Session::arguments() const
 {
     return _arguments;
@@ -1592,6 +1714,16 @@ int Session::historySize() const
     }
 }
 
+qint64 Session::historyMemoryUsage() const
+{
+    return _emulation->historyMemoryUsage();
+}
+
+qreal Session::historyDeduplicationRatio() const
+{
+    return _emulation->historyDeduplicationRatio();
+}
+
 QString Session::profile()
 {
     return SessionManager::instance()->sessionProfile(this)->name();
@@ -1648,6 +1780,10 @@ void Session::saveSession(KConfigGroup& group)
     group.writeEntry("RemoteTab",      tabTitleFormat(RemoteTabTitle));
     group.writeEntry("SessionGuid",    _uniqueIdentifier.toString());
     group.writeEntry("Encoding",       QString::fromUtf8(codec()));
+
+    // the scrollback files have been written all along, they only have
+    // to outlive this session
+    _historySaved = true;
 }
 
 void Session::restoreSession(KConfigGroup& group)
@@ -1668,7 +1804,14 @@ void Session::restoreSession(KConfigGroup& group)
     }
     value = group.readEntry("SessionGuid");
     if (!value.isEmpty()) {
+        const QString oldHistoryFileName = historyFileName();
         _uniqueIdentifier = QUuid(value);
+
+        // continue the scrollback saved with the session
+        if (dynamic_cast<const HistoryTypeFile *>(&historyType()) != nullptr) {
+            setHistoryType(HistoryTypeFile());
+            HistoryScrollFile::removeFiles(oldHistoryFileName);
+        }
     }
     value = group.readEntry("Encoding");
     if (!value.isEmpty()) {
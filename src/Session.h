@@ -46,6 +46,9 @@ class KProcess;
 
 namespace terminal {
 class Emulation;
+class EmulationWorker;
+class ScrollbackExporter;
+class TerminalCharacterDecoder;
 class Pty;
 class ProcessInfo;
 class TerminalDisplay;
@@ -214,6 +217,10 @@ public:
      * used affects the number of lines which can be
      * remembered before they are lost and the storage
      * (in memory, on-disk etc.) used.
+     *
+     * If the SaveScrollback setting is enabled, an unlimited history
+     * is kept in files which saveSession() preserves for restoreSession().
+     * Only the user can read them.
      */
     void setHistoryType(const HistoryType &hType);
     /**
@@ -224,6 +231,19 @@ public:
      * Clears the history store used by this session.
      */
     void clearHistory();
+    /**
+     * Moves a history which is kept in memory to a compressed temporary
+     * file, which keeps as many lines.  Returns false if the history is
+     * not kept in memory.
+     */
+    bool spillHistory();
+    /**
+     * Returns when a view of this session last gained the focus, in
+     * milliseconds since the epoch, or when the session was created.
+     */
+    qint64 lastViewed() const;
+    /** Returns true if one of the views of this session is visible. */
+    bool hasVisibleView() const;
 
     /**
      * Sets the key bindings used by this session.  The bindings
@@ -358,6 +378,24 @@ public:
     void saveSession(KConfigGroup &group);
     void restoreSession(KConfigGroup &group);
 
+    /**
+     * Returns the base name of the files which keep the unlimited
+     * scrollback of the session with the given @p guid across restarts,
+     * see HistoryScrollFile.
+     */
+    static QString historyFileName(const QUuid &guid);
+    /** Returns the directory of the files named by historyFileName() */
+    static QString historyFileDirectory();
+
+    /**
+     * Starts writing the primary screen and its history to @p fd, using
+     * @p decoder to convert them into text, see ScrollbackExporter.  The
+     * session owns the exporter, which is deleted once it has finished.
+     * Exports which are still running when the session is destroyed are
+     * canceled before the emulation goes away.
+     */
+    ScrollbackExporter *exportScrollback(TerminalCharacterDecoder *decoder, int fd);
+
     void sendSignal(int signal);
 
     void reportBackgroundColor(const QColor &c);
@@ -472,6 +510,19 @@ public Q_SLOTS:
     /** Returns whether flow control is enabled for this terminal session. */
     Q_SCRIPTABLE bool flowControlEnabled() const;
 
+    /**
+     * Sets whether the output of the terminal process is read and passed
+     * through the emulation on a worker thread instead of the GUI thread.
+     * This keeps the application responsive while a program floods the
+     * terminal with output.
+     *
+     * The receiveBlock() signal is not emitted while this is enabled.
+     */
+    void setEmulationThreadEnabled(bool enabled);
+
+    /** Returns whether the output is processed on a worker thread.  See setEmulationThreadEnabled() */
+    bool emulationThreadEnabled() const;
+
     /**
      * @param text to send to the current foreground terminal program.
      * @param eol send this after @p text
@@ -576,6 +627,18 @@ public Q_SLOTS:
      */
     Q_SCRIPTABLE int historySize() const;
 
+    /**
+     * Returns the approximate number of bytes of memory used by the
+     * history of this session, not counting what it keeps in files.
+     */
+    Q_SCRIPTABLE qint64 historyMemoryUsage() const;
+
+    /**
+     * Returns the number of lines in the history of this session per line
+     * it stores, see the DeduplicateHistoryLines setting.
+     */
+    Q_SCRIPTABLE qreal historyDeduplicationRatio() const;
+
     /**
      * Sets the current session's profile
      */
@@ -588,6 +651,10 @@ public Q_SLOTS:
 
 Q_SIGNALS:
 
+    /**
+     * Emitted when a block of output is received from the terminal process,
+     * before it is passed to the emulation.
+     */
     void receiveBlock(const char *buf, int len);
 
     /** Emitted when the terminal process starts. */
@@ -742,10 +809,18 @@ private:
 
     QString validDirectory(const QString &dir) const;
 
+    // starts or stops the worker thread according to _emulationThreadEnabled
+    void updateEmulationWorker();
+
+    // the base name of the files which keep the unlimited scrollback
+    // of this session across restarts
+    QString historyFileName() const;
+
     QUuid _uniqueIdentifier;            // SHELL_SESSION_ID
 
     Pty *_shellProcess;
     Emulation *_emulation;
+    EmulationWorker *_emulationWorker;
 
     QList<TerminalDisplay *> _views;
 
@@ -773,6 +848,7 @@ private:
     QString _iconText;        // not actually used
     bool _addToUtmp;
     bool _flowControlEnabled;
+    bool _emulationThreadEnabled;
 
     QString _program;
     QStringList _arguments;
@@ -797,6 +873,13 @@ private:
     static int lastSessionId;
 
     bool _isPrimaryScreen;
+
+    // whether the scrollback files are kept for restoreSession()
+    bool _historySaved;
+
+    QList<ScrollbackExporter *> _scrollbackExporters;
+
+    qint64 _lastViewed;
 };
 
 /**
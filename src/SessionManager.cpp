@@ -24,9 +24,13 @@
 
 #include "TerminalDebug.h"
 
+// Standard
+#include <algorithm>
+
 // Qt
 #include <QStringList>
 #include <QTextCodec>
+#include <QVector>
 
 // KDE
 #include <config/kconfig.h>
@@ -37,6 +41,7 @@
 #include "ProfileManager.h"
 #include "History.h"
 #include "Enumeration.h"
+#include "KonsoleSettings.h"
 #include "TerminalDisplay.h"
 
 using namespace terminal;
@@ -46,11 +51,19 @@ SessionManager::SessionManager() :
     _sessionProfiles(QHash<Session *, Profile::Ptr>()),
     _sessionRuntimeProfiles(QHash<Session *, Profile::Ptr>()),
     _restoreMapping(QHash<Session *, int>()),
-    _isClosingAllSessions(false)
+    _isClosingAllSessions(false),
+    _historyMemoryTimer()
 {
+    // how often the memory used by the histories is checked
+    static const int HISTORY_MEMORY_INTERVAL = 5000;
+
     ProfileManager *profileMananger = ProfileManager::instance();
     connect(profileMananger, &terminal::ProfileManager::profileChanged, this,
             &terminal::SessionManager::profileChanged);
+
+    connect(&_historyMemoryTimer, &QTimer::timeout, this,
+            &terminal::SessionManager::checkHistoryMemory);
+    _historyMemoryTimer.start(HISTORY_MEMORY_INTERVAL);
 }
 
 SessionManager::~SessionManager()
@@ -94,6 +107,52 @@ const QList<Session *> SessionManager::sessions() const
     return _sessions;
 }
 
+qint64 SessionManager::historyMemoryUsage() const
+{
+    qint64 usage = 0;
+    for (const Session *session : _sessions) {
+        usage += session->historyMemoryUsage();
+    }
+    return usage;
+}
+
+void SessionManager::checkHistoryMemory()
+{
+    const qint64 budget = qint64(KonsoleSettings::historyMemoryBudget()) * 1024 * 1024;
+    if (budget == 0) {
+        return;
+    }
+
+    QVector<QPair<Session *, qint64> > usage;
+    qint64 total = 0;
+    for (Session *session : qAsConst(_sessions)) {
+        const qint64 sessionUsage = session->historyMemoryUsage();
+        usage.append(qMakePair(session, sessionUsage));
+        total += sessionUsage;
+    }
+    if (total <= budget) {
+        return;
+    }
+
+    qCDebug(TerminalDebug) << "The histories use" << total << "bytes, the budget is" << budget;
+
+    // the sessions on screen keep their history in memory
+    std::sort(usage.begin(), usage.end(), [](const QPair<Session *, qint64> &a, const QPair<Session *, qint64> &b) {
+        return a.first->lastViewed() < b.first->lastViewed();
+    });
+    for (const auto &entry : qAsConst(usage)) {
+        if (total <= budget) {
+            break;
+        }
+        if (entry.second == 0 || entry.first->hasVisibleView() || !entry.first->spillHistory()) {
+            continue;
+        }
+        qCDebug(TerminalDebug) << "Moved the history of session" << entry.first->sessionId()
+                               << "using" << entry.second << "bytes to disk";
+        total -= entry.second;
+    }
+}
+
 Session *SessionManager::createSession(Profile::Ptr profile)
 {
     if (!profile) {
@@ -267,6 +326,10 @@ void SessionManager::applyProfile(Session *session, const Profile::Ptr &profile,
         case Enum::UnlimitedHistory:
             session->setHistoryType(HistoryTypeFile());
             break;
+
+        case Enum::CompressedHistory:
+            session->setHistoryType(CompressedHistoryType());
+            break;
         }
     }
 
@@ -274,6 +337,9 @@ void SessionManager::applyProfile(Session *session, const Profile::Ptr &profile,
     if (apply.shouldApply(Profile::FlowControlEnabled)) {
         session->setFlowControlEnabled(profile->flowControlEnabled());
     }
+    if (apply.shouldApply(Profile::EmulationThreadEnabled)) {
+        session->setEmulationThreadEnabled(profile->emulationThreadEnabled());
+    }
 
     // Encoding
     if (apply.shouldApply(Profile::DefaultEncoding)) {
@@ -366,11 +432,18 @@ void SessionManager::restoreSessions(KConfig *config)
     KConfigGroup group(config, "Number");
     const int sessions = group.readEntry("NumberOfSessions", 0);
 
+    QStringList savedHistories;
+
     // Any sessions saved?
     for (int n = 1; n <= sessions; n++) {
         const QString name = QLatin1String("Session") + QString::number(n);
         KConfigGroup sessionGroup(config, name);
 
+        const QString guid = sessionGroup.readEntry("SessionGuid");
+        if (!guid.isEmpty()) {
+            savedHistories << Session::historyFileName(QUuid(guid));
+        }
+
         const QString profile = sessionGroup.readPathEntry("Profile", QString());
         Profile::Ptr ptr = ProfileManager::instance()->defaultProfile();
         if (!profile.isEmpty()) {
@@ -379,6 +452,11 @@ void SessionManager::restoreSessions(KConfig *config)
         Session *session = createSession(ptr);
         session->restoreSession(sessionGroup);
     }
+
+    // the scrollback of sessions which are not restored is of no use,
+    // it is left behind by sessions which were saved again without it or
+    // by processes which did not end properly
+    HistoryScrollFile::removeUnusedFiles(Session::historyFileDirectory(), savedHistories);
 }
 
 Session *SessionManager::idToSession(int id)
@@ -25,6 +25,7 @@
 // Qt
 #include <QHash>
 #include <QList>
+#include <QTimer>
 
 // Konsole
 #include "Profile.h"
@@ -94,6 +95,12 @@ public:
     Session *idToSession(int id);
     bool isClosingAllSessions() const;
 
+    /**
+     * Returns the approximate number of bytes of memory used by the
+     * histories of all sessions.  See Session::historyMemoryUsage()
+     */
+    qint64 historyMemoryUsage() const;
+
 Q_SIGNALS:
     /**
      * Emitted when a session's settings are updated to match
@@ -114,6 +121,10 @@ private Q_SLOTS:
 
     void profileChanged(const Profile::Ptr &profile);
 
+    // moves the histories of the least recently viewed sessions to disk
+    // while all of them use more memory than the HistoryMemoryBudget setting
+    void checkHistoryMemory();
+
 private:
     Q_DISABLE_COPY(SessionManager)
 
@@ -135,6 +146,7 @@ private:
     QHash<Session *, Profile::Ptr> _sessionRuntimeProfiles;
     QHash<Session *, int> _restoreMapping;
     bool _isClosingAllSessions;
+    QTimer _historyMemoryTimer;
 };
 
 /** Utility class to simplify code in SessionManager::applyProfile(). */
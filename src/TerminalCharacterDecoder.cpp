@@ -127,7 +127,7 @@ void PlainTextDecoder::decodeLine(const Character* const characters, int count,
     }
 
     for (int i = start; i < outputCount;) {
-        if ((characters[i].rendition & RE_EXTENDED_CHAR) != 0) {
+        if ((characters[i].cellRendition & RE_EXTENDED_CHAR) != 0) {
             ushort extendedCharLength = 0;
             const uint* chars = ExtendedCharTable::instance.lookupExtendedChar(characters[i].character, extendedCharLength);
             if (chars != nullptr) {
@@ -243,17 +243,17 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
 
     for (int i = 0; i < count; i++) {
         //check if appearance of character is different from previous char
-        if (characters[i].rendition != _lastRendition  ||
-                characters[i].foregroundColor != _lastForeColor  ||
-                characters[i].backgroundColor != _lastBackColor) {
+        if (characters[i].rendition() != _lastRendition  ||
+                characters[i].foregroundColor() != _lastForeColor  ||
+                characters[i].backgroundColor() != _lastBackColor) {
             if (_innerSpanOpen) {
                 closeSpan(text);
                 _innerSpanOpen = false;
             }
 
-            _lastRendition = characters[i].rendition;
-            _lastForeColor = characters[i].foregroundColor;
-            _lastBackColor = characters[i].backgroundColor;
+            _lastRendition = characters[i].rendition();
+            _lastForeColor = characters[i].foregroundColor();
+            _lastBackColor = characters[i].backgroundColor();
 
             //build up style string
             QString style;
@@ -285,7 +285,7 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
 
         //output current character
         if (spaceCount < 2) {
-            if ((characters[i].rendition & RE_EXTENDED_CHAR) != 0) {
+            if ((characters[i].cellRendition & RE_EXTENDED_CHAR) != 0) {
                 ushort extendedCharLength = 0;
                 const uint* chars = ExtendedCharTable::instance.lookupExtendedChar(characters[i].character, extendedCharLength);
                 if (chars != nullptr) {
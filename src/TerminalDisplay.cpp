@@ -46,6 +46,7 @@
 #include <QAccessible>
 #include <QtMath>
 #include <QMessageBox>
+#include <QTextBoundaryFinder>
 
 // KDE
 //#include <KShell>
@@ -67,6 +68,7 @@
 //#include "SessionController.h"
 #include "ExtendedCharTable.h"
 #include "TerminalDisplayAccessible.h"
+#include "TerminalGLView.h"
 //#include "SessionManager.h"
 #include "Session.h"
 //#include "WindowSystemInfo.h"
@@ -86,6 +88,40 @@ using namespace terminal;
 // more information can be found in: http://unicode.org/reports/tr9/
 const QChar LTR_OVERRIDE_CHAR(0x202D);
 
+// the number of characters in the clusters which are kept laid out
+const int TEXT_RUN_CACHE_SIZE = 16 * 1024;
+
+// Characters are compared as 64 bit words, which also compares the bits
+// operator== ignores.  This only makes a line look changed more often.
+static inline quint64 characterWord(const Character *line, int x)
+{
+    quint64 word;
+    memcpy(&word, line + x, sizeof(word));
+    return word;
+}
+
+// returns the first column at which the lines @p a and @p b differ,
+// they must differ within their first @p columns characters
+static int firstDifference(const Character *a, const Character *b, int columns)
+{
+    int x = 0;
+    while (x < columns - 1 && characterWord(a, x) == characterWord(b, x)) {
+        ++x;
+    }
+    return x;
+}
+
+// returns the last column at which the lines @p a and @p b differ,
+// they must differ within their first @p columns characters
+static int lastDifference(const Character *a, const Character *b, int columns)
+{
+    int x = columns - 1;
+    while (x > 0 && characterWord(a, x) == characterWord(b, x)) {
+        --x;
+    }
+    return x;
+}
+
 inline int TerminalDisplay::loc(int x, int y) const {
     Q_ASSERT(y >= 0 && y < _lines);
     Q_ASSERT(x >= 0 && x < _columns);
@@ -133,7 +169,8 @@ void TerminalDisplay::setScreenWindow(ScreenWindow* window)
             _filterUpdateRequired = true;
         });
         _screenWindow->setWindowLines(_lines);
-    }   
+    }
+    _compareAllLines = true;
 }
 
 const ColorEntry* TerminalDisplay::colorTable() const
@@ -169,7 +206,7 @@ void TerminalDisplay::onColorsChanged()
 
     _scrollBar->setPalette(p);
 
-    update();
+    invalidateBackingStore();
 }
 
 void TerminalDisplay::ScrollToEnd()
@@ -277,9 +314,14 @@ void TerminalDisplay::fontChange(const QFont&)
 
     _fontAscent = fm.ascent();
 
+    _textRunCache.clear();
+    if (_glView != nullptr) {
+        _glView->clearGlyphs();
+    }
+
     emit changedFontMetricSignal(_fontHeight, _fontWidth);
     propagateSize();
-    update();
+    invalidateBackingStore();
 }
 
 void TerminalDisplay::setVTFont(const QFont& f)
@@ -448,6 +490,7 @@ TerminalDisplay::TerminalDisplay(Session* session, QWidget* parent)
     , _contentRect(QRect())
     , _image(nullptr)
     , _imageSize(0)
+    , _compareAllLines(true)
     , _lineProperties(QVector<LineProperty>())
     , _randomSeed(0)
     , _resizing(false)
@@ -478,6 +521,7 @@ TerminalDisplay::TerminalDisplay(Session* session, QWidget* parent)
     , _textBlinking(false)
     , _cursorBlinking(false)
     , _hasTextBlinker(false)
+    , _blinkingLines(QBitArray())
     , _urlHintsModifiers(Qt::NoModifier)
     , _showUrlHint(false)
     , _reverseUrlHints(false)
@@ -517,6 +561,8 @@ TerminalDisplay::TerminalDisplay(Session* session, QWidget* parent)
 //    , _searchBar(new IncrementalSearchBar(this))
     , _searchResultRect(QRect())
     , _drawOverlay(false)
+    , _textRunCache(TEXT_RUN_CACHE_SIZE)
+    , _glView(nullptr)
 {
     _session = session;
 
@@ -592,10 +638,15 @@ TerminalDisplay::~TerminalDisplay()
     delete _filterChain;
 }
 
+void TerminalDisplay::markStyles(CharacterStyleMarks &marks)
+{
+    marks.mark(_image, _image != nullptr ? _imageSize : 0);
+}
+
 void TerminalDisplay::hideDragTarget()
 {
     _drawOverlay = false;
-    update();
+    updateOverlays();
 }
 
 void TerminalDisplay::showDragTarget(const QPoint& cursorPos)
@@ -617,7 +668,7 @@ void TerminalDisplay::showDragTarget(const QPoint& cursorPos)
     }
     _overlayEdge = closerToEdge.second;
     _drawOverlay = true;
-    update();
+    updateOverlays();
 }
 
 /* ------------------------------------------------------------------------- */
@@ -635,7 +686,7 @@ void TerminalDisplay::drawLineCharString(QPainter& painter, int x, int y, const
     // set https://bugreports.qt.io/browse/QTBUG-66036
     painter.setRenderHint(QPainter::Antialiasing, _antialiasText);
 
-    const bool useBoldPen = (attributes->rendition & RE_BOLD) != 0 && _boldIntense;
+    const bool useBoldPen = (attributes->rendition() & RE_BOLD) != 0 && _boldIntense;
 
     QRect cellRect = {x, y, _fontWidth, _fontHeight};
     for (int i = 0 ; i < str.length(); i++) {
@@ -667,7 +718,7 @@ void TerminalDisplay::setCursorStyle(Enum::CursorShapeEnum shape, bool isBlinkin
     // change until the cursor is moved by the user; calling update()
     // makes the cursor shape get updated sooner.
     if (!isBlinking) {
-        update();
+        invalidateBackingStore();
     }
 }
 void TerminalDisplay::resetCursorStyle()
@@ -799,12 +850,12 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
                                      bool invertCharacterColor)
 {
     // don't draw text which is currently blinking
-    if (_textBlinking && ((style->rendition & RE_BLINK) != 0)) {
+    if (_textBlinking && ((style->rendition() & RE_BLINK) != 0)) {
         return;
     }
 
     // don't draw concealed characters
-    if ((style->rendition & RE_CONCEAL) != 0) {
+    if ((style->rendition() & RE_CONCEAL) != 0) {
         return;
     }
 
@@ -817,11 +868,13 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
 
     const auto isBold = [boldWeight](const QFont &font) { return font.weight() >= boldWeight; };
 
-    const bool useBold = (((style->rendition & RE_BOLD) != 0) && _boldIntense);
-    const bool useUnderline = ((style->rendition & RE_UNDERLINE) != 0) || font().underline();
-    const bool useItalic = ((style->rendition & RE_ITALIC) != 0) || font().italic();
-    const bool useStrikeOut = ((style->rendition & RE_STRIKEOUT) != 0) || font().strikeOut();
-    const bool useOverline = ((style->rendition & RE_OVERLINE) != 0) || font().overline();
+    const bool useBold = (((style->rendition() & RE_BOLD) != 0) && _boldIntense);
+    const bool useUnderline = ((style->rendition() & RE_UNDERLINE) != 0) || font().underline();
+    const bool useItalic = ((style->rendition() & RE_ITALIC) != 0) || font().italic();
+    const bool useStrikeOut = ((style->rendition() & RE_STRIKEOUT) != 0) || font().strikeOut();
+    const bool useOverline = ((style->rendition() & RE_OVERLINE) != 0) || font().overline();
+    const int variant = int(useBold) | int(useUnderline) << 1 | int(useItalic) << 2
+                        | int(useStrikeOut) << 3 | int(useOverline) << 4;
 
     QFont currentFont = painter.font();
 
@@ -839,7 +892,7 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
     }
 
     // setup pen
-    const CharacterColor& textColor = (invertCharacterColor ? style->backgroundColor : style->foregroundColor);
+    const CharacterColor& textColor = (invertCharacterColor ? style->backgroundColor() : style->foregroundColor());
     const QColor color = textColor.color(_colorTable);
     QPen pen = painter.pen();
     if (pen.color() != color) {
@@ -860,24 +913,84 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
         // This still allows RTL characters to be rendered in the RTL way.
         painter.setLayoutDirection(Qt::LeftToRight);
 
+        const int baseline = rect.y() + _fontAscent + _lineSpacing;
         if (_bidiEnabled) {
-            painter.drawText(rect.x(), rect.y() + _fontAscent + _lineSpacing, text);
-        } else {
-            painter.drawText(rect.x(), rect.y() + _fontAscent + _lineSpacing, LTR_OVERRIDE_CHAR + text);
+            painter.drawText(rect.x(), baseline, text);
+        } else if (painter.worldTransform().isScaling()
+                   || !drawClusters(painter, rect.x(), baseline, text, variant, currentFont)) {
+            // runs of double width or double height lines are drawn scaled,
+            // which would lay them out again
+            painter.drawText(rect.x(), baseline, LTR_OVERRIDE_CHAR + text);
         }
     }
     painter.setClipRegion(origClipRegion);
     painter.setClipping(origClipping);
 }
 
+bool TerminalDisplay::drawClusters(QPainter &painter, int x, int baseline, const QString &text,
+                                   int variant, const QFont &font)
+{
+    bool ascii = _fixedFont;
+    for (int i = 0; ascii && i < text.size(); i++) {
+        ascii = text[i].unicode() <= 0x7e;
+    }
+
+    if (ascii) {
+        // each character of an ASCII run fills one cell
+        for (int i = 0; i < text.size(); i++) {
+            if (text[i] == QLatin1Char(' ')) {
+                continue;
+            }
+            const TextRun *glyph = textRun(QString(text[i]), variant, font);
+            if (glyph == nullptr) {
+                return false;
+            }
+            painter.drawStaticText(QPointF(x + i * _fontWidth, baseline - glyph->ascent), glyph->text);
+        }
+        return true;
+    }
+
+    // other runs are cached only when they are a single cluster, which
+    // keeps runs of right-to-left text from filling the cache
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Grapheme, text);
+    if (finder.toNextBoundary() != text.size()) {
+        return false;
+    }
+    const TextRun *cluster = textRun(LTR_OVERRIDE_CHAR + text, variant, font);
+    if (cluster == nullptr) {
+        return false;
+    }
+    painter.drawStaticText(QPointF(x, baseline - cluster->ascent), cluster->text);
+    return true;
+}
+
+const TextRun *TerminalDisplay::textRun(const QString &text, int variant, const QFont &font)
+{
+    const QPair<int, QString> key(variant, text);
+    TextRun *run = _textRunCache.object(key);
+    if (run == nullptr) {
+        run = new TextRun();
+        run->text.setText(text);
+        run->text.setTextFormat(Qt::PlainText);
+        run->text.setPerformanceHint(QStaticText::AggressiveCaching);
+        run->text.prepare(QTransform(), font);
+        run->ascent = QFontMetricsF(font).ascent();
+        // deletes the run if it is larger than the cache
+        if (!_textRunCache.insert(key, run, text.size())) {
+            return nullptr;
+        }
+    }
+    return run;
+}
+
 void TerminalDisplay::drawTextFragment(QPainter& painter ,
                                        const QRect& rect,
                                        const QString& text,
                                        const Character* style)
 {
     // setup painter
-    const QColor foregroundColor = style->foregroundColor.color(_colorTable);
-    const QColor backgroundColor = style->backgroundColor.color(_colorTable);
+    const QColor foregroundColor = style->foregroundColor().color(_colorTable);
+    const QColor backgroundColor = style->backgroundColor().color(_colorTable);
 
     // draw background if different from the display's background color
     if (backgroundColor != getBackgroundColor()) {
@@ -888,7 +1001,7 @@ void TerminalDisplay::drawTextFragment(QPainter& painter ,
     // draw cursor shape if the current character is the cursor
     // this may alter the foreground and background colors
     bool invertCharacterColor = false;
-    if ((style->rendition & RE_CURSOR) != 0) {
+    if ((style->rendition() & RE_CURSOR) != 0) {
         drawCursor(painter, rect, foregroundColor, backgroundColor, invertCharacterColor);
     }
 
@@ -904,8 +1017,9 @@ void TerminalDisplay::drawPrinterFriendlyTextFragment(QPainter& painter,
     // Set the colors used to draw to black foreground and white
     // background for printer friendly output when printing
     Character print_style = *style;
-    print_style.foregroundColor = CharacterColor(COLOR_SPACE_RGB, 0x00000000);
-    print_style.backgroundColor = CharacterColor(COLOR_SPACE_RGB, 0xFFFFFFFF);
+    print_style.setFormat(CharacterColor(COLOR_SPACE_RGB, 0x00000000),
+                          CharacterColor(COLOR_SPACE_RGB, 0xFFFFFFFF),
+                          style->rendition());
 
     // draw text
     drawCharacters(painter, rect, text, &print_style, false);
@@ -935,17 +1049,6 @@ void TerminalDisplay::scrollImage(int lines , const QRect& screenWindowRegion)
         return;
     }
 
-    // if the flow control warning is enabled this will interfere with the
-    // scrolling optimizations and cause artifacts.  the simple solution here
-    // is to just disable the optimization whilst it is visible
-    if ((_outputSuspendedMessageWidget != nullptr) && _outputSuspendedMessageWidget->isVisible()) {
-        return;
-    }
-
-    if ((_readOnlyMessageWidget != nullptr) && _readOnlyMessageWidget->isVisible()) {
-        return;
-    }
-
     // constrain the region to the display
     // the bottom of the region is capped to the number of lines in the display's
     // internal image - 2, so that the height of 'region' is strictly less
@@ -960,31 +1063,6 @@ void TerminalDisplay::scrollImage(int lines , const QRect& screenWindowRegion)
         return;
     }
 
-    // hide terminal size label to prevent it being scrolled
-    if ((_resizeWidget != nullptr) && _resizeWidget->isVisible()) {
-        _resizeWidget->hide();
-    }
-
-    // Note:  With Qt 4.4 the left edge of the scrolled area must be at 0
-    // to get the correct (newly exposed) part of the widget repainted.
-    //
-    // The right edge must be before the left edge of the scroll bar to
-    // avoid triggering a repaint of the entire widget, the distance is
-    // given by SCROLLBAR_CONTENT_GAP
-    //
-    // Set the QT_FLUSH_PAINT environment variable to '1' before starting the
-    // application to monitor repainting.
-    //
-    const int scrollBarWidth = _scrollBar->isHidden() ? 0 : _scrollBar->width();
-    const int SCROLLBAR_CONTENT_GAP = 1;
-    QRect scrollRect;
-    if (_scrollbarLocation == Enum::ScrollBarLeft) {
-        scrollRect.setLeft(scrollBarWidth + SCROLLBAR_CONTENT_GAP);
-        scrollRect.setRight(width());
-    } else {
-        scrollRect.setLeft(0);
-        scrollRect.setRight(width() - scrollBarWidth - SCROLLBAR_CONTENT_GAP);
-    }
     void* firstCharPos = &_image[ region.top() * _columns ];
     void* lastCharPos = &_image[(region.top() + abs(lines)) * _columns ];
 
@@ -995,10 +1073,9 @@ void TerminalDisplay::scrollImage(int lines , const QRect& screenWindowRegion)
     Q_ASSERT(linesToMove > 0);
     Q_ASSERT(bytesToMove > 0);
 
-    scrollRect.setTop( lines > 0 ? top : top + abs(lines) * _fontHeight);
-    scrollRect.setHeight(linesToMove * _fontHeight);
-
-    if (!scrollRect.isValid() || scrollRect.isEmpty()) {
+    // the pixels of the backing store can only be moved by whole lines
+    const qreal dpr = _backingStore.devicePixelRatio();
+    if (_backingStore.isNull() || dpr != qRound(dpr)) {
         return;
     }
 
@@ -1021,8 +1098,16 @@ void TerminalDisplay::scrollImage(int lines , const QRect& screenWindowRegion)
         memmove(lastCharPos , firstCharPos , bytesToMove);
     }
 
-    //scroll the display vertically to match internal _image
-    scroll(0 , _fontHeight * (-lines) , scrollRect);
+    // scroll the backing store to match the internal _image.  Its newly
+    // exposed lines keep their pixels like the lines of _image keep their
+    // characters, they are drawn again if they differ from the new image.
+    // The parts still to be drawn move with the pixels
+    const QRect scrollRect(0, top, width(), region.height() * _fontHeight);
+    const int dy = _fontHeight * (-lines);
+    _backingStoreInvalid |= (_backingStoreInvalid & scrollRect).translated(0, dy) & scrollRect;
+
+    _backingStore.scroll(0, dy * dpr, QRect(scrollRect.topLeft() * dpr, scrollRect.size() * dpr));
+    update(scrollRect);
 }
 
 QRegion TerminalDisplay::hotSpotRegion() const
@@ -1066,6 +1151,8 @@ void TerminalDisplay::processFilters()
         return;
     }
 
+    QMutexLocker locker(_screenWindow->mutex());
+
     QRegion preUpdateHotSpots = hotSpotRegion();
 
     // use _screenWindow->getImage() here rather than _image because
@@ -1081,7 +1168,7 @@ void TerminalDisplay::processFilters()
 
     QRegion postUpdateHotSpots = hotSpotRegion();
 
-    update(preUpdateHotSpots | postUpdateHotSpots);
+    updateOverlays(preUpdateHotSpots | postUpdateHotSpots);
     _filterUpdateRequired = false;
 }
 
@@ -1091,6 +1178,16 @@ void TerminalDisplay::updateImage()
         return;
     }
 
+    // the screen may be changed by an emulation running on a worker thread,
+    // keep it consistent while the image is copied
+    QMutexLocker locker(_screenWindow->mutex());
+
+    // scrolling moves the lines of _image, so they have to be compared
+    // with the window even if it has not changed them
+    if (_screenWindow->scrollCount() != 0) {
+        _compareAllLines = true;
+    }
+
     // optimization - scroll the existing image where possible and
     // avoid expensive text drawing for parts of the image that
     // can simply be moved up or down
@@ -1115,19 +1212,16 @@ void TerminalDisplay::updateImage()
     Q_ASSERT(_usedLines <= _lines);
     Q_ASSERT(_usedColumns <= _columns);
 
-    int y, x, len;
+    int y, x;
 
     const QPoint tL  = contentsRect().topLeft();
     const int    tLx = tL.x();
     const int    tLy = tL.y();
-    _hasTextBlinker = false;
 
-    CharacterColor cf;       // undefined
 
     const int linesToUpdate = qMin(_lines, qMax(0, lines));
     const int columnsToUpdate = qMin(_columns, qMax(0, columns));
 
-    auto dirtyMask = new char[columnsToUpdate + 2];
     QRegion dirtyRegion;
 
     // debugging variable, this records the number of lines that are found to
@@ -1139,91 +1233,55 @@ void TerminalDisplay::updateImage()
         const Character* currentLine = &_image[y * _columns];
         const Character* const newLine = &newimg[y * columns];
 
-        bool updateLine = false;
-
-        // The dirty mask indicates which characters need repainting. We also
-        // mark surrounding neighbors dirty, in case the character exceeds
-        // its cell boundaries
-        memset(dirtyMask, 0, columnsToUpdate + 2);
+        //both the top and bottom halves of double height _lines must always be redrawn
+        //although both top and bottom halves contain the same characters, only
+        //the top one is actually
+        //drawn.
+        const bool doubleHeight = _lineProperties.count() > y && (_lineProperties[y] & LINE_DOUBLEHEIGHT) != 0;
 
-        for (x = 0 ; x < columnsToUpdate ; ++x) {
-            if (newLine[x] != currentLine[x]) {
-                dirtyMask[x] = 1;
-            }
+        // the other lines are the same in the window and in _image
+        if (!_compareAllLines && !doubleHeight && !_screenWindow->isLineDirty(y)) {
+            continue;
         }
 
+        bool hasTextBlinker = false;
         if (!_resizing) { // not while _resizing, we're expecting a paintEvent
-            for (x = 0; x < columnsToUpdate; ++x) {
-                _hasTextBlinker |= (newLine[x].rendition & RE_BLINK);
-
-                // Start drawing if this character or the next one differs.
-                // We also take the next one into account to handle the situation
-                // where characters exceed their cell width.
-                if (dirtyMask[x] != 0) {
-                    if (newLine[x + 0].character == 0u) {
-                        continue;
-                    }
-                    const bool lineDraw = LineBlockCharacters::canDraw(newLine[x + 0].character);
-                    const bool doubleWidth = (x + 1 == columnsToUpdate) ? false : (newLine[x + 1].character == 0);
-                    const RenditionFlags cr = newLine[x].rendition;
-                    const CharacterColor clipboard = newLine[x].backgroundColor;
-                    if (newLine[x].foregroundColor != cf) {
-                        cf = newLine[x].foregroundColor;
-                    }
-                    const int lln = columnsToUpdate - x;
-                    for (len = 1; len < lln; ++len) {
-                        const Character& ch = newLine[x + len];
-
-                        if (ch.character == 0u) {
-                            continue; // Skip trailing part of multi-col chars.
-                        }
-
-                        const bool nextIsDoubleWidth = (x + len + 1 == columnsToUpdate) ? false : (newLine[x + len + 1].character == 0);
-
-                        if (ch.foregroundColor != cf ||
-                                ch.backgroundColor != clipboard ||
-                                (ch.rendition & ~RE_EXTENDED_CHAR) != (cr & ~RE_EXTENDED_CHAR) ||
-                                (dirtyMask[x + len] == 0) ||
-                                LineBlockCharacters::canDraw(ch.character) != lineDraw ||
-                                nextIsDoubleWidth != doubleWidth) {
-                            break;
-                        }
-                    }
-
-                    const bool saveFixedFont = _fixedFont;
-                    if (lineDraw) {
-                        _fixedFont = false;
-                    }
-                    if (doubleWidth) {
-                        _fixedFont = false;
-                    }
-
-                    updateLine = true;
-
-                    _fixedFont = saveFixedFont;
-                    x += len - 1;
+            // neighboring characters mostly share their style, so its
+            // rendition is looked up only where the style changes
+            for (x = 0; x < columnsToUpdate && !hasTextBlinker; ++x) {
+                if (x == 0 || newLine[x].style != newLine[x - 1].style) {
+                    hasTextBlinker = (newLine[x].rendition() & RE_BLINK) != 0;
                 }
             }
         }
+        _blinkingLines.setBit(y, hasTextBlinker);
+
+        // find the changed characters with a comparison of the whole line,
+        // then of words from either end.  We also repaint their neighbors,
+        // in case a character exceeds its cell boundaries
+        int firstDirty = columnsToUpdate;
+        int lastDirty = -1;
+        if (!_resizing // not while _resizing, we're expecting a paintEvent
+            && memcmp(currentLine, newLine, columnsToUpdate * sizeof(Character)) != 0) {
+            firstDirty = qMax(0, firstDifference(currentLine, newLine, columnsToUpdate) - 1);
+            lastDirty = qMin(columnsToUpdate - 1, lastDifference(currentLine, newLine, columnsToUpdate) + 1);
+        }
 
-        //both the top and bottom halves of double height _lines must always be redrawn
-        //although both top and bottom halves contain the same characters, only
-        //the top one is actually
-        //drawn.
-        if (_lineProperties.count() > y) {
-            updateLine |= (_lineProperties[y] & LINE_DOUBLEHEIGHT);
+        // the columns of double width lines are not those of the display
+        const bool doubleWidth = _lineProperties.count() > y && (_lineProperties[y] & LINE_DOUBLEWIDTH) != 0;
+        if (doubleHeight || (doubleWidth && firstDirty <= lastDirty)) {
+            firstDirty = 0;
+            lastDirty = columnsToUpdate - 1;
         }
 
         // if the characters on the line are different in the old and the new _image
-        // then this line must be repainted.
-        if (updateLine) {
+        // then this part of the line must be repainted.
+        if (firstDirty <= lastDirty) {
             dirtyLineCount++;
 
-            // add the area occupied by this line to the region which needs to be
-            // repainted
-            QRect dirtyRect = QRect(_contentRect.left() + tLx ,
-                                    _contentRect.top() + tLy + _fontHeight * y ,
-                                    _fontWidth * columnsToUpdate ,
+            QRect dirtyRect = QRect(_contentRect.left() + tLx + _fontWidth * firstDirty,
+                                    _contentRect.top() + tLy + _fontHeight * y,
+                                    _fontWidth * (lastDirty - firstDirty + 1),
                                     _fontHeight);
 
             dirtyRegion |= dirtyRect;
@@ -1252,6 +1310,11 @@ void TerminalDisplay::updateImage()
     }
     _usedColumns = columnsToUpdate;
 
+    _screenWindow->resetDirtyLines();
+    _compareAllLines = false;
+    _blinkingLines.fill(false, linesToUpdate, _blinkingLines.size());
+    _hasTextBlinker = _blinkingLines.count(true) > 0;
+
     dirtyRegion |= _inputMethodData.previousPreeditRect;
 
     if ((_screenWindow->currentResultLine() != -1) && (_screenWindow->scrollCount() != 0)) {
@@ -1265,7 +1328,7 @@ void TerminalDisplay::updateImage()
 
 
     // update the parts of the display which have changed
-    update(dirtyRegion);
+    invalidateBackingStore(dirtyRegion);
 
     if (_allowBlinkingText && _hasTextBlinker && !_blinkTextTimer->isActive()) {
         _blinkTextTimer->start();
@@ -1274,7 +1337,6 @@ void TerminalDisplay::updateImage()
         _blinkTextTimer->stop();
         _textBlinking = false;
     }
-    delete[] dirtyMask;
 
 #ifndef QT_NO_ACCESSIBILITY
     QAccessibleEvent dataChangeEvent(this, QAccessible::VisibleDataChanged);
@@ -1311,29 +1373,43 @@ void TerminalDisplay::showResizeNotification()
 
 void TerminalDisplay::paintEvent(QPaintEvent* pe)
 {
+    // the OpenGL view draws everything, including the overlays
+    if (_glView != nullptr) {
+        _glView->update();
+        return;
+    }
+
+    updateBackingStore();
+
     QPainter paint(this);
 
-    // Determine which characters should be repainted (1 region unit = 1 character)
-    QRegion dirtyImageRegion;
-    foreach(const QRect & rect, (pe->region() & contentsRect())) {
-        dirtyImageRegion += widgetToImage(rect);
-        drawBackground(paint, rect, getBackgroundColor(), true /* use opacity setting */);
+    // copy the backgrounds and text, keeping the alpha of a translucent
+    // background
+    const QRegion region = pe->region() & contentsRect();
+    const qreal dpr = _backingStore.devicePixelRatio();
+    paint.setCompositionMode(QPainter::CompositionMode_Source);
+    foreach(const QRect & rect, region) {
+        paint.drawPixmap(QRectF(rect), _backingStore,
+                         QRectF(rect.x() * dpr, rect.y() * dpr, rect.width() * dpr, rect.height() * dpr));
     }
+    paint.setCompositionMode(QPainter::CompositionMode_SourceOver);
+
+    drawOverlays(paint, region);
+}
 
+void TerminalDisplay::drawOverlays(QPainter &paint, const QRegion &region)
+{
     // only turn on text anti-aliasing, never turn on normal antialiasing
     // set https://bugreports.qt.io/browse/QTBUG-66036
     paint.setRenderHint(QPainter::TextAntialiasing, _antialiasText);
 
-    foreach(const QRect & rect, dirtyImageRegion) {
-        drawContents(paint, rect);
-    }
     drawCurrentResultRect(paint);
     drawInputMethodPreeditString(paint, preeditRect());
     paintFilters(paint);
 
     const bool drawDimmed = _dimWhenInactive && !hasFocus();
     const QColor dimColor(0, 0, 0, 128);
-    foreach(const QRect & rect, (pe->region() & contentsRect())) {
+    foreach(const QRect & rect, region) {
         if (drawDimmed) {
             paint.fillRect(rect, dimColor);
         }
@@ -1353,6 +1429,79 @@ void TerminalDisplay::paintEvent(QPaintEvent* pe)
     }
 }
 
+void TerminalDisplay::invalidateBackingStore(const QRegion& region)
+{
+    if (_glView != nullptr) {
+        _glView->update();
+        return;
+    }
+
+    _backingStoreInvalid |= region;
+    update(region);
+}
+
+void TerminalDisplay::invalidateBackingStore()
+{
+    if (_glView != nullptr) {
+        _glView->update();
+        return;
+    }
+
+    _backingStoreInvalid = rect();
+    update();
+}
+
+void TerminalDisplay::updateOverlays(const QRegion& region)
+{
+    if (_glView != nullptr) {
+        _glView->update();
+    } else {
+        update(region);
+    }
+}
+
+void TerminalDisplay::updateOverlays()
+{
+    if (_glView != nullptr) {
+        _glView->update();
+    } else {
+        update();
+    }
+}
+
+void TerminalDisplay::updateBackingStore()
+{
+    const qreal dpr = devicePixelRatioF();
+    if (_backingStore.devicePixelRatio() != dpr || _backingStore.size() != size() * dpr) {
+        _backingStore = QPixmap(size() * dpr);
+        _backingStore.setDevicePixelRatio(dpr);
+        _backingStore.fill(Qt::transparent);
+        _backingStoreInvalid = rect();
+    }
+
+    const QRegion region = _backingStoreInvalid & contentsRect();
+    _backingStoreInvalid = QRegion();
+    if (region.isEmpty()) {
+        return;
+    }
+
+    QPainter paint(&_backingStore);
+    paint.setClipRegion(region);
+
+    // Determine which characters should be repainted (1 region unit = 1 character)
+    QRegion dirtyImageRegion;
+    foreach(const QRect & rect, region) {
+        dirtyImageRegion += widgetToImage(rect);
+        drawBackground(paint, rect, getBackgroundColor(), true /* use opacity setting */);
+    }
+
+    paint.setRenderHint(QPainter::TextAntialiasing, _antialiasText);
+
+    foreach(const QRect & rect, dirtyImageRegion) {
+        drawContents(paint, rect);
+    }
+}
+
 void TerminalDisplay::printContent(QPainter& painter, bool friendly)
 {
     // Reinitialize the font with the printers paint device so the font
@@ -1406,7 +1555,7 @@ void TerminalDisplay::paintFilters(QPainter& painter)
     auto [cursorLine, cursorColumn] = getCharacterPosition(cursorPos, false);
     Character cursorCharacter = _image[loc(qMin(cursorColumn, _columns - 1), cursorLine)];
 
-    painter.setPen(QPen(cursorCharacter.foregroundColor.color(_colorTable)));
+    painter.setPen(QPen(cursorCharacter.foregroundColor().color(_colorTable)));
 
     // iterate over hotspots identified by the display's currently active filters
     // and draw appropriate visuals to indicate the presence of the hotspot
@@ -1533,7 +1682,7 @@ void TerminalDisplay::paintFilters(QPainter& painter)
 
 inline static bool isRtl(const Character &chr) {
     uint c = 0;
-    if ((chr.rendition & RE_EXTENDED_CHAR) == 0) {
+    if ((chr.cellRendition & RE_EXTENDED_CHAR) == 0) {
         c = chr.character;
     } else {
         ushort extendedCharLength = 0;
@@ -1575,7 +1724,7 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
             uint *disstrU = univec.data();
 
             // is this a single character or a sequence of characters ?
-            if ((_image[loc(x, y)].rendition & RE_EXTENDED_CHAR) != 0) {
+            if ((_image[loc(x, y)].cellRendition & RE_EXTENDED_CHAR) != 0) {
                 // sequence of characters
                 ushort extendedCharLength = 0;
                 const uint* chars = ExtendedCharTable::instance.lookupExtendedChar(_image[loc(x, y)].character, extendedCharLength);
@@ -1600,19 +1749,15 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
 
             const bool lineDraw = LineBlockCharacters::canDraw(_image[loc(x, y)].character);
             const bool doubleWidth = (_image[qMin(loc(x, y) + 1, _imageSize - 1)].character == 0);
-            const CharacterColor currentForeground = _image[loc(x, y)].foregroundColor;
-            const CharacterColor currentBackground = _image[loc(x, y)].backgroundColor;
-            const RenditionFlags currentRendition = _image[loc(x, y)].rendition;
+            const quint32 currentStyle = _image[loc(x, y)].style;
+            const RenditionFlags currentCursor = _image[loc(x, y)].cellRendition & RE_CURSOR;
             const bool rtl = isRtl(_image[loc(x, y)]);
 
             const auto isInsideDrawArea = [&](int column) { return column <= rect.right(); };
-            const auto hasSameColors = [&](int column) {
-                return _image[loc(column, y)].foregroundColor == currentForeground
-                    && _image[loc(column, y)].backgroundColor == currentBackground;
-            };
-            const auto hasSameRendition = [&](int column) {
-                return (_image[loc(column, y)].rendition & ~RE_EXTENDED_CHAR)
-                    == (currentRendition & ~RE_EXTENDED_CHAR);
+            // same colors and rendition, apart from RE_EXTENDED_CHAR
+            const auto hasSameFormat = [&](int column) {
+                return _image[loc(column, y)].style == currentStyle
+                    && (_image[loc(column, y)].cellRendition & RE_CURSOR) == currentCursor;
             };
             const auto hasSameWidth = [&](int column) {
                 const int characterLoc = qMin(loc(column, y) + 1, _imageSize - 1);
@@ -1623,11 +1768,11 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
             };
 
             if (canBeGrouped(x)) {
-                while (isInsideDrawArea(x + len) && hasSameColors(x + len)
-                        && hasSameRendition(x + len) && hasSameWidth(x + len)
+                while (isInsideDrawArea(x + len) && hasSameFormat(x + len)
+                        && hasSameWidth(x + len)
                         && canBeGrouped(x + len)) {
                     const uint c = _image[loc(x + len, y)].character;
-                    if ((_image[loc(x + len, y)].rendition & RE_EXTENDED_CHAR) != 0) {
+                    if ((_image[loc(x + len, y)].cellRendition & RE_EXTENDED_CHAR) != 0) {
                         // sequence of characters
                         ushort extendedCharLength = 0;
                         const uint* chars = ExtendedCharTable::instance.lookupExtendedChar(c, extendedCharLength);
@@ -1658,8 +1803,7 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
                 // Group spaces following any non-wide character with the character. This allows for
                 // rendering ambiguous characters with wide glyphs without clipping them.
                 while (!doubleWidth && isInsideDrawArea(x + len)
-                        && _image[loc(x + len, y)].character == ' ' && hasSameColors(x + len)
-                        && hasSameRendition(x + len)) {
+                        && _image[loc(x + len, y)].character == ' ' && hasSameFormat(x + len)) {
                     // disstrU intentionally not modified - trailing spaces are meaningless
                     len++;
                 }
@@ -1813,9 +1957,41 @@ void TerminalDisplay::setBlinkingTextEnabled(bool blink)
     if (!blink && _blinkTextTimer->isActive()) {
         _blinkTextTimer->stop();
         _textBlinking = false;
+        invalidateBackingStore();
     }
 }
 
+void TerminalDisplay::setOpenGLRenderingEnabled(bool enabled)
+{
+    if (enabled == (_glView != nullptr)) {
+        return;
+    }
+
+    if (enabled) {
+        // the view is the lowest child, so that the scroll bar and the
+        // other children are drawn on top of it
+        _glView = new TerminalGLView(this);
+        _glView->setGeometry(rect());
+        _glView->lower();
+        _glView->show();
+
+        // the backing store is not used while the view draws
+        _backingStore = QPixmap();
+        _backingStoreInvalid = QRegion();
+    } else {
+        // the view may be disabling itself from one of its own functions
+        _glView->hide();
+        _glView->deleteLater();
+        _glView = nullptr;
+        invalidateBackingStore();
+    }
+}
+
+bool TerminalDisplay::openGLRenderingEnabled() const
+{
+    return _glView != nullptr;
+}
+
 void TerminalDisplay::focusOutEvent(QFocusEvent* /*event*/)
 {
     // trigger a repaint of the cursor so that it is both:
@@ -1867,7 +2043,7 @@ void TerminalDisplay::blinkTextEvent()
     // TODO: Optimize to only repaint the areas of the widget where there is
     // blinking text rather than repainting the whole widget.
     //_headerBar->terminalFocusOut();
-    update();
+    invalidateBackingStore();
 }
 
 void TerminalDisplay::blinkCursorEvent()
@@ -1889,7 +2065,7 @@ void TerminalDisplay::updateCursor()
 
     int charWidth = _image[cursorLocation].width();
     QRect cursorRect = imageToWidget(QRect(cursorPosition(), QSize(charWidth, 1)));
-    update(cursorRect);
+    invalidateBackingStore(cursorRect);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -1910,6 +2086,10 @@ void TerminalDisplay::resizeEvent(QResizeEvent *event)
         updateImage();
     }
 
+    if (_glView != nullptr) {
+        _glView->setGeometry(rect());
+    }
+
 //    const auto scrollBarWidth = _scrollbarLocation != Enum::ScrollBarHidden
 //                                ? _scrollBar->width()
 //                                : 0;
@@ -1959,6 +2139,9 @@ void TerminalDisplay::updateImageSize()
     }
 
     _resizing = false;
+
+    // the contents may have moved within the widget
+    invalidateBackingStore();
 }
 
 void TerminalDisplay::makeImage()
@@ -1975,6 +2158,7 @@ void TerminalDisplay::makeImage()
     _imageSize = _lines * _columns;
 
     _image = new Character[_imageSize];
+    _blinkingLines.fill(false, _lines);
 
     clearImage();
 }
@@ -1984,6 +2168,7 @@ void TerminalDisplay::clearImage()
     for (int i = 0; i < _imageSize; ++i) {
         _image[i] = Screen::DefaultChar;
     }
+    _compareAllLines = true;
 }
 
 void TerminalDisplay::calcGeometry()
@@ -2077,7 +2262,7 @@ void TerminalDisplay::setCenterContents(bool enable)
 {
     _centerContents = enable;
     calcGeometry();
-    update();
+    invalidateBackingStore();
 }
 
 /* ------------------------------------------------------------------------- */
@@ -2096,7 +2281,7 @@ void TerminalDisplay::setScrollBarPosition(Enum::ScrollBarPositionEnum position)
     _scrollbarLocation = position;
 
     propagateSize();
-    update();
+    invalidateBackingStore();
 }
 
 void TerminalDisplay::scrollBarPositionChanged(int /*pos*/)
@@ -2318,13 +2503,13 @@ void TerminalDisplay::mouseMoveEvent(QMouseEvent* ev)
             setCursor(Qt::PointingHandCursor);
         }
 
-        update(_mouseOverHotspotArea | previousHotspotArea);
+        updateOverlays(_mouseOverHotspotArea | previousHotspotArea);
     } else if (!_mouseOverHotspotArea.isEmpty()) {
         if ((_openLinksByDirectClick || ((ev->modifiers() & Qt::ControlModifier) != 0u)) || (cursor().shape() == Qt::PointingHandCursor)) {
             setCursor(_usesMouseTracking ? Qt::ArrowCursor : Qt::IBeamCursor);
         }
 
-        update(_mouseOverHotspotArea);
+        updateOverlays(_mouseOverHotspotArea);
         // set hotspot area to an invalid rectangle
         _mouseOverHotspotArea = QRegion();
     }
@@ -2392,7 +2577,7 @@ void TerminalDisplay::leaveEvent(QEvent *)
 {
     // remove underline from an active link when cursor leaves the widget area
     if(!_mouseOverHotspotArea.isEmpty()) {
-        update(_mouseOverHotspotArea);
+        updateOverlays(_mouseOverHotspotArea);
         _mouseOverHotspotArea = QRegion();
     }
 }
@@ -2791,6 +2976,8 @@ void TerminalDisplay::viewScrolledByUser()
 */
 QPoint TerminalDisplay::findLineStart(const QPoint &pnt)
 {
+    QMutexLocker locker(_screenWindow->mutex());
+
     const int visibleScreenLines = (int)_lineProperties.size();
     const int topVisibleLine = _screenWindow->currentLine();
     Screen *screen = _screenWindow->screen();
@@ -2824,6 +3011,8 @@ QPoint TerminalDisplay::findLineStart(const QPoint &pnt)
 */
 QPoint TerminalDisplay::findLineEnd(const QPoint &pnt)
 {
+    QMutexLocker locker(_screenWindow->mutex());
+
     const int visibleScreenLines = (int)_lineProperties.size();
     const int topVisibleLine = _screenWindow->currentLine();
     const int maxY = _screenWindow->lineCount() - 1;
@@ -2849,6 +3038,8 @@ QPoint TerminalDisplay::findLineEnd(const QPoint &pnt)
 
 QPoint TerminalDisplay::findWordStart(const QPoint &pnt)
 {
+    QMutexLocker locker(_screenWindow->mutex());
+
     const int regSize = qMax(_screenWindow->windowLines(), 10);
     const int firstVisibleLine = _screenWindow->currentLine();
 
@@ -2921,6 +3112,8 @@ out:
 
 QPoint TerminalDisplay::findWordEnd(const QPoint &pnt)
 {
+    QMutexLocker locker(_screenWindow->mutex());
+
     const int regSize = qMax(_screenWindow->windowLines(), 10);
     const int curLine = _screenWindow->currentLine();
     int i = pnt.y();
@@ -2980,7 +3173,7 @@ QPoint TerminalDisplay::findWordEnd(const QPoint &pnt)
 out:
     y -= curLine;
     // In word selection mode don't select @ (64) if at end of word.
-    if (((image[j].rendition & RE_EXTENDED_CHAR) == 0) &&
+    if (((image[j].cellRendition & RE_EXTENDED_CHAR) == 0) &&
         (QChar(image[j].character) == QLatin1Char('@')) &&
         (y > pnt.y() || x > pnt.x())) {
         if (x > 0) {
@@ -3082,7 +3275,7 @@ bool TerminalDisplay::focusNextPrevChild(bool next)
 
 QChar TerminalDisplay::charClass(const Character& ch) const
 {
-    if ((ch.rendition & RE_EXTENDED_CHAR) != 0) {
+    if ((ch.cellRendition & RE_EXTENDED_CHAR) != 0) {
         ushort extendedCharLength = 0;
         const uint* chars = ExtendedCharTable::instance.lookupExtendedChar(ch.character, extendedCharLength);
         if ((chars != nullptr) && extendedCharLength > 0) {
@@ -3353,7 +3546,7 @@ void TerminalDisplay::inputMethodEvent(QInputMethodEvent* event)
 
     if (!_readOnly && isCursorOnDisplay()) {
         _inputMethodData.preeditString = event->preeditString();
-        update(preeditRect() | _inputMethodData.previousPreeditRect);
+        updateOverlays(preeditRect() | _inputMethodData.previousPreeditRect);
     }
     event->accept();
 }
@@ -3536,7 +3729,7 @@ void TerminalDisplay::keyPressEvent(QKeyEvent* event)
             }
             _filterChain->hotSpots().at(hintSelected)->activate();
             _showUrlHint = false;
-            update();
+            updateOverlays();
             return;
         }
 
@@ -3544,7 +3737,7 @@ void TerminalDisplay::keyPressEvent(QKeyEvent* event)
         {
             processFilters();
             _showUrlHint = true;
-            update();
+            updateOverlays();
         }
     }
 
@@ -3593,7 +3786,7 @@ void TerminalDisplay::keyReleaseEvent(QKeyEvent *event)
 {
     if (_showUrlHint) {
         _showUrlHint = false;
-        update();
+        updateOverlays();
     }
 
     if (_readOnly) {
@@ -3675,7 +3868,7 @@ bool TerminalDisplay::event(QEvent* event)
             // but doesn't redraws.
             _screenWindow->notifyOutputChanged();
         }
-        update();
+        invalidateBackingStore();
         break;
     default:
         break;
@@ -3988,6 +4181,7 @@ void TerminalDisplay::applyProfile(const Profile::Ptr &profile)
     _boldIntense = profile->boldIntense();
     _useFontLineCharacters = profile->useFontLineCharacters();
     setVTFont(profile->font());
+    setOpenGLRenderingEnabled(profile->openGLRenderingEnabled());
 
     // set scroll-bar position
     setScrollBarPosition(Enum::ScrollBarPositionEnum(profile->property<int>(Profile::ScrollBarPosition)));
@@ -4035,4 +4229,10 @@ void TerminalDisplay::applyProfile(const Profile::Ptr &profile)
     // mouse wheel zoom
     _mouseWheelZoom = profile->mouseWheelZoomEnabled();
     setAlternateScrolling(profile->property<bool>(Profile::AlternateScrolling));
+
+    // the cursor and text are drawn differently
+    if (_glView != nullptr) {
+        _glView->clearGlyphs();
+    }
+    invalidateBackingStore();
 }
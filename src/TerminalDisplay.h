@@ -22,8 +22,12 @@
 #define TERMINALDISPLAY_H
 
 // Qt
+#include <QBitArray>
+#include <QCache>
 #include <QColor>
+#include <QPixmap>
 #include <QPointer>
+#include <QStaticText>
 #include <QWidget>
 
 // terminal
@@ -56,9 +60,16 @@ class KMessageWidget;
 
 namespace terminal
 {
+// a cluster of text laid out once, see TerminalDisplay::drawClusters()
+struct TextRun {
+    QStaticText text;
+    qreal ascent; // from the top of the text to its baseline
+};
+
 class FilterChain;
 class TerminalImageFilterChain;
 class Session;
+class TerminalGLView;
 
 //class SessionController;
 //class IncrementalSearchBar;
@@ -72,7 +83,7 @@ class Session;
  *
  * TODO More documentation
  */
-class  TerminalDisplay : public QWidget
+class  TerminalDisplay : public QWidget, public CharacterStyleUser
 {
     Q_OBJECT
 
@@ -164,6 +175,18 @@ public:
     /** Specifies whether or not text can blink. */
     void setBlinkingTextEnabled(bool blink);
 
+    /**
+     * Specifies whether the display is drawn with OpenGL instead of
+     * QPainter, see TerminalGLView.  The display goes back to QPainter if
+     * OpenGL is not available.
+     */
+    void setOpenGLRenderingEnabled(bool enabled);
+    /** Returns whether the display is drawn with OpenGL.  See setOpenGLRenderingEnabled() */
+    bool openGLRenderingEnabled() const;
+
+    /** Marks the styles of the characters which are drawn. */
+    void markStyles(CharacterStyleMarks &marks) Q_DECL_OVERRIDE;
+
     void setLineSpacing(uint);
     uint lineSpacing() const;
 
@@ -648,6 +671,13 @@ private:
     // draws the characters or line graphics in a text fragment
     void drawCharacters(QPainter &painter, const QRect &rect, const QString &text,
                         const Character *style, bool invertCharacterColor);
+    // draws a run from its laid out clusters, the characters of ASCII runs
+    // one per cell, and returns false if the run cannot be drawn that way
+    bool drawClusters(QPainter &painter, int x, int baseline, const QString &text,
+                      int variant, const QFont &font);
+    // returns the laid out text of a cluster drawn with font, which is the
+    // widget font in the given variant, or 0 if it cannot be cached
+    const TextRun *textRun(const QString &text, int variant, const QFont &font);
     // draws a string of line graphics
     void drawLineCharString(QPainter &painter, int x, int y, const QString &str,
                             const Character *attributes);
@@ -655,6 +685,11 @@ private:
     // draws the preedit string for input methods
     void drawInputMethodPreeditString(QPainter &painter, const QRect &rect);
 
+    // draws what is shown on top of the contents in 'region': the current
+    // search result, the preedit string, the filters, the dimming and the
+    // drag and drop overlay
+    void drawOverlays(QPainter &painter, const QRegion &region);
+
     // --
 
     // maps an area in the character image to an area on the widget
@@ -681,6 +716,18 @@ private:
     // the left and right are ignored.
     void scrollImage(int lines, const QRect &screenWindowRegion);
 
+    // marks a region of the widget, or all of it, to be drawn again from
+    // the image into the backing store and schedules a repaint of it
+    void invalidateBackingStore(const QRegion &region);
+    void invalidateBackingStore();
+    // schedules a repaint of a region of the widget, or all of it, for
+    // the overlays only.  The backing store stays valid
+    void updateOverlays(const QRegion &region);
+    void updateOverlays();
+    // draws the invalid parts of the backing store, recreating it if the
+    // size of the widget has changed
+    void updateBackingStore();
+
     void calcGeometry();
     void propagateSize();
     void updateImageSize();
@@ -753,6 +800,9 @@ private:
     // only the area [usedLines][usedColumns] in the image contains valid data
 
     int _imageSize;
+    // whether _image may differ from the window in lines which the
+    // window does not report as dirty, see updateImage()
+    bool _compareAllLines;
     QVector<LineProperty> _lineProperties;
 
     ColorEntry _colorTable[TABLE_COLORS];
@@ -791,6 +841,7 @@ private:
     bool _textBlinking;   // text is blinking, hide it when drawing
     bool _cursorBlinking;     // cursor is blinking, hide it when drawing
     bool _hasTextBlinker; // has characters to blink
+    QBitArray _blinkingLines; // the lines which have characters to blink
     QTimer *_blinkTextTimer;
     QTimer *_blinkCursorTimer;
 
@@ -878,9 +929,26 @@ private:
 //    TerminalHeaderBar *_headerBar;
     QRect _searchResultRect;
     friend class TerminalDisplayAccessible;
+    friend class TerminalGLView;
 
     bool _drawOverlay;
     Qt::Edge _overlayEdge;
+
+    // Laying out text is the most expensive part of painting, the clusters
+    // drawn recently are kept laid out by their variant and text.  The
+    // color of the style is the painter's pen and not part of the key.  Qt
+    // caches the rendered glyphs of a laid out text.
+    QCache<QPair<int, QString>, TextRun> _textRunCache;
+
+    // The backgrounds and text of the display are drawn into the backing
+    // store, which paintEvent() copies to the widget before drawing the
+    // filters, overlays and dimming on top.  Scrolling moves its pixels,
+    // so only the newly exposed lines have to be drawn.
+    QPixmap _backingStore;
+    QRegion _backingStoreInvalid; // the parts of the backing store to draw again
+
+    // draws the display instead of the backing store if OpenGL rendering is enabled
+    TerminalGLView *_glView;
 };
 
 class AutoScrollHandler : public QObject
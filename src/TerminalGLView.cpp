@@ -0,0 +1,520 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "TerminalGLView.h"
+
+// Qt
+#include <QOpenGLContext>
+#include <QPainter>
+#include <QtMath>
+
+// terminal
+#include "ExtendedCharTable.h"
+#include "LineBlockCharacters.h"
+#include "TerminalDebug.h"
+#include "TerminalDisplay.h"
+
+// Standard
+#include <cstddef>
+
+using namespace terminal;
+
+// the largest width and height of the glyph atlas
+static const int ATLAS_SIZE = 2048;
+
+// the variants of the font, as in TerminalDisplay::drawCharacters()
+static const int BOLD_VARIANT = 1 << 0;
+static const int UNDERLINE_VARIANT = 1 << 1;
+static const int ITALIC_VARIANT = 1 << 2;
+static const int STRIKEOUT_VARIANT = 1 << 3;
+static const int OVERLINE_VARIANT = 1 << 4;
+
+// we use this to force QPainter to display text in LTR mode, see TerminalDisplay.cpp
+static const QChar LTR_OVERRIDE_CHAR(0x202D);
+
+// The shaders are preceded by a #version line for OpenGL 3.3 or OpenGL ES 3.0.
+// One instance of a quad, a triangle strip of four vertices, is drawn for
+// each cell, the position of the cell follows from the instance.
+static const char VERTEX_SHADER[] = R"(
+in vec4 background;
+in vec4 foreground;
+in vec4 glyph; // x, y, width and height in the atlas
+
+uniform int columns;
+uniform vec2 origin; // the top left of the cells
+uniform vec2 cellSize;
+uniform vec2 viewportSize;
+uniform vec2 atlasSize;
+uniform bool glyphs; // draw the glyphs instead of the backgrounds
+
+out vec4 color;
+out vec2 atlasPosition;
+
+void main()
+{
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    vec2 cell = vec2(float(gl_InstanceID % columns), float(gl_InstanceID / columns));
+    vec2 position = origin + cell * cellSize + corner * (glyphs ? glyph.zw : cellSize);
+
+    gl_Position = vec4(position / viewportSize * vec2(2.0, -2.0) + vec2(-1.0, 1.0), 0.0, 1.0);
+    color = glyphs ? foreground : background;
+    atlasPosition = (glyph.xy + corner * glyph.zw) / atlasSize;
+}
+)";
+
+static const char FRAGMENT_SHADER[] = R"(
+in vec4 color;
+in vec2 atlasPosition;
+
+uniform sampler2D atlas;
+uniform bool glyphs;
+
+out vec4 fragColor;
+
+void main()
+{
+    // the glyphs are drawn in white, their alpha is the coverage
+    float coverage = glyphs ? texture(atlas, atlasPosition).a : 1.0;
+    fragColor = vec4(color.rgb * color.a, color.a) * coverage;
+}
+)";
+
+static void setColor(uchar rgba[4], const QColor &color)
+{
+    rgba[0] = uchar(color.red());
+    rgba[1] = uchar(color.green());
+    rgba[2] = uchar(color.blue());
+    rgba[3] = uchar(color.alpha());
+}
+
+TerminalGLView::TerminalGLView(TerminalDisplay *display) :
+    QOpenGLWidget(display),
+    _display(display),
+    _initialized(false),
+    _atlasTexture(0),
+    _cellColumns(0),
+    _atlasSize(0),
+    _atlasX(0),
+    _atlasY(0),
+    _atlasFull(false),
+    _atlasUploadTop(0),
+    _atlasUploadBottom(0),
+    _glyphPixelRatio(0)
+{
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    if (QOpenGLContext::openGLModuleType() == QOpenGLContext::LibGLES) {
+        format.setVersion(3, 0);
+    } else {
+        format.setVersion(3, 3);
+        format.setProfile(QSurfaceFormat::CoreProfile);
+    }
+    setFormat(format);
+
+    // the display handles the input
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+    setFocusPolicy(Qt::NoFocus);
+}
+
+TerminalGLView::~TerminalGLView()
+{
+    makeCurrent();
+    releaseGL();
+    doneCurrent();
+}
+
+void TerminalGLView::initializeGL()
+{
+    initializeOpenGLFunctions();
+    connect(context(), &QOpenGLContext::aboutToBeDestroyed, this, &TerminalGLView::releaseGL,
+            Qt::UniqueConnection);
+
+    const QSurfaceFormat format = context()->format();
+    const bool isOpenGLES = context()->isOpenGLES();
+    const bool isSupported = isOpenGLES ? format.majorVersion() >= 3
+                                        : format.version() >= qMakePair(3, 3);
+    const QByteArray version = isOpenGLES ? QByteArrayLiteral("#version 300 es\nprecision highp float;\n")
+                                          : QByteArrayLiteral("#version 330 core\n");
+
+    _program.reset(new QOpenGLShaderProgram());
+    if (!isSupported
+            || !_program->addShaderFromSourceCode(QOpenGLShader::Vertex, version + VERTEX_SHADER)
+            || !_program->addShaderFromSourceCode(QOpenGLShader::Fragment, version + FRAGMENT_SHADER)
+            || !_program->link()) {
+        qCDebug(TerminalDebug) << "Drawing with QPainter, OpenGL" << format.majorVersion()
+                               << format.minorVersion() << "is not supported" << _program->log();
+        _program.reset();
+
+        // this view is deleted, which it cannot be while it is initialized
+        TerminalDisplay *display = _display;
+        QMetaObject::invokeMethod(display, [display]() {
+            display->setOpenGLRenderingEnabled(false);
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    _vertexArray.create();
+    _vertexArray.bind();
+    _cellBuffer.create();
+    _cellBuffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+    _cellBuffer.bind();
+
+    const struct {
+        const char *name;
+        GLenum type;
+        GLboolean normalized;
+        size_t offset;
+    } attributes[] = {
+        { "background", GL_UNSIGNED_BYTE, GL_TRUE, offsetof(Cell, background) },
+        { "foreground", GL_UNSIGNED_BYTE, GL_TRUE, offsetof(Cell, foreground) },
+        { "glyph", GL_UNSIGNED_SHORT, GL_FALSE, offsetof(Cell, glyph) }
+    };
+    for (const auto &attribute : attributes) {
+        const GLuint location = GLuint(_program->attributeLocation(attribute.name));
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, attribute.type, attribute.normalized, sizeof(Cell),
+                              reinterpret_cast<const void *>(attribute.offset));
+        glVertexAttribDivisor(location, 1);
+    }
+
+    _vertexArray.release();
+    _cellBuffer.release();
+
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    _atlasSize = qMin(ATLAS_SIZE, int(maxTextureSize));
+    _atlas = QImage(_atlasSize, _atlasSize, QImage::Format_RGBA8888_Premultiplied);
+
+    glGenTextures(1, &_atlasTexture);
+    glBindTexture(GL_TEXTURE_2D, _atlasTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, _atlasSize, _atlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    // the glyphs are drawn at the size they have been rasterized at
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    resetAtlas();
+    _initialized = true;
+}
+
+void TerminalGLView::releaseGL()
+{
+    if (!_initialized) {
+        return;
+    }
+    _initialized = false;
+
+    _vertexArray.destroy();
+    _cellBuffer.destroy();
+    _program.reset();
+    glDeleteTextures(1, &_atlasTexture);
+    _atlasTexture = 0;
+    resetAtlas();
+}
+
+void TerminalGLView::clearGlyphs()
+{
+    resetAtlas();
+    update();
+}
+
+void TerminalGLView::resetAtlas()
+{
+    _glyphs.clear();
+    _sequenceGlyphs.clear();
+    _atlasX = 0;
+    _atlasY = 0;
+    _atlasFull = false;
+    _atlasUploadTop = _atlasSize;
+    _atlasUploadBottom = 0;
+}
+
+void TerminalGLView::paintGL()
+{
+    if (!_initialized) {
+        return;
+    }
+
+    const qreal dpr = devicePixelRatioF();
+    if (_glyphPixelRatio != dpr) {
+        resetAtlas();
+        _glyphPixelRatio = dpr;
+    }
+    if (!updateCells()) {
+        // start over with only the glyphs which are on display
+        resetAtlas();
+        updateCells();
+    }
+    uploadAtlas();
+
+    const QColor background = _display->getBackgroundColor();
+    const qreal opacity = qAlpha(_display->_blendColor) / 255.0;
+    glClearColor(GLfloat(background.redF() * opacity), GLfloat(background.greenF() * opacity),
+                 GLfloat(background.blueF() * opacity), GLfloat(opacity));
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    const QPoint origin = _display->_contentRect.topLeft() + _display->contentsRect().topLeft();
+
+    if (!_cells.isEmpty()) {
+        _program->bind();
+        _program->setUniformValue("columns", GLint(_cellColumns));
+        _program->setUniformValue("origin", GLfloat(origin.x() * dpr), GLfloat(origin.y() * dpr));
+        _program->setUniformValue("cellSize", GLfloat(_display->_fontWidth * dpr),
+                                  GLfloat(_display->_fontHeight * dpr));
+        _program->setUniformValue("viewportSize", GLfloat(width() * dpr), GLfloat(height() * dpr));
+        _program->setUniformValue("atlasSize", GLfloat(_atlasSize), GLfloat(_atlasSize));
+        _program->setUniformValue("atlas", GLint(0));
+
+        _cellBuffer.bind();
+        _cellBuffer.allocate(_cells.constData(), _cells.size() * int(sizeof(Cell)));
+        _cellBuffer.release();
+
+        _vertexArray.bind();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, _atlasTexture);
+
+        _program->setUniformValue("glyphs", GLint(0));
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, _cells.size());
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        _program->setUniformValue("glyphs", GLint(1));
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, _cells.size());
+        glDisable(GL_BLEND);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        _vertexArray.release();
+        _program->release();
+    }
+
+    QPainter painter(this);
+    if (!_cursor.isNull()) {
+        const QRect cursorRect(origin.x() + _cursor.x() * _display->_fontWidth,
+                               origin.y() + _cursor.y() * _display->_fontHeight,
+                               _cursor.width() * _display->_fontWidth,
+                               _display->_fontHeight);
+        bool invertCharacterColor = false;
+        _display->drawCursor(painter, cursorRect, _cursorForeground, QColor(), invertCharacterColor);
+    }
+    _display->drawOverlays(painter, rect());
+}
+
+bool TerminalGLView::updateCells()
+{
+    const TerminalDisplay *display = _display;
+
+    _cursor = QRect();
+    if (display->_image == nullptr) {
+        _cells.clear();
+        return true;
+    }
+
+    const int lines = display->_usedLines;
+    const int columns = display->_usedColumns;
+    _cells.resize(lines * columns);
+    _cellColumns = columns;
+
+    const QFont &font = display->font();
+    const QColor defaultBackground = display->getBackgroundColor();
+    const int opacity = qAlpha(display->_blendColor);
+    const bool fillCursor = display->_cursorShape == Enum::BlockCursor && display->hasFocus()
+                            && !display->_cursorBlinking;
+
+    // the format of the previous character, which most characters share
+    // with their neighbors
+    quint32 style = ~0u;
+    QColor foreground;
+    QColor background;
+    int variant = 0;
+    bool hidden = false;
+    Cell format = {};
+
+    Cell *cell = _cells.data();
+    for (int y = 0; y < lines; ++y) {
+        const Character *line = display->_image + y * display->_columns;
+        for (int x = 0; x < columns; ++x, ++cell) {
+            const Character &character = line[x];
+
+            if (character.style != style) {
+                style = character.style;
+                const RenditionFlags rendition = CharacterStyleTable::style(style).rendition;
+
+                foreground = character.foregroundColor().color(display->_colorTable);
+                background = character.backgroundColor().color(display->_colorTable);
+                // only the display's background is translucent, see
+                // TerminalDisplay::drawTextFragment()
+                if (background == defaultBackground) {
+                    background.setAlpha(opacity);
+                }
+                setColor(format.background, background);
+                setColor(format.foreground, foreground);
+
+                variant = ((rendition & RE_BOLD) != 0 && display->_boldIntense ? BOLD_VARIANT : 0)
+                          | ((rendition & RE_UNDERLINE) != 0 || font.underline() ? UNDERLINE_VARIANT : 0)
+                          | ((rendition & RE_ITALIC) != 0 || font.italic() ? ITALIC_VARIANT : 0)
+                          | ((rendition & RE_STRIKEOUT) != 0 || font.strikeOut() ? STRIKEOUT_VARIANT : 0)
+                          | ((rendition & RE_OVERLINE) != 0 || font.overline() ? OVERLINE_VARIANT : 0);
+                hidden = (rendition & RE_CONCEAL) != 0
+                         || (display->_textBlinking && (rendition & RE_BLINK) != 0);
+            }
+            *cell = format;
+
+            const int cells = (x + 1 < columns && line[x + 1].character == 0) ? 2 : 1;
+
+            if ((character.cellRendition & RE_CURSOR) != 0) {
+                if (fillCursor) {
+                    setColor(cell->background, display->_cursorColor.isValid() ? display->_cursorColor : foreground);
+                    if (!display->_cursorColor.isValid()) {
+                        // draw the character in its background color to keep it readable
+                        QColor inverted = background;
+                        inverted.setAlpha(0xff);
+                        setColor(cell->foreground, inverted);
+                    }
+                } else {
+                    _cursor = QRect(x, y, cells, 1);
+                    _cursorForeground = foreground;
+                }
+            }
+
+            // trailing parts of wide characters and blank spaces have no glyph
+            if (hidden || character.character == 0
+                    || (character.character == ' '
+                        && (variant & (UNDERLINE_VARIANT | STRIKEOUT_VARIANT | OVERLINE_VARIANT)) == 0)) {
+                continue;
+            }
+
+            if ((character.cellRendition & RE_EXTENDED_CHAR) != 0) {
+                ushort extendedCharLength = 0;
+                const uint *chars = ExtendedCharTable::instance.lookupExtendedChar(character.character,
+                                                                                   extendedCharLength);
+                if (chars == nullptr) {
+                    continue;
+                }
+                cell->glyph = glyph(QString::fromUcs4(chars, extendedCharLength), variant, cells);
+            } else {
+                cell->glyph = glyph(character.character, variant, cells);
+            }
+            if (_atlasFull) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+TerminalGLView::Glyph TerminalGLView::glyph(uint character, int variant, int cells)
+{
+    const quint64 key = quint64(character) << 8 | quint64(variant) << 1 | quint64(cells - 1);
+    const auto it = _glyphs.constFind(key);
+    if (it != _glyphs.constEnd()) {
+        return it.value();
+    }
+
+    const Glyph glyph = rasterize(QString::fromUcs4(&character, 1), variant, cells);
+    if (!_atlasFull) {
+        _glyphs.insert(key, glyph);
+    }
+    return glyph;
+}
+
+TerminalGLView::Glyph TerminalGLView::glyph(const QString &text, int variant, int cells)
+{
+    const QPair<int, QString> key(variant << 1 | (cells - 1), text);
+    const auto it = _sequenceGlyphs.constFind(key);
+    if (it != _sequenceGlyphs.constEnd()) {
+        return it.value();
+    }
+
+    const Glyph glyph = rasterize(text, variant, cells);
+    if (!_atlasFull) {
+        _sequenceGlyphs.insert(key, glyph);
+    }
+    return glyph;
+}
+
+TerminalGLView::Glyph TerminalGLView::rasterize(const QString &text, int variant, int cells)
+{
+    const TerminalDisplay *display = _display;
+    const int width = qCeil(cells * display->_fontWidth * _glyphPixelRatio);
+    const int height = qCeil(display->_fontHeight * _glyphPixelRatio);
+
+    // all glyphs have the height of a line, they are placed in rows
+    if (_atlasX + width > _atlasSize) {
+        _atlasX = 0;
+        _atlasY += height;
+    }
+    if (_atlasY + height > _atlasSize || width > _atlasSize) {
+        _atlasFull = true;
+        return Glyph();
+    }
+
+    const QRect area(_atlasX, _atlasY, width, height);
+    _atlasX += width;
+    _atlasUploadTop = qMin(_atlasUploadTop, area.top());
+    _atlasUploadBottom = qMax(_atlasUploadBottom, area.bottom() + 1);
+
+    QPainter painter(&_atlas);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(area, Qt::transparent);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.setClipRect(area);
+    painter.translate(area.topLeft());
+    painter.scale(_glyphPixelRatio, _glyphPixelRatio);
+    painter.setPen(Qt::white);
+
+    const bool bold = (variant & BOLD_VARIANT) != 0;
+    if (text.size() == 1 && LineBlockCharacters::canDraw(text.at(0).unicode())
+            && !display->_useFontLineCharacters) {
+        painter.setRenderHint(QPainter::Antialiasing, display->_antialiasText);
+        LineBlockCharacters::draw(painter, QRect(0, 0, display->_fontWidth, display->_fontHeight),
+                                  text.at(0), bold);
+    } else {
+        QFont font = display->font();
+        font.setWeight(bold ? QFont::Weight::Bold : QFont::Weight::Normal);
+        font.setUnderline((variant & UNDERLINE_VARIANT) != 0);
+        font.setItalic((variant & ITALIC_VARIANT) != 0);
+        font.setStrikeOut((variant & STRIKEOUT_VARIANT) != 0);
+        font.setOverline((variant & OVERLINE_VARIANT) != 0);
+        painter.setFont(font);
+        painter.setRenderHint(QPainter::TextAntialiasing, display->_antialiasText);
+        painter.setLayoutDirection(Qt::LeftToRight);
+        painter.drawText(QPointF(0, display->_fontAscent + display->_lineSpacing), LTR_OVERRIDE_CHAR + text);
+    }
+
+    return { quint16(area.x()), quint16(area.y()), quint16(area.width()), quint16(area.height()) };
+}
+
+void TerminalGLView::uploadAtlas()
+{
+    if (_atlasUploadTop >= _atlasUploadBottom) {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, _atlasTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, _atlasUploadTop, _atlasSize, _atlasUploadBottom - _atlasUploadTop,
+                    GL_RGBA, GL_UNSIGNED_BYTE, _atlas.constScanLine(_atlasUploadTop));
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    _atlasUploadTop = _atlasSize;
+    _atlasUploadBottom = 0;
+}
@@ -0,0 +1,142 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef TERMINALGLVIEW_H
+#define TERMINALGLVIEW_H
+
+// Qt
+#include <QHash>
+#include <QImage>
+#include <QOpenGLBuffer>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QOpenGLWidget>
+#include <QPair>
+#include <QScopedPointer>
+#include <QVector>
+
+namespace terminal {
+class TerminalDisplay;
+
+/**
+ * Draws the characters of a TerminalDisplay with OpenGL.
+ *
+ * The view covers its display, below the display's other children, and
+ * lets the mouse events pass to the display.  Each frame, the display's
+ * image of characters is converted into the colors and glyph of every
+ * cell, using the display's color table, and uploaded as instance data.
+ * The backgrounds and then the glyphs are drawn with one instanced draw
+ * call each.  Glyphs are rasterized by QPainter into an atlas texture the
+ * first time they are used.
+ *
+ * The filters, overlays and the cursor shapes other than the filled block
+ * are drawn on top by the display with QPainter.  Double width and double
+ * height lines are drawn as normal lines, and text is not reordered for
+ * bidirectional rendering.
+ *
+ * Only OpenGL 3.3 and OpenGL ES 3.0 features are used, so the view also
+ * runs on Mesa's llvmpipe software rasterizer, for example with
+ * LIBGL_ALWAYS_SOFTWARE=1 on a virtual X server.  If no such context can
+ * be created, the display goes back to drawing with QPainter.
+ */
+class TerminalGLView : public QOpenGLWidget, protected QOpenGLExtraFunctions
+{
+    Q_OBJECT
+
+public:
+    explicit TerminalGLView(TerminalDisplay *display);
+    ~TerminalGLView() Q_DECL_OVERRIDE;
+
+    /**
+     * Discards the rasterized glyphs.  Called when the font or the way
+     * text is drawn have changed.
+     */
+    void clearGlyphs();
+
+protected:
+    void initializeGL() Q_DECL_OVERRIDE;
+    void paintGL() Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    // frees the OpenGL objects before the context is destroyed
+    void releaseGL();
+
+private:
+    Q_DISABLE_COPY(TerminalGLView)
+
+    // the area of a glyph in the atlas, in pixels.  An empty glyph
+    // draws nothing
+    struct Glyph
+    {
+        quint16 x;
+        quint16 y;
+        quint16 width;
+        quint16 height;
+    };
+
+    // the instance data of a cell, see the vertex shader
+    struct Cell
+    {
+        uchar background[4]; // RGBA
+        uchar foreground[4];
+        Glyph glyph;
+    };
+
+    // discards the glyphs in the atlas
+    void resetAtlas();
+    // fills _cells from the image of the display, returns false if
+    // the atlas has run full
+    bool updateCells();
+    // returns the glyph of a character or a sequence of characters in
+    // a variant of the font, which covers 'cells' cells
+    Glyph glyph(uint character, int variant, int cells);
+    Glyph glyph(const QString &text, int variant, int cells);
+    // draws a glyph into the atlas
+    Glyph rasterize(const QString &text, int variant, int cells);
+    // copies the rows of the atlas which glyphs were drawn into to the texture
+    void uploadAtlas();
+
+    TerminalDisplay *_display;
+    bool _initialized;
+
+    QScopedPointer<QOpenGLShaderProgram> _program;
+    QOpenGLVertexArrayObject _vertexArray;
+    QOpenGLBuffer _cellBuffer;
+    GLuint _atlasTexture;
+
+    QVector<Cell> _cells;
+    int _cellColumns;
+    QRect _cursor; // the cells of a cursor which is drawn by the display
+    QColor _cursorForeground;
+
+    QImage _atlas;
+    int _atlasSize;
+    int _atlasX; // where the next glyph is placed
+    int _atlasY;
+    bool _atlasFull;
+    int _atlasUploadTop; // the rows of the atlas to upload
+    int _atlasUploadBottom;
+    qreal _glyphPixelRatio; // the device pixel ratio of the glyphs
+    QHash<quint64, Glyph> _glyphs;
+    QHash<QPair<int, QString>, Glyph> _sequenceGlyphs;
+};
+}
+
+#endif // TERMINALGLVIEW_H
@@ -19,6 +19,10 @@
 #include <utils/algorithm.h>
 #include <projectexplorer/projectexplorer.h>
 #include <ProfileManager.h>
+#include <KonsoleSettings.h>
+#include <Session.h>
+#include <SessionManager.h>
+#include <config/kconfig.h>
 
 #include <QDir>
 #include <QIcon>
@@ -50,6 +54,9 @@ TerminalWindow* AsTerminal(QWidget* widget)
 {
     return reinterpret_cast<TerminalWindow*>(widget);
 }
+
+// the sessions saved when Qt Creator shuts down, in AppDataLocation
+const char SessionsConfig[] = "terminalsessionsrc";
 }
 
 TerminalOutputPane::TerminalOutputPane(QObject *parent)
@@ -85,7 +92,15 @@ QWidget *TerminalOutputPane::outputWidget(QWidget *parent)
         connect(tabs, &QTabWidget::currentChanged, this, &TerminalOutputPane::ActiveTabChanged);
         connect(tabs, &QTabWidget::customContextMenuRequested, this, &TerminalOutputPane::ShowContextMenu);
 
-        AddTab();
+        if (_restoredSessions.isEmpty())
+        {
+            AddTab();
+        }
+        for (auto session : qAsConst(_restoredSessions))
+        {
+            AddWindow(session);
+        }
+        _restoredSessions.clear();
     }
 
     return _tabs.get();
@@ -127,12 +142,42 @@ void TerminalOutputPane::termInitialized()
 {
 }
 
+void TerminalOutputPane::restoreSessions()
+{
+    // an empty configuration still removes the files of sessions which
+    // have not ended properly
+    KConfig config(QLatin1String(SessionsConfig), KConfig::SimpleConfig, QStandardPaths::AppDataLocation);
+    SessionManager::instance()->restoreSessions(&config);
+    _restoredSessions = SessionManager::instance()->sessions();
+}
+
+void TerminalOutputPane::saveSessions()
+{
+    KConfig config(QLatin1String(SessionsConfig), KConfig::SimpleConfig, QStandardPaths::AppDataLocation);
+    for (const auto &group : config.groupList())
+    {
+        config.deleteGroup(group);
+    }
+
+    // without the setting the files of the sessions are removed with them
+    if (KonsoleSettings::saveScrollback())
+    {
+        SessionManager::instance()->saveSessions(&config);
+    }
+    config.sync();
+}
+
 void TerminalOutputPane::AddTab()
+{
+    AddWindow(nullptr);
+}
+
+void TerminalOutputPane::AddWindow(Session* restoredSession)
 {
     auto id = _nextTerminalNumber++;
     auto title = QString::asprintf("Terminal %d", id);
 
-    auto newWindow = new TerminalWindow(_tabs.get(), title, id);
+    auto newWindow = new TerminalWindow(_tabs.get(), title, id, restoredSession);
     newWindow->initialze();    
     _windows.insert(id, newWindow);
 
@@ -44,6 +44,14 @@ public:
     void goToNext() override;
     void goToPrev() override;
 
+    // restores the sessions saved by saveSessions(), which get their tabs
+    // when the pane is first shown, and removes the scrollback files no
+    // restored session uses
+    void restoreSessions();
+    // saves the sessions of the tabs along with their scrollback, if the
+    // SaveScrollback setting is enabled
+    void saveSessions();
+
 private slots:
     void termInitialized();
     void AddTab();
@@ -56,6 +64,7 @@ private:
     TerminalWindow* _activeWindow;
     QToolButton* _addButton;
     QMap<int, TerminalWindow*> _windows;
+    QList<Session*> _restoredSessions;
     int _nextTerminalNumber;
     QTimer _delayCloseTimer;
 
@@ -64,6 +73,7 @@ private:
     QAction* _closeOtherAction;
 
     void CreateControls();
+    void AddWindow(Session* restoredSession);
     bool CloseTab(int index);
     void CloseAllTabs(int except = -1);
     void UpdateCloseState();
@@ -72,11 +72,21 @@ bool TerminalPlugin::initialize(const QStringList &arguments, QString *errorMess
     interested in. These objects can now be requested through the
     PluginManagerInterface.
 
-    The TerminalPlugin doesn't need things from other plugins, so it does
-    nothing here.
+    The TerminalPlugin restores the sessions saved at the last shutdown here,
+    once the profiles and settings can be loaded.
 */
 void TerminalPlugin::extensionsInitialized()
 {
+    _outputPane->restoreSessions();
+}
+
+/*! Saves the sessions, while they are still running, so that their
+    scrollback files are kept for the next start.
+*/
+ExtensionSystem::IPlugin::ShutdownFlag TerminalPlugin::aboutToShutdown()
+{
+    _outputPane->saveSessions();
+    return SynchronousShutdown;
 }
 
 } // namespace Terminal
@@ -24,6 +24,7 @@ public:
 
     bool initialize(const QStringList &arguments, QString *errorMessage);
     void extensionsInitialized();
+    ShutdownFlag aboutToShutdown();
 
 private:
     TerminalOutputPane* _outputPane;
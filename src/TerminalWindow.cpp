@@ -13,11 +13,12 @@
 using namespace terminal;
 
 
-TerminalWindow::TerminalWindow(QWidget *parent, QString title, int id)
+TerminalWindow::TerminalWindow(QWidget *parent, QString title, int id, Session *restoredSession)
     : QWidget(parent),
       _title(title),
       _id(id),
       _tabIndex(-1),
+      _restoredSession(restoredSession),
       _parent(parent)
 {
     setContextMenuPolicy(Qt::CustomContextMenu);
@@ -53,9 +54,20 @@ void TerminalWindow::CreateDisplay()
 
     auto profile = ProfileManager::instance()->defaultProfile();
 
-    Q_ASSERT(profile);
+    // the first display shows the restored session, a display recreated
+    // after the session has finished gets a new one
+    if (_restoredSession != nullptr)
+    {
+        _session = _restoredSession;
+        _restoredSession = nullptr;
+        profile = SessionManager::instance()->sessionProfile(_session);
+    }
+    else
+    {
+        _session = SessionManager::instance()->createSession(profile);
+    }
 
-    _session = SessionManager::instance()->createSession(profile);
+    Q_ASSERT(profile);
     connect(_session, &terminal::Session::finished, this,
         [this]() {
             disconnect(_session);
@@ -17,7 +17,9 @@ class TerminalWindow : public QWidget
     Q_OBJECT
 
 public:
-    TerminalWindow(QWidget *parent, QString title = QString(), int id = -1);
+    // shows the restored session if one is given, see SessionManager::restoreSessions()
+    TerminalWindow(QWidget *parent, QString title = QString(), int id = -1,
+                   Session *restoredSession = nullptr);
     void initialze();
 
     TerminalDisplay *Display() const { return _display; }
@@ -61,6 +63,7 @@ private:
     int _id;
     int _tabIndex;
     Session* _session = nullptr;
+    Session* _restoredSession = nullptr;
     QVBoxLayout *_layout = nullptr;
     TerminalDisplay *_display = nullptr;
     QAction *_copyAction = nullptr;
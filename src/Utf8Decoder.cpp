@@ -0,0 +1,125 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "Utf8Decoder.h"
+
+// System
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace terminal;
+
+Utf8Decoder::Utf8Decoder() :
+    _codePoint(0),
+    _minimum(0),
+    _pending(0)
+{
+}
+
+void Utf8Decoder::reset()
+{
+    _codePoint = 0;
+    _minimum = 0;
+    _pending = 0;
+}
+
+int Utf8Decoder::feed(uchar byte, uint *dest)
+{
+    if (_pending == 0) {
+        return start(byte, dest);
+    }
+
+    if ((byte & 0xC0) == 0x80) {
+        _codePoint = (_codePoint << 6) | (byte & 0x3F);
+        if (--_pending > 0) {
+            return 0;
+        }
+
+        const uint c = _codePoint;
+        const bool valid = c >= _minimum
+                           && c <= 0x10FFFF
+                           && !(c >= 0xD800 && c <= 0xDFFF);
+        dest[0] = valid ? c : ReplacementCharacter;
+        return 1;
+    }
+
+    // the sequence was cut short, the byte which interrupted it
+    // starts a new character
+    _pending = 0;
+    dest[0] = ReplacementCharacter;
+    return 1 + start(byte, dest + 1);
+}
+
+int Utf8Decoder::start(uchar byte, uint *dest)
+{
+    if (byte < 0x80) {
+        dest[0] = byte;
+        return 1;
+    }
+
+    if ((byte & 0xE0) == 0xC0) {
+        _codePoint = byte & 0x1F;
+        _minimum = 0x80;
+        _pending = 1;
+    } else if ((byte & 0xF0) == 0xE0) {
+        _codePoint = byte & 0x0F;
+        _minimum = 0x800;
+        _pending = 2;
+    } else if ((byte & 0xF8) == 0xF0) {
+        _codePoint = byte & 0x07;
+        _minimum = 0x10000;
+        _pending = 3;
+    } else {
+        // stray continuation byte or invalid lead byte
+        dest[0] = ReplacementCharacter;
+        return 1;
+    }
+    return 0;
+}
+
+int Utf8Decoder::printableAsciiLength(const char *text, int length)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    // Compare as signed bytes: everything >= 0x80 is negative and therefore
+    // fails the lower bound along with the C0 controls.
+    const __m128i lower = _mm_set1_epi8(0x1F);
+    const __m128i upper = _mm_set1_epi8(0x7F);
+    for (; i + 16 <= length; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+        const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(bytes, lower),
+                                                _mm_cmplt_epi8(bytes, upper));
+        const int mask = _mm_movemask_epi8(printable);
+        if (mask != 0xFFFF) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#endif
+
+    for (; i < length; ++i) {
+        const uchar c = static_cast<uchar>(text[i]);
+        if (c < 0x20 || c > 0x7E) {
+            break;
+        }
+    }
+    return i;
+}
@@ -0,0 +1,85 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef UTF8DECODER_H
+#define UTF8DECODER_H
+
+// Qt
+#include <QtGlobal>
+
+namespace terminal {
+/**
+ * A streaming UTF-8 decoder which works directly on the byte buffers
+ * received from the pty.
+ *
+ * Unlike QTextDecoder it does not allocate: bytes are fed in one at a time
+ * with feed() and the decoded code points are written into a caller supplied
+ * buffer.  A multi-byte sequence which is split across two buffers is
+ * completed when the remaining bytes arrive.
+ *
+ * Malformed input (stray continuation bytes, truncated or overlong sequences,
+ * surrogates and values beyond U+10FFFF) is decoded as U+FFFD.
+ */
+class Utf8Decoder
+{
+public:
+    /** The code point produced for malformed input. */
+    static constexpr uint ReplacementCharacter = 0xFFFD;
+
+    Utf8Decoder();
+
+    /** Discards any partially decoded sequence. */
+    void reset();
+
+    /**
+     * Returns true if the decoder is not in the middle of a multi-byte
+     * sequence, ie. the next byte starts a new character.
+     */
+    bool isIdle() const
+    {
+        return _pending == 0;
+    }
+
+    /**
+     * Feeds @p byte to the decoder.
+     *
+     * @param byte The next byte of input
+     * @param dest Receives the decoded code points.  Must have room for
+     * at least two entries.
+     *
+     * @return The number of code points written to @p dest (0, 1 or 2).
+     */
+    int feed(uchar byte, uint *dest);
+
+    /**
+     * Returns the length of the run of printable ASCII characters
+     * (0x20..0x7E) at the start of @p text.  Uses SIMD where available.
+     */
+    static int printableAsciiLength(const char *text, int length);
+
+private:
+    int start(uchar byte, uint *dest);
+
+    uint _codePoint;
+    uint _minimum;
+    int _pending;
+};
+}
+
+#endif // UTF8DECODER_H
@@ -29,6 +29,7 @@
 
 // Qt
 #include <QEvent>
+#include <QThread>
 #include <QTimer>
 #include <QKeyEvent>
 
@@ -77,7 +78,6 @@ Vt102Emulation::Vt102Emulation() :
     QObject::connect(_sessionAttributesUpdateTimer, &QTimer::timeout, this,
                      &terminal::Vt102Emulation::updateSessionAttributes);
 
-    initTokenizer();
     reset();
 }
 
@@ -85,12 +85,16 @@ Vt102Emulation::~Vt102Emulation() = default;
 
 void Vt102Emulation::clearEntireScreen()
 {
+    QMutexLocker locker(mutex());
+
     _currentScreen->clearEntireScreen();
     bufferedUpdate();
 }
 
 void Vt102Emulation::reset()
 {
+    QMutexLocker locker(mutex());
+
     // Save the current codec so we can set it later.
     // Ideally we would want to use the profile setting
     const QTextCodec *currentCodec = codec();
@@ -239,16 +243,314 @@ const int MAX_ARGUMENT = 4096;
 /* The tokenizer's state
 
    The state is represented by the buffer (tokenBuffer, tokenBufferPos),
-   and accompanied by decoded arguments kept in (argv,argc).
+   and accompanied by decoded arguments kept in (argv,argc) and the
+   current state of the parser (tokenizerState).
    Note that they are kept internal in the tokenizer.
 */
 
+namespace {
+/* Tokenizer states
+
+   Ground               - no sequence in progress
+   Escape               - <ESC>
+   EscapeCharset        - <ESC><any of `()+*%'>
+   EscapeHash           - <ESC>'#'
+   CsiEntry             - <ESC>'['
+   CsiParamFirst        - <ESC>'[' {Pn} (one character so far)
+   CsiParam             - <ESC>'[' {Pn} ';' ...
+   Csi*First            - <ESC>'[' followed by one of `?>! ' (the "marker")
+   Csi*                 - <ESC>'[' <marker> {Pn} ';' ...
+   Csi*Space            - a space as the 2nd character after '['
+   OscString            - <ESC>']' ... terminated by <BEL> or <ESC>
+   DcsPassthrough       - <ESC>'P' ... (eaten, terminated by <ESC>)
+   Vt52*                - the same for VT52 mode
+
+   The marker states are also entered from EscapeCharset and EscapeHash,
+   this mirrors the behavior of the original scanner which only looked
+   at the third character of the token.
+*/
+enum TokenizerState {
+    Ground,
+    Escape,
+    EscapeCharset,
+    EscapeHash,
+    CsiEntry,
+    CsiParamFirst,
+    CsiParam,
+    CsiPrivateFirst,
+    CsiPrivate,
+    CsiGreaterFirst,
+    CsiGreater,
+    CsiBangFirst,
+    CsiSpaceFirst,
+    CsiParamSpace,
+    CsiPrivateSpace,
+    CsiGreaterSpace,
+    CsiBangSpace,
+    CsiSpaceSpace,
+    OscString,
+    DcsPassthrough,
+    Vt52Ground,
+    Vt52Escape,
+    Vt52CupRow,
+    Vt52CupColumn,
+    TokenizerStateCount
+};
+
+// Character classes used while decoding
+enum CharacterClass {
+    ClassControl,   // C0 control characters not listed below
+    ClassBell,      // BEL
+    ClassCancel,    // CAN and SUB
+    ClassEscape,    // ESC
+    ClassDelete,    // DEL
+    ClassDigit,     // 0..9
+    ClassSemicolon, // argument separator
+    ClassQuestion,  // '?' marker
+    ClassGreater,   // '>' marker
+    ClassBang,      // '!' marker
+    ClassSpace,     // ' ' marker
+    ClassCsi,       // '['
+    ClassOsc,       // ']'
+    ClassCharset,   // Select Character Set, one of `()+*%'
+    ClassHash,      // '#'
+    ClassDcs,       // 'P', also a CPN final character
+    ClassCpn,       // final characters of CSI_PN tokens
+    ClassCps,       // 't', final character of window manipulation (resize = \e[8;<row>;<col>t)
+    ClassVt52Cup,   // 'Y', VT52 cursor positioning
+    ClassC1Csi,     // ESC+128, the 8-bit CSI
+    ClassPrintable, // any other character below 256
+    ClassWide,      // any character from 256 upwards
+    CharacterClassCount
+};
+
+enum TokenizerAction {
+    Ignore,
+    Execute,          // processes a control character
+    Cancel,           // CAN or SUB, aborts the sequence and processes the character
+    StartEscape,      // aborts the sequence and starts a new one
+    C1Csi,            // translates ESC+128 into <ESC>'['
+    Collect,
+    CollectDigit,
+    CollectSeparator,
+    Print,
+    EscDispatch,
+    EscCharsetDispatch,
+    EscHashDispatch,
+    CsiPnDispatch,
+    CsiResizeDispatch,
+    CsiPeDispatch,
+    CsiSpDispatch,
+    CsiPspDispatch,
+    CsiDispatch,
+    CsiPrivateDispatch,
+    CsiGreaterDispatch,
+    OscDispatch,
+    Vt52Print,
+    Vt52Dispatch,
+    Vt52CupDispatch
+};
+
+struct Transition {
+    quint8 action;
+    quint8 next;
+};
+
+struct TransitionTable {
+    Transition entry[TokenizerStateCount][CharacterClassCount];
+};
+
+struct CharacterClassTable {
+    quint8 entry[256];
+};
+
+constexpr CharacterClassTable buildCharacterClasses()
+{
+    CharacterClassTable table = {};
+
+    for (int i = 0; i < 256; ++i) {
+        table.entry[i] = i < 32 ? ClassControl : ClassPrintable;
+    }
+    table.entry[7] = ClassBell;
+    table.entry[24] = ClassCancel;
+    table.entry[26] = ClassCancel;
+    table.entry[27] = ClassEscape;
+    table.entry[127] = ClassDelete;
+    table.entry[27 + 128] = ClassC1Csi;
+
+    for (const char *s = "@ABCDGHILMSTXZbcdfry"; *s != 0; ++s) {
+        table.entry[static_cast<quint8>(*s)] = ClassCpn;
+    }
+    for (const char *s = "()+*%"; *s != 0; ++s) {
+        table.entry[static_cast<quint8>(*s)] = ClassCharset;
+    }
+    for (int i = '0'; i <= '9'; ++i) {
+        table.entry[i] = ClassDigit;
+    }
+    table.entry[';'] = ClassSemicolon;
+    table.entry['?'] = ClassQuestion;
+    table.entry['>'] = ClassGreater;
+    table.entry['!'] = ClassBang;
+    table.entry[' '] = ClassSpace;
+    table.entry['['] = ClassCsi;
+    table.entry[']'] = ClassOsc;
+    table.entry['#'] = ClassHash;
+    table.entry['P'] = ClassDcs;
+    table.entry['t'] = ClassCps;
+    table.entry['Y'] = ClassVt52Cup;
+
+    return table;
+}
+
+constexpr void setTransition(TransitionTable &table, int state, int characterClass, int action, int next)
+{
+    table.entry[state][characterClass] = Transition{static_cast<quint8>(action), static_cast<quint8>(next)};
+}
+
+// sets the transition for all non-control characters
+constexpr void setDefaultTransition(TransitionTable &table, int state, int action, int next)
+{
+    for (int c = ClassDigit; c < CharacterClassCount; ++c) {
+        setTransition(table, state, c, action, next);
+    }
+}
+
+// sets the transitions for the characters which start a CSI marker state
+constexpr void setMarkerTransitions(TransitionTable &table, int state)
+{
+    setTransition(table, state, ClassQuestion, Collect, CsiPrivateFirst);
+    setTransition(table, state, ClassGreater, Collect, CsiGreaterFirst);
+    setTransition(table, state, ClassBang, Collect, CsiBangFirst);
+    setTransition(table, state, ClassSpace, Collect, CsiSpaceFirst);
+}
+
+// sets the transitions for the final characters of CSI_PN and resize tokens
+constexpr void setPnTransitions(TransitionTable &table, int state)
+{
+    setTransition(table, state, ClassCpn, CsiPnDispatch, Ground);
+    setTransition(table, state, ClassDcs, CsiPnDispatch, Ground);
+    setTransition(table, state, ClassCps, CsiResizeDispatch, Ground);
+}
+
+// sets the transitions for the argument list
+constexpr void setParameterTransitions(TransitionTable &table, int state, int next)
+{
+    setTransition(table, state, ClassDigit, CollectDigit, next);
+    setTransition(table, state, ClassSemicolon, CollectSeparator, next);
+}
+
+constexpr TransitionTable buildTransitionTable()
+{
+    TransitionTable table = {};
+
+    // DEC HACK ALERT! Control Characters are allowed *within* esc sequences in VT100
+    // This means, they do neither a resetTokenizer() nor a pushToToken(). Some of them, do
+    // of course. Guess this originates from a weakly layered handling of the X-on
+    // X-off protocol, which comes really below this level.
+    for (int state = 0; state < TokenizerStateCount; ++state) {
+        const bool vt52 = state >= Vt52Ground;
+        setTransition(table, state, ClassControl, Execute, state);
+        setTransition(table, state, ClassBell, Execute, state);
+        setTransition(table, state, ClassCancel, Cancel, Ground);
+        setTransition(table, state, ClassEscape, StartEscape, vt52 ? Vt52Escape : Escape);
+        setTransition(table, state, ClassDelete, Ignore, state); // VT100: ignore.
+    }
+
+    setDefaultTransition(table, Ground, Print, Ground);
+    setTransition(table, Ground, ClassC1Csi, C1Csi, CsiEntry);
+
+    setDefaultTransition(table, Escape, EscDispatch, Ground);
+    setTransition(table, Escape, ClassCsi, Collect, CsiEntry);
+    setTransition(table, Escape, ClassOsc, Collect, OscString);
+    setTransition(table, Escape, ClassCharset, Collect, EscapeCharset);
+    setTransition(table, Escape, ClassHash, Collect, EscapeHash);
+    setTransition(table, Escape, ClassDcs, Collect, DcsPassthrough);
+
+    setDefaultTransition(table, EscapeCharset, EscCharsetDispatch, Ground);
+    setMarkerTransitions(table, EscapeCharset);
+
+    setDefaultTransition(table, EscapeHash, EscHashDispatch, Ground);
+    setMarkerTransitions(table, EscapeHash);
+
+    setDefaultTransition(table, CsiEntry, CsiDispatch, Ground);
+    setMarkerTransitions(table, CsiEntry);
+    setPnTransitions(table, CsiEntry);
+    setParameterTransitions(table, CsiEntry, CsiParamFirst);
+
+    setDefaultTransition(table, CsiParamFirst, CsiDispatch, Ground);
+    setPnTransitions(table, CsiParamFirst);
+    setParameterTransitions(table, CsiParamFirst, CsiParam);
+    setTransition(table, CsiParamFirst, ClassSpace, Collect, CsiParamSpace);
+
+    setDefaultTransition(table, CsiParam, CsiDispatch, Ground);
+    setPnTransitions(table, CsiParam);
+    setParameterTransitions(table, CsiParam, CsiParam);
+
+    setDefaultTransition(table, CsiPrivateFirst, CsiPrivateDispatch, Ground);
+    setParameterTransitions(table, CsiPrivateFirst, CsiPrivate);
+    setTransition(table, CsiPrivateFirst, ClassSpace, Collect, CsiPrivateSpace);
+
+    setDefaultTransition(table, CsiPrivate, CsiPrivateDispatch, Ground);
+    setParameterTransitions(table, CsiPrivate, CsiPrivate);
+
+    setDefaultTransition(table, CsiGreaterFirst, CsiGreaterDispatch, Ground);
+    setParameterTransitions(table, CsiGreaterFirst, CsiGreater);
+    setTransition(table, CsiGreaterFirst, ClassSpace, Collect, CsiGreaterSpace);
+
+    setDefaultTransition(table, CsiGreater, CsiGreaterDispatch, Ground);
+    setParameterTransitions(table, CsiGreater, CsiGreater);
+
+    setDefaultTransition(table, CsiBangFirst, CsiPeDispatch, Ground);
+    setTransition(table, CsiBangFirst, ClassSpace, Collect, CsiBangSpace);
+
+    setDefaultTransition(table, CsiSpaceFirst, CsiSpDispatch, Ground);
+    setPnTransitions(table, CsiSpaceFirst);
+    setTransition(table, CsiSpaceFirst, ClassSpace, Collect, CsiSpaceSpace);
+
+    setDefaultTransition(table, CsiParamSpace, CsiPspDispatch, Ground);
+    setPnTransitions(table, CsiParamSpace);
+
+    setDefaultTransition(table, CsiPrivateSpace, CsiPspDispatch, Ground);
+    setDefaultTransition(table, CsiGreaterSpace, CsiPspDispatch, Ground);
+    setDefaultTransition(table, CsiBangSpace, CsiPeDispatch, Ground);
+
+    setDefaultTransition(table, CsiSpaceSpace, CsiSpDispatch, Ground);
+    setPnTransitions(table, CsiSpaceSpace);
+
+    // ignore control characters in the text part of OSC "ESC]"
+    // escape sequences; this matches what XTERM docs say
+    setDefaultTransition(table, OscString, Collect, OscString);
+    setTransition(table, OscString, ClassControl, Ignore, OscString);
+    setTransition(table, OscString, ClassCancel, Ignore, OscString);
+    setTransition(table, OscString, ClassBell, OscDispatch, Ground);
+    setTransition(table, OscString, ClassEscape, OscDispatch, Ground);
+
+    // TODO We don't xterm DCS, so we just eat it
+    setDefaultTransition(table, DcsPassthrough, Collect, DcsPassthrough);
+
+    setDefaultTransition(table, Vt52Ground, Vt52Print, Ground);
+    setTransition(table, Vt52Ground, ClassWide, Vt52Dispatch, Ground);
+
+    setDefaultTransition(table, Vt52Escape, Vt52Dispatch, Ground);
+    setTransition(table, Vt52Escape, ClassVt52Cup, Collect, Vt52CupRow);
+
+    setDefaultTransition(table, Vt52CupRow, Collect, Vt52CupColumn);
+    setDefaultTransition(table, Vt52CupColumn, Vt52CupDispatch, Ground);
+
+    return table;
+}
+
+constexpr CharacterClassTable characterClasses = buildCharacterClasses();
+constexpr TransitionTable transitions = buildTransitionTable();
+}
+
 void Vt102Emulation::resetTokenizer()
 {
     tokenBufferPos = 0;
     argc = 0;
     argv[0] = 0;
     argv[1] = 0;
+    tokenizerState = Ground;
 }
 
 void Vt102Emulation::addDigit(int digit)
@@ -270,206 +572,139 @@ void Vt102Emulation::addToCurrentToken(int cc)
     tokenBufferPos = qMin(tokenBufferPos + 1, MAX_TOKEN_LENGTH - 1);
 }
 
-// Character Class flags used while decoding
-const int CTL = 1;   // Control character
-const int CHR = 2;   // Printable character
-const int CPN = 4;   // TODO: Document me
-const int DIG = 8;   // Digit
-const int SCS = 16;  // Select Character Set
-const int GRP = 32;  // TODO: Document me
-const int CPS = 64;  // Character which indicates end of window resize
-
-void Vt102Emulation::initTokenizer()
-{
-    int i;
-    quint8 *s;
-    for (i = 0; i < 256; ++i) {
-        charClass[i] = 0;
-    }
-    for (i = 0; i < 32; ++i) {
-        charClass[i] |= CTL;
-    }
-    for (i = 32; i < 256; ++i) {
-        charClass[i] |= CHR;
-    }
-    for (s = (quint8 *)"@ABCDGHILMPSTXZbcdfry"; *s != 0u; ++s) {
-        charClass[*s] |= CPN;
-    }
-    // resize = \e[8;<row>;<col>t
-    for (s = (quint8 *)"t"; *s != 0u; ++s) {
-        charClass[*s] |= CPS;
-    }
-    for (s = (quint8 *)"0123456789"; *s != 0u; ++s) {
-        charClass[*s] |= DIG;
-    }
-    for (s = (quint8 *)"()+*%"; *s != 0u; ++s) {
-        charClass[*s] |= SCS;
-    }
-    for (s = (quint8 *)"()+*#[]%"; *s != 0u; ++s) {
-        charClass[*s] |= GRP;
-    }
-
-    resetTokenizer();
-}
-
-/* Ok, here comes the nasty part of the decoder.
-
-   Instead of keeping an explicit state, we deduce it from the
-   token scanned so far. It is then immediately combined with
-   the current character to form a scanning decision.
-
-   This is done by the following defines.
-
-   - P is the length of the token scanned so far.
-   - L (often P-1) is the position on which contents we base a decision.
-   - C is a character or a group of characters (taken from 'charClass').
-
-   - 'cc' is the current character
-   - 's' is a pointer to the start of the token buffer
-   - 'p' is the current position within the token buffer
-
-   Note that they need to applied in proper order.
-*/
-
-#define lec(P,L,C) (p == (P) && s[(L)] == (C))
-#define lun(     ) (p ==  1  && cc >= 32 )
-#define les(P,L,C) (p == (P) && s[L] < 256 && (charClass[s[(L)]] & (C)) == (C))
-#define eec(C)     (p >=  3  && cc == (C))
-#define ees(C)     (p >=  3  && cc < 256 && (charClass[cc] & (C)) == (C))
-#define eps(C)     (p >=  3  && s[2] != '?' && s[2] != '!' && s[2] != '>' && cc < 256 && (charClass[cc] & (C)) == (C))
-#define epp( )     (p >=  3  && s[2] == '?')
-#define epe( )     (p >=  3  && s[2] == '!')
-#define egt( )     (p >=  3  && s[2] == '>')
-#define esp( )     (p >=  4  && s[2] == SP )
-#define epsp( )    (p >=  5  && s[3] == SP )
-#define Xpe        (tokenBufferPos >= 2 && tokenBuffer[1] == ']')
-#define Xte        (Xpe      && (cc ==  7 || cc == 27))
-#define ces(C)     (cc < 256 && (charClass[cc] & (C)) == (C) && !Xte)
-#define dcs        (p >= 2   && s[0] == ESC && s[1] == 'P')
-
-#define CNTL(c) ((c)-'@')
 const int ESC = 27;
-const int DEL = 127;
-const int SP  = 32;
 
 // process an incoming unicode character
 void Vt102Emulation::receiveChar(uint cc)
 {
-  if (cc == DEL) {
-    return; //VT100: ignore.
-  }
-
-  if (ces(CTL))
-  {
-    // ignore control characters in the text part of Xpe (aka OSC) "ESC]"
-    // escape sequences; this matches what XTERM docs say
-    if (Xpe) {
-        return;
+    int state = tokenizerState;
+    if (state == Ground && !getMode(MODE_Ansi)) {
+        state = Vt52Ground;
     }
 
-    // DEC HACK ALERT! Control Characters are allowed *within* esc sequences in VT100
-    // This means, they do neither a resetTokenizer() nor a pushToToken(). Some of them, do
-    // of course. Guess this originates from a weakly layered handling of the X-on
-    // X-off protocol, which comes really below this level.
-    if (cc == CNTL('X') || cc == CNTL('Z') || cc == ESC) {
+    const int characterClass = cc < 256 ? characterClasses.entry[cc] : ClassWide;
+    const Transition transition = transitions.entry[state][characterClass];
+
+    switch (transition.action) {
+    case Ignore:
+        return;
+    case Execute:
+        processToken(token_ctl(cc+'@'), 0, 0);
+        return;
+    case Cancel:
         resetTokenizer(); //VT100: CAN or SUB
-    }
-    if (cc != ESC)
-    {
         processToken(token_ctl(cc+'@'), 0, 0);
         return;
-    }
-  }
-  // advance the state
-  addToCurrentToken(cc);
-
-  int* s = tokenBuffer;
-  const int  p = tokenBufferPos;
-
-  if (getMode(MODE_Ansi))
-  {
-    if (lec(1,0,ESC)) { return; }
-    if (lec(1,0,ESC+128)) { s[0] = ESC; receiveChar('['); return; }
-    if (les(2,1,GRP)) { return; }
-    if (Xte         ) { processSessionAttributeRequest(); resetTokenizer(); return; }
-    if (Xpe         ) { return; }
-    if (lec(3,2,'?')) { return; }
-    if (lec(3,2,'>')) { return; }
-    if (lec(3,2,'!')) { return; }
-    if (lec(3,2,SP )) { return; }
-    if (lec(4,3,SP )) { return; }
-    if (lun(       )) { processToken(token_chr(), applyCharset(cc), 0);   resetTokenizer(); return; }
-    if (dcs         ) { return; /* TODO We don't xterm DCS, so we just eat it */ }
-    if (lec(2,0,ESC)) { processToken(token_esc(s[1]), 0, 0);              resetTokenizer(); return; }
-    if (les(3,1,SCS)) { processToken(token_esc_cs(s[1],s[2]), 0, 0);      resetTokenizer(); return; }
-    if (lec(3,1,'#')) { processToken(token_esc_de(s[2]), 0, 0);           resetTokenizer(); return; }
-    if (eps(    CPN)) { processToken(token_csi_pn(cc), argv[0],argv[1]);  resetTokenizer(); return; }
-
-    // resize = \e[8;<row>;<col>t
-    if (eps(CPS))
-    {
-        processToken(token_csi_ps(cc, argv[0]), argv[1], argv[2]);
+    case StartEscape:
         resetTokenizer();
+        addToCurrentToken(cc);
+        tokenizerState = transition.next;
+        return;
+    case C1Csi:
+        addToCurrentToken(ESC);
+        addToCurrentToken('[');
+        tokenizerState = transition.next;
         return;
     }
 
-    if (epe(   )) { processToken(token_csi_pe(cc), 0, 0); resetTokenizer(); return; }
+    // advance the state
+    addToCurrentToken(cc);
 
-    if (esp (   )) { processToken(token_csi_sp(cc), 0, 0);           resetTokenizer(); return; }
-    if (epsp(   )) { processToken(token_csi_psp(cc, argv[0]), 0, 0); resetTokenizer(); return; }
+    const int* s = tokenBuffer;
 
-    if (ees(DIG)) { addDigit(cc-'0'); return; }
-    if (eec(';')) { addArgument();    return; }
-    for (int i = 0; i <= argc; i++)
-    {
-        if (epp()) {
-            processToken(token_csi_pr(cc,argv[i]), 0, 0);
-        } else if (egt()) {
-            processToken(token_csi_pg(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
-        } else if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
-        {
-            // ESC[ ... 48;2;<red>;<green>;<blue> ... m -or- ESC[ ... 38;2;<red>;<green>;<blue> ... m
-            i += 2;
-            processToken(token_csi_ps(cc, argv[i-2]), COLOR_SPACE_RGB, (argv[i] << 16) | (argv[i+1] << 8) | argv[i+2]);
-            i += 2;
-        }
-        else if (cc == 'm' && argc - i >= 2 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 5)
+    switch (transition.action) {
+    case Collect:
+        tokenizerState = transition.next;
+        return;
+    case CollectDigit:
+        addDigit(cc-'0');
+        tokenizerState = transition.next;
+        return;
+    case CollectSeparator:
+        addArgument();
+        tokenizerState = transition.next;
+        return;
+    case Print:              processToken(token_chr(), applyCharset(cc), 0); break;
+    case EscDispatch:        processToken(token_esc(s[1]), 0, 0); break;
+    case EscCharsetDispatch: processToken(token_esc_cs(s[1],s[2]), 0, 0); break;
+    case EscHashDispatch:    processToken(token_esc_de(s[2]), 0, 0); break;
+    case CsiPnDispatch:      processToken(token_csi_pn(cc), argv[0],argv[1]); break;
+    // resize = \e[8;<row>;<col>t
+    case CsiResizeDispatch:  processToken(token_csi_ps(cc, argv[0]), argv[1], argv[2]); break;
+    case CsiPeDispatch:      processToken(token_csi_pe(cc), 0, 0); break;
+    case CsiSpDispatch:      processToken(token_csi_sp(cc), 0, 0); break;
+    case CsiPspDispatch:     processToken(token_csi_psp(cc, argv[0]), 0, 0); break;
+    case CsiDispatch:
+    case CsiPrivateDispatch:
+    case CsiGreaterDispatch:
+        for (int i = 0; i <= argc; i++)
         {
-            // ESC[ ... 48;5;<index> ... m -or- ESC[ ... 38;5;<index> ... m
-            i += 2;
-            processToken(token_csi_ps(cc, argv[i-2]), COLOR_SPACE_256, argv[i]);
-        } else {
-            processToken(token_csi_ps(cc,argv[i]), 0, 0);
+            if (transition.action == CsiPrivateDispatch) {
+                processToken(token_csi_pr(cc,argv[i]), 0, 0);
+            } else if (transition.action == CsiGreaterDispatch) {
+                processToken(token_csi_pg(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
+            } else if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
+            {
+                // ESC[ ... 48;2;<red>;<green>;<blue> ... m -or- ESC[ ... 38;2;<red>;<green>;<blue> ... m
+                i += 2;
+                processToken(token_csi_ps(cc, argv[i-2]), COLOR_SPACE_RGB, (argv[i] << 16) | (argv[i+1] << 8) | argv[i+2]);
+                i += 2;
+            }
+            else if (cc == 'm' && argc - i >= 2 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 5)
+            {
+                // ESC[ ... 48;5;<index> ... m -or- ESC[ ... 38;5;<index> ... m
+                i += 2;
+                processToken(token_csi_ps(cc, argv[i-2]), COLOR_SPACE_256, argv[i]);
+            } else {
+                processToken(token_csi_ps(cc,argv[i]), 0, 0);
+            }
         }
+        break;
+    case OscDispatch:        processSessionAttributeRequest(); break;
+    case Vt52Print:          processToken(token_chr(), s[0], 0); break;
+    case Vt52Dispatch:       processToken(token_vt52(s[1]), 0, 0); break;
+    case Vt52CupDispatch:    processToken(token_vt52(s[1]), s[2], s[3]); break;
     }
     resetTokenizer();
-  } else {
-    // VT52 Mode
-    if (lec(1,0,ESC)) {
-        return;
-    }
-    if (les(1,0,CHR))
-    {
-        processToken(token_chr(), s[0], 0);
-        resetTokenizer();
-        return;
+}
+
+// process a run of printable characters
+void Vt102Emulation::receivePrintableChars(const uint *chars, int count)
+{
+    int i = 0;
+
+    // characters which continue an escape sequence in progress
+    // have to go through the tokenizer
+    while (i < count && tokenizerState != Ground) {
+        receiveChar(chars[i++]);
     }
-    if (lec(2,1,'Y')) {
+
+    if (!getMode(MODE_Ansi)) {
+        for (; i < count; i++) {
+            receiveChar(chars[i]);
+        }
         return;
     }
-    if (lec(3,1,'Y')) {
+
+    // in the ground state every printable character is a CHR token,
+    // so the whole run goes to the screen at once
+    const CharCodes &charset = _charset[_currentScreen == _screen[1]];
+    if (!charset.graphic && !charset.pound) {
+        if (i < count) {
+            _currentScreen->displayCharacters(chars + i, count - i);
+        }
         return;
     }
-    if (p < 4)
-    {
-        processToken(token_vt52(s[1] ), 0, 0);
-        resetTokenizer();
-        return;
+
+    uint translated[256];
+    while (i < count) {
+        const int n = qMin(count - i, 256);
+        for (int j = 0; j < n; j++) {
+            translated[j] = applyCharset(chars[i + j]);
+        }
+        _currentScreen->displayCharacters(translated, n);
+        i += n;
     }
-    processToken(token_vt52(s[1]), s[2], s[3]);
-    resetTokenizer();
-    return;
-  }
 }
 
 void Vt102Emulation::processSessionAttributeRequest()
@@ -503,11 +738,18 @@ void Vt102Emulation::processSessionAttributeRequest()
   }
 
   _pendingSessionAttributesUpdates[attribute] = value;
-  _sessionAttributesUpdateTimer->start(20);
+  if (QThread::currentThread() == thread()) {
+      _sessionAttributesUpdateTimer->start(20);
+  } else {
+      // the output is processed on a worker thread, see EmulationWorker
+      QMetaObject::invokeMethod(_sessionAttributesUpdateTimer, "start", Qt::QueuedConnection, Q_ARG(int, 20));
+  }
 }
 
 void Vt102Emulation::updateSessionAttributes()
 {
+    QMutexLocker locker(mutex());
+
     for (auto arg : _pendingSessionAttributesUpdates.keys())
     {
         emit sessionAttributeChanged(arg , _pendingSessionAttributesUpdates[arg]);
@@ -1034,6 +1276,8 @@ void Vt102Emulation::reportAnswerBack()
 
 void Vt102Emulation::sendMouseEvent(int cb, int cx, int cy, int eventType)
 {
+    QMutexLocker locker(mutex());
+
     if (cx < 1 || cy < 1) {
         return;
     }
@@ -1122,6 +1366,8 @@ void Vt102Emulation::sendText(const QString &text)
 
 void Vt102Emulation::sendKeyEvent(QKeyEvent *event)
 {
+    QMutexLocker locker(mutex());
+
     const Qt::KeyboardModifiers modifiers = event->modifiers();
     KeyboardTranslator::States states = KeyboardTranslator::NoState;
 
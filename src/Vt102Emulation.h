@@ -101,6 +101,7 @@ protected:
     void setMode(int mode) Q_DECL_OVERRIDE;
     void resetMode(int mode) Q_DECL_OVERRIDE;
     void receiveChar(uint cc) Q_DECL_OVERRIDE;
+    void receivePrintableChars(const uint *chars, int count) Q_DECL_OVERRIDE;
 
 private Q_SLOTS:
     // Causes sessionAttributeChanged() to be emitted for each (int,QString)
@@ -141,12 +142,14 @@ private:
     void addArgument();
     int argv[MAXARGS];
     int argc;
-    void initTokenizer();
 
-    // Set of flags for each of the ASCII characters which indicates
-    // what category they fall into (printable character, control, digit etc.)
-    // for the purposes of decoding terminal output
-    int charClass[256];
+    // The state of the tokenizer, see the TokenizerState enum and the
+    // transition table in Vt102Emulation.cpp
+    int tokenizerState;
+
+    // the scanner which the transition table replaced, kept to check that
+    // both produce the same screens, see src/bench/TokenizerDiff.cpp
+    friend class LegacyVt102Emulation;
 
     void reportDecodingError();
 
@@ -0,0 +1,230 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+/*
+    terminal-render-diff
+
+    Draws a known screen with a TerminalDisplay, once with QPainter and
+    once through TerminalGLView, and compares the pixels of the two.  The
+    screen holds what both paths support: colors, renditions, line
+    graphics, wide and combined characters.  Double width lines and
+    bidirectional text are drawn differently by the OpenGL view, see
+    TerminalGLView.
+
+    Without a window system, the offscreen platform and Mesa's llvmpipe
+    software rasterizer are used.  If no OpenGL 3.3 or OpenGL ES 3.0
+    context can be created there, the test is skipped with exit code 77.
+
+    Usage: terminal-render-diff [--output directory] [--tolerance n] [--max-differences percent]
+    Exits with 1 and prints the first differing pixel on a mismatch.
+*/
+
+// Qt
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QEventLoop>
+#include <QFontDatabase>
+#include <QImage>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QTimer>
+
+// terminal
+#include "Emulation.h"
+#include "Session.h"
+#include "TerminalDisplay.h"
+
+// Standard
+#include <cstdio>
+
+namespace terminal {
+
+static const int COLUMNS = 80;
+static const int LINES = 24;
+
+// hides the cursor, which blinks, and fills the screen
+static const char SCREEN[] =
+    "\033[?25l"
+    "plain ASCII text: The quick brown fox jumps over the lazy dog 0123456789\r\n"
+    "\033[1mbold\033[0m \033[3mitalic\033[0m \033[4munderline\033[0m \033[9mstrikeout\033[0m "
+    "\033[53moverline\033[0m \033[7mreverse\033[0m \033[2mfaint\033[0m\r\n"
+    "\033[30;47m black \033[31;46m red \033[32;45m green \033[33;44m yellow "
+    "\033[34;43m blue \033[35;42m magenta \033[36;41m cyan \033[37;40m white \033[0m\r\n"
+    "\033[90m bright \033[91m red \033[92m green \033[93m yellow \033[94m blue "
+    "\033[95m magenta \033[96m cyan \033[97m white \033[0m\r\n"
+    "\033[38;5;208;48;5;24m 256 colors \033[38;2;255;128;0;48;2;0;64;128m true color \033[0m\r\n"
+    "\xe2\x94\x8c\xe2\x94\x80\xe2\x94\x80\xe2\x94\xac\xe2\x94\x80\xe2\x94\x80\xe2\x94\x90 "
+    "\xe2\x96\x88\xe2\x96\x93\xe2\x96\x92\xe2\x96\x91 \xe2\x94\x82 line graphics\r\n"
+    "\xe2\x94\x94\xe2\x94\x80\xe2\x94\x80\xe2\x94\xb4\xe2\x94\x80\xe2\x94\x80\xe2\x94\x98\r\n"
+    "wide: \xe6\xbc\xa2\xe5\xad\x97 \xe3\x81\x8b\xe3\x81\xaa combined: e\xcc\x81 a\xcc\x8a n\xcc\x83\r\n"
+    "\033[1;32muser@host\033[0m:\033[1;34m~/src\033[0m$ make -j8\r\n"
+    "\033[10;20H\033[44m positioned \033[0m\033[12;60H\033[1;4;31mend\033[0m";
+
+// runs the event loop, so that the display picks up the output and size
+// changes and the OpenGL view initializes
+static void settle(int msecs)
+{
+    QEventLoop loop;
+    QTimer::singleShot(msecs, &loop, &QEventLoop::quit);
+    loop.exec();
+}
+
+// returns whether a context of the version TerminalGLView requires can be
+// created and made current on an offscreen surface
+static bool openGLAvailable()
+{
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    if (QOpenGLContext::openGLModuleType() == QOpenGLContext::LibGLES) {
+        format.setVersion(3, 0);
+    } else {
+        format.setVersion(3, 3);
+        format.setProfile(QSurfaceFormat::CoreProfile);
+    }
+
+    QOffscreenSurface surface;
+    surface.setFormat(format);
+    surface.create();
+
+    QOpenGLContext context;
+    context.setFormat(format);
+    if (!surface.isValid() || !context.create() || !context.makeCurrent(&surface)) {
+        return false;
+    }
+
+    const QSurfaceFormat created = context.format();
+    const bool isSupported = context.isOpenGLES() ? created.majorVersion() >= 3
+                                                  : created.version() >= qMakePair(3, 3);
+    context.doneCurrent();
+    return isSupported;
+}
+
+// returns the largest difference between the channels of two pixels
+static int pixelDifference(QRgb a, QRgb b)
+{
+    return qMax(qMax(qAbs(qRed(a) - qRed(b)), qAbs(qGreen(a) - qGreen(b))),
+                qMax(qAbs(qBlue(a) - qBlue(b)), qAbs(qAlpha(a) - qAlpha(b))));
+}
+
+}
+
+using namespace terminal;
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    if (qEnvironmentVariableIsEmpty("LIBGL_ALWAYS_SOFTWARE")) {
+        qputenv("LIBGL_ALWAYS_SOFTWARE", "1");
+    }
+
+    QApplication app(argc, argv);
+    QApplication::setApplicationName(QStringLiteral("terminal-render-diff"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Compares a screen drawn with QPainter and with OpenGL."));
+    parser.addHelpOption();
+
+    const QCommandLineOption outputOption(QStringLiteral("output"),
+                                          QStringLiteral("Directory to write both images and their difference to."),
+                                          QStringLiteral("directory"));
+    const QCommandLineOption toleranceOption(QStringLiteral("tolerance"),
+                                             QStringLiteral("Largest difference of a channel which is ignored (default 64)."),
+                                             QStringLiteral("n"), QStringLiteral("64"));
+    const QCommandLineOption maxDifferencesOption(QStringLiteral("max-differences"),
+                                                  QStringLiteral("Percentage of pixels which may differ, for the anti-aliasing of glyphs (default 0.5)."),
+                                                  QStringLiteral("percent"), QStringLiteral("0.5"));
+    parser.addOptions({outputOption, toleranceOption, maxDifferencesOption});
+    parser.process(app);
+
+    if (!openGLAvailable()) {
+        printf("skipped, no OpenGL 3.3 or OpenGL ES 3.0 context\n");
+        return 77;
+    }
+
+    // the display is destroyed before its session
+    Session session;
+    TerminalDisplay display(&session);
+    QFont font = QFontDatabase::systemFont(QFontDatabase::FixedFont);
+    font.setPixelSize(14);
+    display.setVTFont(font);
+    display.setSize(COLUMNS, LINES);
+    display.resize(display.sizeHint());
+    session.addView(&display);
+    display.show();
+    settle(100);
+
+    session.emulation()->receiveData(SCREEN, int(sizeof(SCREEN) - 1));
+    settle(200);
+    const QImage painted = display.grab().toImage().convertToFormat(QImage::Format_ARGB32);
+
+    display.setOpenGLRenderingEnabled(true);
+    settle(200);
+    if (!display.openGLRenderingEnabled()) {
+        // the view has gone back to QPainter, see TerminalGLView::initializeGL()
+        printf("skipped, the OpenGL view could not be initialized\n");
+        return 77;
+    }
+    const QImage rendered = display.grab().toImage().convertToFormat(QImage::Format_ARGB32);
+
+    if (painted.size() != rendered.size()) {
+        fprintf(stderr, "the images differ in size: %dx%d and %dx%d\n",
+                painted.width(), painted.height(), rendered.width(), rendered.height());
+        return 1;
+    }
+
+    const int tolerance = qMax(parser.value(toleranceOption).toInt(), 0);
+    QImage difference(painted.size(), QImage::Format_ARGB32);
+    difference.fill(Qt::black);
+    qint64 differences = 0;
+    QPoint first(-1, -1);
+    for (int y = 0; y < painted.height(); y++) {
+        const QRgb *paintedLine = reinterpret_cast<const QRgb *>(painted.constScanLine(y));
+        const QRgb *renderedLine = reinterpret_cast<const QRgb *>(rendered.constScanLine(y));
+        for (int x = 0; x < painted.width(); x++) {
+            const int pixel = pixelDifference(paintedLine[x], renderedLine[x]);
+            if (pixel > tolerance) {
+                if (differences == 0) {
+                    first = QPoint(x, y);
+                }
+                differences++;
+                difference.setPixel(x, y, qRgb(pixel, pixel, pixel));
+            }
+        }
+    }
+
+    if (parser.isSet(outputOption)) {
+        const QDir output(parser.value(outputOption));
+        painted.save(output.filePath(QStringLiteral("painter.png")));
+        rendered.save(output.filePath(QStringLiteral("opengl.png")));
+        difference.save(output.filePath(QStringLiteral("difference.png")));
+    }
+
+    const qint64 pixels = qint64(painted.width()) * painted.height();
+    const double percent = pixels > 0 ? 100.0 * double(differences) / double(pixels) : 0.0;
+    printf("%lld of %lld pixels differ by more than %d (%.3f%%)\n",
+           differences, pixels, tolerance, percent);
+    if (percent > parser.value(maxDifferencesOption).toDouble()) {
+        fprintf(stderr, "first difference at %d,%d: QPainter #%08x, OpenGL #%08x\n",
+                first.x(), first.y(), painted.pixel(first), rendered.pixel(first));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,217 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+/*
+    terminal-bench
+
+    Replays captured pty output (a vttest dump, `ls -lR`, a compiler log,
+    a `script` recording of htop, ...) through Emulation::receiveData() as
+    fast as possible and reports the throughput of the parser, the screen
+    and the history for each history type.  No display is attached, so the
+    numbers do not include painting.
+
+    Usage: terminal-bench [options] capture...
+*/
+
+// Qt
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextCodec>
+
+// terminal
+#include "History.h"
+#include "Vt102Emulation.h"
+
+// Standard
+#include <cstdio>
+#include <memory>
+
+// System
+#include <sys/resource.h>
+
+using namespace terminal;
+
+namespace {
+struct BenchResult {
+    qint64 bytes = 0;
+    qint64 lines = 0;
+    qint64 nsecs = 0;
+    qint64 peakRss = 0; // in KiB
+};
+
+// Resets the peak resident set size of the process, so that each run
+// reports its own peak instead of the largest one so far.  Linux only,
+// elsewhere the peak of the whole process is reported.
+void resetPeakRss()
+{
+    QFile clearRefs(QStringLiteral("/proc/self/clear_refs"));
+    if (clearRefs.open(QIODevice::WriteOnly)) {
+        clearRefs.write("5");
+    }
+}
+
+qint64 peakRss()
+{
+    QFile status(QStringLiteral("/proc/self/status"));
+    if (status.open(QIODevice::ReadOnly)) {
+        const QList<QByteArray> lines = status.readAll().split('\n');
+        for (const QByteArray &line : lines) {
+            if (line.startsWith("VmHWM:")) {
+                return line.mid(6).trimmed().split(' ').first().toLongLong();
+            }
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+std::unique_ptr<HistoryType> createHistoryType(const QString &name, int historySize)
+{
+    if (name == QLatin1String("none")) {
+        return std::unique_ptr<HistoryType>(new HistoryTypeNone());
+    } else if (name == QLatin1String("compact")) {
+        return std::unique_ptr<HistoryType>(new CompactHistoryType(historySize));
+    } else if (name == QLatin1String("file")) {
+        return std::unique_ptr<HistoryType>(new HistoryTypeFile());
+    } else if (name == QLatin1String("compressed")) {
+        return std::unique_ptr<HistoryType>(new CompressedHistoryType());
+    }
+    return nullptr;
+}
+
+BenchResult run(const QByteArray &capture, const HistoryType &historyType,
+                int lines, int columns, int chunkSize, int repeat)
+{
+    BenchResult result;
+
+    resetPeakRss();
+
+    Vt102Emulation emulation;
+    emulation.setCodec(QTextCodec::codecForName("UTF-8"));
+    emulation.setImageSize(lines, columns);
+    emulation.setHistory(historyType);
+
+    const qint64 newlines = capture.count('\n');
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < repeat; i++) {
+        // feed the data in pieces of the size the pty would deliver them
+        for (int offset = 0; offset < capture.size(); offset += chunkSize) {
+            emulation.receiveData(capture.constData() + offset,
+                                  qMin(chunkSize, capture.size() - offset));
+        }
+        result.bytes += capture.size();
+        result.lines += newlines;
+    }
+    result.nsecs = timer.nsecsElapsed();
+    result.peakRss = peakRss();
+
+    return result;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("terminal-bench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Replays captured terminal output through the emulation and reports its throughput."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("capture"), QStringLiteral("Files containing raw pty output."), QStringLiteral("capture..."));
+
+    const QCommandLineOption historyOption(QStringLiteral("history"),
+                                           QStringLiteral("History types to measure: none, compact, file, compressed or all (default)."),
+                                           QStringLiteral("type"), QStringLiteral("all"));
+    const QCommandLineOption historySizeOption(QStringLiteral("history-size"),
+                                               QStringLiteral("Number of lines kept by the compact history (default 10000)."),
+                                               QStringLiteral("lines"), QStringLiteral("10000"));
+    const QCommandLineOption linesOption(QStringLiteral("lines"),
+                                         QStringLiteral("Screen height (default 50)."),
+                                         QStringLiteral("lines"), QStringLiteral("50"));
+    const QCommandLineOption columnsOption(QStringLiteral("columns"),
+                                           QStringLiteral("Screen width (default 160)."),
+                                           QStringLiteral("columns"), QStringLiteral("160"));
+    const QCommandLineOption chunkOption(QStringLiteral("chunk"),
+                                         QStringLiteral("Bytes passed to each receiveData() call (default 4096)."),
+                                         QStringLiteral("bytes"), QStringLiteral("4096"));
+    const QCommandLineOption repeatOption(QStringLiteral("repeat"),
+                                          QStringLiteral("Number of times each capture is replayed (default 10)."),
+                                          QStringLiteral("count"), QStringLiteral("10"));
+    parser.addOptions({historyOption, historySizeOption, linesOption, columnsOption, chunkOption, repeatOption});
+    parser.process(app);
+
+    const QStringList captures = parser.positionalArguments();
+    if (captures.isEmpty()) {
+        parser.showHelp(1);
+    }
+
+    QStringList historyTypes;
+    if (parser.value(historyOption) == QLatin1String("all")) {
+        historyTypes << QStringLiteral("none") << QStringLiteral("compact") << QStringLiteral("file")
+                     << QStringLiteral("compressed");
+    } else {
+        historyTypes = parser.value(historyOption).split(QLatin1Char(','));
+    }
+
+    const int historySize = qMax(parser.value(historySizeOption).toInt(), 1);
+    const int lines = qMax(parser.value(linesOption).toInt(), 1);
+    const int columns = qMax(parser.value(columnsOption).toInt(), 1);
+    const int chunkSize = qMax(parser.value(chunkOption).toInt(), 1);
+    const int repeat = qMax(parser.value(repeatOption).toInt(), 1);
+
+    printf("%-24s %-8s %10s %12s %14s %12s\n",
+           "capture", "history", "MiB", "MB/s", "lines/s", "peak RSS KiB");
+
+    for (const QString &fileName : captures) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            fprintf(stderr, "terminal-bench: cannot open %s\n", qPrintable(fileName));
+            return 1;
+        }
+        const QByteArray capture = file.readAll();
+
+        for (const QString &name : historyTypes) {
+            const std::unique_ptr<HistoryType> historyType = createHistoryType(name, historySize);
+            if (!historyType) {
+                fprintf(stderr, "terminal-bench: unknown history type %s\n", qPrintable(name));
+                return 1;
+            }
+
+            const BenchResult result = run(capture, *historyType, lines, columns, chunkSize, repeat);
+            const double seconds = qMax(result.nsecs, qint64(1)) / 1e9;
+
+            printf("%-24s %-8s %10.1f %12.1f %14.0f %12lld\n",
+                   qPrintable(QFileInfo(fileName).fileName().left(24)),
+                   qPrintable(name),
+                   result.bytes / (1024.0 * 1024.0),
+                   result.bytes / seconds / 1e6,
+                   result.lines / seconds,
+                   result.peakRss);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,599 @@
+/*
+    This file is part of terminal, an X terminal.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+/*
+    terminal-tokenizer-diff
+
+    Replays escape sequence corpora through the table-driven tokenizer of
+    Vt102Emulation and through the macro-based scanner it replaced, which
+    is kept here, and compares the resulting screens, history included.
+    Besides the captures given on the command line (`script` recordings,
+    vttest dumps, ...), a set of hand-written sequences and a seeded random
+    corpus biased towards escape sequences are replayed.
+
+    Usage: terminal-tokenizer-diff [options] [capture...]
+    Exits with 1 and prints the first differing cell on a mismatch.
+*/
+
+// Qt
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTextCodec>
+#include <QVector>
+
+// terminal
+#include "History.h"
+#include "TerminalCharacterDecoder.h"
+#include "Vt102Emulation.h"
+
+// Standard
+#include <cstdio>
+
+namespace terminal {
+
+// A cell of a screen, with its format resolved so that screens with
+// separate style tables can be compared
+struct Cell {
+    uint character;
+    CharacterColor foreground;
+    CharacterColor background;
+    RenditionFlags rendition;
+    bool isRealCharacter;
+
+    bool operator==(const Cell &other) const
+    {
+        return character == other.character && foreground == other.foreground
+               && background == other.background && rendition == other.rendition
+               && isRealCharacter == other.isRealCharacter;
+    }
+};
+
+struct ScreenLine {
+    QVector<Cell> cells;
+    LineProperty properties;
+
+    bool operator==(const ScreenLine &other) const
+    {
+        return properties == other.properties && cells == other.cells;
+    }
+};
+
+// records the lines written by Screen::writeLinesToStream()
+class ScreenRecorder : public TerminalCharacterDecoder
+{
+public:
+    explicit ScreenRecorder(QVector<ScreenLine> *lines) :
+        _lines(lines)
+    {
+    }
+
+    void begin(QTextStream *) Q_DECL_OVERRIDE
+    {
+    }
+
+    void end() Q_DECL_OVERRIDE
+    {
+    }
+
+    void decodeLine(const Character * const characters, int count,
+                    LineProperty properties) Q_DECL_OVERRIDE
+    {
+        ScreenLine line;
+        line.properties = properties;
+        line.cells.reserve(count);
+        for (int i = 0; i < count; i++) {
+            const Character &c = characters[i];
+            line.cells.append({ c.character, c.foregroundColor(), c.backgroundColor(),
+                                c.rendition(), c.isRealCharacter != 0 });
+        }
+        _lines->append(line);
+    }
+
+private:
+    QVector<ScreenLine> *_lines;
+};
+
+// The state of both screens of an emulation
+struct Snapshot {
+    QVector<ScreenLine> lines[2];
+    int cursorX[2];
+    int cursorY[2];
+    int currentScreen;
+};
+
+class TestEmulation : public Vt102Emulation
+{
+public:
+    Snapshot snapshot() const
+    {
+        Snapshot snapshot;
+        for (int i = 0; i < 2; i++) {
+            const Screen *screen = _screen[i];
+            ScreenRecorder recorder(&snapshot.lines[i]);
+            screen->writeLinesToStream(&recorder, 0, screen->getHistLines() + screen->getLines() - 1);
+            snapshot.cursorX[i] = screen->getCursorX();
+            snapshot.cursorY[i] = screen->getCursorY();
+        }
+        snapshot.currentScreen = _currentScreen == _screen[1] ? 1 : 0;
+        return snapshot;
+    }
+};
+
+/*
+    The scanner of Vt102Emulation before the transition table, which deduced
+    its state from the token scanned so far.  It is kept unchanged apart from
+    the character class table, which is built once instead of per emulation.
+*/
+class LegacyVt102Emulation : public TestEmulation
+{
+protected:
+    void receiveChar(uint cc) Q_DECL_OVERRIDE;
+
+    // every printable character goes through receiveChar(), as it used to
+    void receivePrintableChars(const uint *chars, int count) Q_DECL_OVERRIDE
+    {
+        Emulation::receivePrintableChars(chars, count);
+    }
+};
+}
+
+using namespace terminal;
+
+namespace {
+constexpr int token_construct(int t, int a, int n)
+{
+    return (((n & 0xffff) << 16) | ((a & 0xff) << 8) | (t & 0xff));
+}
+constexpr int token_chr()
+{
+    return token_construct(0, 0, 0);
+}
+constexpr int token_ctl(int a)
+{
+    return token_construct(1, a, 0);
+}
+constexpr int token_esc(int a)
+{
+    return token_construct(2, a, 0);
+}
+constexpr int token_esc_cs(int a, int b)
+{
+    return token_construct(3, a, b);
+}
+constexpr int token_esc_de(int a)
+{
+    return token_construct(4, a, 0);
+}
+constexpr int token_csi_ps(int a, int n)
+{
+    return token_construct(5, a, n);
+}
+constexpr int token_csi_pn(int a)
+{
+    return token_construct(6, a, 0);
+}
+constexpr int token_csi_pr(int a, int n)
+{
+    return token_construct(7, a, n);
+}
+constexpr int token_vt52(int a)
+{
+    return token_construct(8, a, 0);
+}
+constexpr int token_csi_pg(int a)
+{
+    return token_construct(9, a, 0);
+}
+constexpr int token_csi_pe(int a)
+{
+    return token_construct(10, a, 0);
+}
+constexpr int token_csi_sp(int a)
+{
+    return token_construct(11, a, 0);
+}
+constexpr int token_csi_psp(int a, int n)
+{
+    return token_construct(12, a, n);
+}
+
+// Character Class flags used while decoding
+const int CTL = 1;   // Control character
+const int CHR = 2;   // Printable character
+const int CPN = 4;   // TODO: Document me
+const int DIG = 8;   // Digit
+const int SCS = 16;  // Select Character Set
+const int GRP = 32;  // TODO: Document me
+const int CPS = 64;  // Character which indicates end of window resize
+
+struct CharClassTable {
+    int entry[256];
+
+    CharClassTable()
+    {
+        int i;
+        const quint8 *s;
+        for (i = 0; i < 256; ++i) {
+            entry[i] = 0;
+        }
+        for (i = 0; i < 32; ++i) {
+            entry[i] |= CTL;
+        }
+        for (i = 32; i < 256; ++i) {
+            entry[i] |= CHR;
+        }
+        for (s = (const quint8 *)"@ABCDGHILMPSTXZbcdfry"; *s != 0u; ++s) {
+            entry[*s] |= CPN;
+        }
+        // resize = \e[8;<row>;<col>t
+        for (s = (const quint8 *)"t"; *s != 0u; ++s) {
+            entry[*s] |= CPS;
+        }
+        for (s = (const quint8 *)"0123456789"; *s != 0u; ++s) {
+            entry[*s] |= DIG;
+        }
+        for (s = (const quint8 *)"()+*%"; *s != 0u; ++s) {
+            entry[*s] |= SCS;
+        }
+        for (s = (const quint8 *)"()+*#[]%"; *s != 0u; ++s) {
+            entry[*s] |= GRP;
+        }
+    }
+};
+
+const CharClassTable charClassTable;
+const int *const charClass = charClassTable.entry;
+}
+
+#define lec(P,L,C) (p == (P) && s[(L)] == (C))
+#define lun(     ) (p ==  1  && cc >= 32 )
+#define les(P,L,C) (p == (P) && s[L] < 256 && (charClass[s[(L)]] & (C)) == (C))
+#define eec(C)     (p >=  3  && cc == (C))
+#define ees(C)     (p >=  3  && cc < 256 && (charClass[cc] & (C)) == (C))
+#define eps(C)     (p >=  3  && s[2] != '?' && s[2] != '!' && s[2] != '>' && cc < 256 && (charClass[cc] & (C)) == (C))
+#define epp( )     (p >=  3  && s[2] == '?')
+#define epe( )     (p >=  3  && s[2] == '!')
+#define egt( )     (p >=  3  && s[2] == '>')
+#define esp( )     (p >=  4  && s[2] == SP )
+#define epsp( )    (p >=  5  && s[3] == SP )
+#define Xpe        (tokenBufferPos >= 2 && tokenBuffer[1] == ']')
+#define Xte        (Xpe      && (cc ==  7 || cc == 27))
+#define ces(C)     (cc < 256 && (charClass[cc] & (C)) == (C) && !Xte)
+#define dcs        (p >= 2   && s[0] == ESC && s[1] == 'P')
+
+#define CNTL(c) ((c)-'@')
+static const int ESC = 27;
+static const int DEL = 127;
+static const int SP  = 32;
+
+// process an incoming unicode character
+void LegacyVt102Emulation::receiveChar(uint cc)
+{
+  if (cc == DEL) {
+    return; //VT100: ignore.
+  }
+
+  if (ces(CTL))
+  {
+    // ignore control characters in the text part of Xpe (aka OSC) "ESC]"
+    // escape sequences; this matches what XTERM docs say
+    if (Xpe) {
+        return;
+    }
+
+    // DEC HACK ALERT! Control Characters are allowed *within* esc sequences in VT100
+    // This means, they do neither a resetTokenizer() nor a pushToToken(). Some of them, do
+    // of course. Guess this originates from a weakly layered handling of the X-on
+    // X-off protocol, which comes really below this level.
+    if (cc == CNTL('X') || cc == CNTL('Z') || cc == ESC) {
+        resetTokenizer(); //VT100: CAN or SUB
+    }
+    if (cc != ESC)
+    {
+        processToken(token_ctl(cc+'@'), 0, 0);
+        return;
+    }
+  }
+  // advance the state
+  addToCurrentToken(cc);
+
+  int* s = tokenBuffer;
+  const int  p = tokenBufferPos;
+
+  if (getMode(MODE_Ansi))
+  {
+    if (lec(1,0,ESC)) { return; }
+    if (lec(1,0,ESC+128)) { s[0] = ESC; receiveChar('['); return; }
+    if (les(2,1,GRP)) { return; }
+    if (Xte         ) { processSessionAttributeRequest(); resetTokenizer(); return; }
+    if (Xpe         ) { return; }
+    if (lec(3,2,'?')) { return; }
+    if (lec(3,2,'>')) { return; }
+    if (lec(3,2,'!')) { return; }
+    if (lec(3,2,SP )) { return; }
+    if (lec(4,3,SP )) { return; }
+    if (lun(       )) { processToken(token_chr(), applyCharset(cc), 0);   resetTokenizer(); return; }
+    if (dcs         ) { return; /* TODO We don't xterm DCS, so we just eat it */ }
+    if (lec(2,0,ESC)) { processToken(token_esc(s[1]), 0, 0);              resetTokenizer(); return; }
+    if (les(3,1,SCS)) { processToken(token_esc_cs(s[1],s[2]), 0, 0);      resetTokenizer(); return; }
+    if (lec(3,1,'#')) { processToken(token_esc_de(s[2]), 0, 0);           resetTokenizer(); return; }
+    if (eps(    CPN)) { processToken(token_csi_pn(cc), argv[0],argv[1]);  resetTokenizer(); return; }
+
+    // resize = \e[8;<row>;<col>t
+    if (eps(CPS))
+    {
+        processToken(token_csi_ps(cc, argv[0]), argv[1], argv[2]);
+        resetTokenizer();
+        return;
+    }
+
+    if (epe(   )) { processToken(token_csi_pe(cc), 0, 0); resetTokenizer(); return; }
+
+    if (esp (   )) { processToken(token_csi_sp(cc), 0, 0);           resetTokenizer(); return; }
+    if (epsp(   )) { processToken(token_csi_psp(cc, argv[0]), 0, 0); resetTokenizer(); return; }
+
+    if (ees(DIG)) { addDigit(cc-'0'); return; }
+    if (eec(';')) { addArgument();    return; }
+    for (int i = 0; i <= argc; i++)
+    {
+        if (epp()) {
+            processToken(token_csi_pr(cc,argv[i]), 0, 0);
+        } else if (egt()) {
+            processToken(token_csi_pg(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
+        } else if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
+        {
+            // ESC[ ... 48;2;<red>;<green>;<blue> ... m -or- ESC[ ... 38;2;<red>;<green>;<blue> ... m
+            i += 2;
+            processToken(token_csi_ps(cc, argv[i-2]), COLOR_SPACE_RGB, (argv[i] << 16) | (argv[i+1] << 8) | argv[i+2]);
+            i += 2;
+        }
+        else if (cc == 'm' && argc - i >= 2 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 5)
+        {
+            // ESC[ ... 48;5;<index> ... m -or- ESC[ ... 38;5;<index> ... m
+            i += 2;
+            processToken(token_csi_ps(cc, argv[i-2]), COLOR_SPACE_256, argv[i]);
+        } else {
+            processToken(token_csi_ps(cc,argv[i]), 0, 0);
+        }
+    }
+    resetTokenizer();
+  } else {
+    // VT52 Mode
+    if (lec(1,0,ESC)) {
+        return;
+    }
+    if (les(1,0,CHR))
+    {
+        processToken(token_chr(), s[0], 0);
+        resetTokenizer();
+        return;
+    }
+    if (lec(2,1,'Y')) {
+        return;
+    }
+    if (lec(3,1,'Y')) {
+        return;
+    }
+    if (p < 4)
+    {
+        processToken(token_vt52(s[1] ), 0, 0);
+        resetTokenizer();
+        return;
+    }
+    processToken(token_vt52(s[1]), s[2], s[3]);
+    resetTokenizer();
+    return;
+  }
+}
+
+namespace {
+// Sequences which the old scanner handled in peculiar ways
+const char *const HAND_WRITTEN[] = {
+    "plain text\r\nsecond line\r\n",
+    "\x1b[1;31mred\x1b[0m \x1b[38;5;208m256\x1b[48;2;10;20;30mrgb\x1b[m\r\n",
+    "\x1b[38;2;1;2m\x1b[48;5m\x1b[38;2;1;2;3;4;5;6m short and long color arguments\r\n",
+    "\x1b[2J\x1b[H\x1b[5;10Hmoved\x1b[3Aup\x1b[2Bdown\x1b[4Cright\x1b[1Dleft\x1b[K\x1b[1K\x1b[2K",
+    "\x1b[?1049hsecondary screen\x1b[?25l\x1b[?1049lprimary\x1b[?25h",
+    "\x1b[5P\x1b[3@\x1b[2X\x1b[2L\x1b[2M\x1b[2S\x1b[2T\x1b[3b\x1b[3Z\x1b[2I",
+    "\x1b[8;30;100t\x1b[22;0t\x1b[23;0t",
+    "\x1b]0;title\x07\x1b]2;title with \x1b\\ST\x1b]1;\x08\x09ignored controls\x07",
+    "\x1bP1$r\x1b\\ DCS eaten",
+    "\x1b(0lqqk\x1b(B \x1b)0\x0e" "abc\x0f \x1b#8\x1b#3double\x1b#6wide\x1b#5",
+    "\x1b%G\x1b*0\x1b+A",
+    "\x1b[?7l no wrap no wrap no wrap no wrap no wrap no wrap no wrap no wrap no wrap no wrap\x1b[?7h",
+    "\x1b[>c\x1b[>0c\x1b[!p\x1b[ q\x1b[2 q\x1b[6 q\x1b[c\x1b[5n\x1b[6n",
+    "\x1b[1;2;3;4;5;6;7;8;9;10;11;12;13;14;15;16;17;18;19;20m too many arguments",
+    "\x1b[99999999999999C\x1b[99999;99999H overflowing arguments",
+    "\x1b[1\x18m cancelled\x1b[1\x1am substituted\x1b[2\x08" "0m control inside CSI",
+    "\x1b[?2l\x1b" "A\x1b" "B\x1bY  vt52\x1bY%/cup\x1b" "F\x1bG\x1b<ansi again",
+    "\xc2\x9b" "1mC1 CSI\xc2\x9b" "0m \xc3\xa9t\xc3\xa9 \xe4\xb8\xad\xe6\x96\x87 \xf0\x9f\x98\x80 e\xcc\x81\r\n",
+    "tab\tstop\x1bH\r\x1b[3g\x1b[0g\ttab\r\n\x1b" "D\x1bM\x1b" "E\x1b" "7\x1b" "8\x1b=\x1b>\x1b" "c",
+    "\x1b[3;10r\x1b[10;1H\n\n\n\n\x1b[r\x1b[4h insert\x1b[4l\x1b[20h\n\x1b[20l",
+};
+
+// Returns a random corpus of escape sequences, control characters and
+// text which mostly continue each other in plausible ways
+QByteArray randomCorpus(quint32 seed, int size)
+{
+    static const char *const pieces[] = {
+        "\x1b", "\x1b[", "\x1b]", "\x1bP", "\x1b(", "\x1b)", "\x1b#", "\x1b%", "\x1b[?", "\x1b[>", "\x1b[!",
+        "\xc2\x9b", "0", "1", "2", "3", "5", "7", "9", "38", "48", ";", ";5;", ";2;", "m", "H", "J", "K",
+        "A", "B", "C", "D", "P", "@", "X", "L", "M", "r", "t", "h", "l", "c", "q", " ", "\\", "?", ">",
+        "!", "$", "Y", "\x07", "\x08", "\x09", "\x0a", "\x0d", "\x0e", "\x0f", "\x18", "\x1a", "\x7f",
+        "\x1b[?2l", "\x1b<", "\x1b[?1049h", "\x1b[?1049l", "\x1b[?7l", "\x1b[?7h",
+        "text", "longer text to wrap around the line ", "\xc3\xa9", "\xe4\xb8\xad", "\xf0\x9f\x98\x80",
+        "\xcc\x81", "\xff", "\xc3",
+    };
+    const int pieceCount = int(sizeof(pieces) / sizeof(pieces[0]));
+
+    QRandomGenerator random(seed);
+    QByteArray corpus;
+    corpus.reserve(size + 16);
+    while (corpus.size() < size) {
+        corpus.append(pieces[random.bounded(pieceCount)]);
+    }
+    return corpus;
+}
+
+QString describe(const Cell &cell)
+{
+    return QStringLiteral("U+%1 rendition %2%3")
+           .arg(cell.character, 4, 16, QLatin1Char('0'))
+           .arg(cell.rendition, 0, 16)
+           .arg(cell.isRealCharacter ? QString() : QStringLiteral(" placeholder"));
+}
+
+// Returns a description of the first difference, or an empty string
+QString compare(const Snapshot &expected, const Snapshot &actual)
+{
+    if (expected.currentScreen != actual.currentScreen) {
+        return QStringLiteral("current screen %1, expected %2").arg(actual.currentScreen).arg(expected.currentScreen);
+    }
+    for (int i = 0; i < 2; i++) {
+        const QVector<ScreenLine> &e = expected.lines[i];
+        const QVector<ScreenLine> &a = actual.lines[i];
+        if (e.size() != a.size()) {
+            return QStringLiteral("screen %1 has %2 lines, expected %3").arg(i).arg(a.size()).arg(e.size());
+        }
+        for (int y = 0; y < e.size(); y++) {
+            if (e[y] == a[y]) {
+                continue;
+            }
+            if (e[y].properties != a[y].properties) {
+                return QStringLiteral("screen %1 line %2 has properties %3, expected %4")
+                       .arg(i).arg(y).arg(int(a[y].properties)).arg(int(e[y].properties));
+            }
+            if (e[y].cells.size() != a[y].cells.size()) {
+                return QStringLiteral("screen %1 line %2 has %3 cells, expected %4")
+                       .arg(i).arg(y).arg(a[y].cells.size()).arg(e[y].cells.size());
+            }
+            for (int x = 0; x < e[y].cells.size(); x++) {
+                if (!(e[y].cells[x] == a[y].cells[x])) {
+                    return QStringLiteral("screen %1 line %2 column %3 is %4, expected %5")
+                           .arg(i).arg(y).arg(x).arg(describe(a[y].cells[x]), describe(e[y].cells[x]));
+                }
+            }
+        }
+        if (expected.cursorX[i] != actual.cursorX[i] || expected.cursorY[i] != actual.cursorY[i]) {
+            return QStringLiteral("screen %1 cursor at %2,%3, expected %4,%5")
+                   .arg(i).arg(actual.cursorX[i]).arg(actual.cursorY[i])
+                   .arg(expected.cursorX[i]).arg(expected.cursorY[i]);
+        }
+    }
+    return QString();
+}
+
+// Replays a corpus through both scanners in pieces of 'chunkSize' bytes
+// and returns the first difference between their screens
+QString replay(const QByteArray &corpus, int chunkSize)
+{
+    LegacyVt102Emulation legacy;
+    TestEmulation current;
+    TestEmulation *emulations[] = { &legacy, &current };
+    for (TestEmulation *emulation : emulations) {
+        emulation->setCodec(QTextCodec::codecForName("UTF-8"));
+        emulation->setImageSize(24, 80);
+        emulation->setHistory(CompactHistoryType(1000));
+    }
+
+    for (int offset = 0; offset < corpus.size(); offset += chunkSize) {
+        const int length = qMin(chunkSize, corpus.size() - offset);
+        for (TestEmulation *emulation : emulations) {
+            emulation->receiveData(corpus.constData() + offset, length);
+        }
+    }
+
+    return compare(legacy.snapshot(), current.snapshot());
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("terminal-tokenizer-diff"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Compares the screens produced by the current and the previous escape sequence tokenizer."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("capture"), QStringLiteral("Files containing raw pty output."), QStringLiteral("[capture...]"));
+
+    const QCommandLineOption seedOption(QStringLiteral("seed"),
+                                        QStringLiteral("Seed of the first random corpus (default 1)."),
+                                        QStringLiteral("seed"), QStringLiteral("1"));
+    const QCommandLineOption countOption(QStringLiteral("random"),
+                                         QStringLiteral("Number of random corpora (default 200)."),
+                                         QStringLiteral("count"), QStringLiteral("200"));
+    const QCommandLineOption sizeOption(QStringLiteral("random-size"),
+                                        QStringLiteral("Size of each random corpus in bytes (default 16384)."),
+                                        QStringLiteral("bytes"), QStringLiteral("16384"));
+    parser.addOptions({seedOption, countOption, sizeOption});
+    parser.process(app);
+
+    struct Corpus {
+        QString name;
+        QByteArray data;
+    };
+    QVector<Corpus> corpora;
+
+    QByteArray handWritten;
+    for (const char *sequence : HAND_WRITTEN) {
+        corpora.append({ QStringLiteral("hand-written: %1").arg(QString::fromLatin1(QByteArray(sequence).toPercentEncoding())),
+                         QByteArray(sequence) });
+        handWritten.append(sequence);
+    }
+    corpora.append({ QStringLiteral("hand-written, all"), handWritten });
+
+    const quint32 seed = parser.value(seedOption).toUInt();
+    const int randomCount = qMax(parser.value(countOption).toInt(), 0);
+    const int randomSize = qMax(parser.value(sizeOption).toInt(), 1);
+    for (int i = 0; i < randomCount; i++) {
+        corpora.append({ QStringLiteral("random, --seed %1 --random 1").arg(seed + quint32(i)),
+                         randomCorpus(seed + quint32(i), randomSize) });
+    }
+
+    for (const QString &fileName : parser.positionalArguments()) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            fprintf(stderr, "terminal-tokenizer-diff: cannot open %s\n", qPrintable(fileName));
+            return 1;
+        }
+        corpora.append({ fileName, file.readAll() });
+    }
+
+    // sequences split across receiveData() calls must come out the same
+    const int chunkSizes[] = { 1, 7, 4096 };
+
+    int failures = 0;
+    for (const Corpus &corpus : corpora) {
+        for (int chunkSize : chunkSizes) {
+            const QString difference = replay(corpus.data, chunkSize);
+            if (!difference.isEmpty()) {
+                fprintf(stderr, "%s, chunks of %d bytes: %s\n",
+                        qPrintable(corpus.name), chunkSize, qPrintable(difference));
+                failures++;
+                break;
+            }
+        }
+    }
+
+    printf("%d of %d corpora differ\n", failures, int(corpora.size()));
+    return failures == 0 ? 0 : 1;
+}
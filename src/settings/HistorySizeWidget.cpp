@@ -50,6 +50,7 @@ HistorySizeWidget::HistorySizeWidget(QWidget *parent) :
     modeGroup->addButton(_ui->noHistoryButton);
     modeGroup->addButton(_ui->fixedSizeHistoryButton);
     modeGroup->addButton(_ui->unlimitedHistoryButton);
+    modeGroup->addButton(_ui->compressedHistoryButton);
     connect(modeGroup,
             static_cast<void (QButtonGroup::*)(QAbstractButton *)>(&QButtonGroup::buttonClicked),
             this, &terminal::HistorySizeWidget::buttonClicked);
@@ -90,6 +91,7 @@ HistorySizeWidget::HistorySizeWidget(QWidget *parent) :
     const int radioButtonHeight = _ui->fixedSizeHistoryWrapper->sizeHint().height();
     _ui->noHistoryButton->setMinimumHeight(radioButtonHeight);
     _ui->unlimitedHistoryButton->setMinimumHeight(radioButtonHeight);
+    _ui->compressedHistoryButton->setMinimumHeight(radioButtonHeight);
 }
 
 HistorySizeWidget::~HistorySizeWidget()
@@ -111,6 +113,8 @@ void HistorySizeWidget::setMode(Enum::HistoryModeEnum aMode)
         _ui->fixedSizeHistoryButton->setChecked(true);
     } else if (aMode == Enum::UnlimitedHistory) {
         _ui->unlimitedHistoryButton->setChecked(true);
+    } else if (aMode == Enum::CompressedHistory) {
+        _ui->compressedHistoryButton->setChecked(true);
     }
 }
 
@@ -122,6 +126,8 @@ Enum::HistoryModeEnum HistorySizeWidget::mode() const
         return Enum::FixedSizeHistory;
     } else if (_ui->unlimitedHistoryButton->isChecked()) {
         return Enum::UnlimitedHistory;
+    } else if (_ui->compressedHistoryButton->isChecked()) {
+        return Enum::CompressedHistory;
     }
 
     Q_ASSERT(false);